@@ -28,6 +28,10 @@ namespace display
         None = 0,
         Training,
         Testing,
+        Evaluating,
+
+        // Stop was pressed, the workers are still finishing
+        Stopping,
     };
 
 
@@ -39,6 +43,8 @@ namespace display
         MLStatus ai_status = MLStatus::None;
 
         mlai::AI_State ai_state{};
+        mlai::LoadProgress ai_load_progress;
+        mlai::QuantReport ai_quant_report;
 
         img::Image input_image;
         img::SubView input_view;
@@ -153,7 +159,7 @@ namespace internal
     static bool load_data(DisplayState& state)
     {
         auto& ai = state.ai_state;
-        if (!mlai::load_data(ai, state.ai_files))
+        if (!mlai::load_data(ai, state.ai_files, state.ai_load_progress))
         {
             sdl::display_error("Train/test data unavailable");
             return false;
@@ -231,33 +237,74 @@ namespace internal
     }
 
 
-    static void start_ai_training(DisplayState& state)
+    static void file_progress(mlai::FileProgress const& fp)
     {
-        state.ai_status = MLStatus::Training;
+        using LS = mlai::LoadStage;
+
+        auto stage = fp.stage.load();
+        auto done = fp.bytes_done.load();
+        auto total = fp.bytes_total.load();
+
+        cstr msg = "";
+        switch (stage)
+        {
+        case LS::Reading:
+            msg = "Reading";
+            break;
+
+        case LS::Features:
+            msg = "Features";
+            break;
+
+        case LS::Done:
+            msg = "Done";
+            break;
+
+        case LS::Fail:
+            msg = "ERROR";
+            break;
+
+        default:
+            msg = "";
+            break;
+        }
+
+        auto fraction = total ? (f32)((f64)done / total) : (stage == LS::Done ? 1.0f : 0.0f);
+
+        ImGui::ProgressBar(fraction, ImVec2(120.0f, 0.0f));
+        ImGui::Text("%s %.1f/%.1f MB", msg, done / 1.0e6, total / 1.0e6);
+    }
 
+
+    static void start_ai_training(DisplayState& state)
+    {
         auto const condition = [&](){ return state.ai_status == MLStatus::Training; };
 
         mlai::train(state.ai_state, condition);
+
+        // the workers and the checkpoint writer are joined
+        state.ai_status = MLStatus::None;
     }
 
 
     static void start_ai_training_async(DisplayState& state)
     {
+        state.ai_status = MLStatus::Training;
+
         std::thread th([&](){ start_ai_training(state); });
         th.detach();
     }
 
 
+    // the status is None once the running thread has returned
     static void stop_ai(DisplayState& state)
     {
-        state.ai_status = MLStatus::None;
+        state.ai_status = MLStatus::Stopping;
     }
 
 
     static void run_ai_test(DisplayState& state)
     {
-        state.ai_status = MLStatus::Testing;
-
         auto const condition = [&](){ return state.ai_status == MLStatus::Testing; };
         
         mlai::test(state.ai_state, condition);
@@ -268,15 +315,114 @@ namespace internal
 
     static void run_ai_test_async(DisplayState& state)
     {
+        state.ai_status = MLStatus::Testing;
+
         std::thread th([&](){ run_ai_test(state); });
         th.detach();
     }
 
 
+    static void run_ai_evaluate_async(DisplayState& state)
+    {
+        state.ai_status = MLStatus::Evaluating;
+
+        auto const evaluate = [&]()
+        {
+            auto& ai = state.ai_state;
+            auto n_threads = std::thread::hardware_concurrency();
+
+            ai.test_report = mlai::evaluate(ai, n_threads);
+
+            state.ai_status = MLStatus::None;
+        };
+
+        std::thread th(evaluate);
+        th.detach();
+    }
+
+
+    static void run_ai_compare_async(DisplayState& state, mlai::Precision precision)
+    {
+        state.ai_status = MLStatus::Evaluating;
+
+        auto const compare = [&, precision]()
+        {
+            auto& ai = state.ai_state;
+            auto n_threads = std::thread::hardware_concurrency();
+
+            state.ai_quant_report = mlai::compare(ai, n_threads, precision);
+
+            state.ai_status = MLStatus::None;
+        };
+
+        std::thread th(compare);
+        th.detach();
+    }
+
+
+    static void confusion_table(mlai::TestReport const& report)
+    {
+        auto n = report.n_classes;
+
+        int table_flags = ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit;
+
+        if (!n || !ImGui::BeginTable("##ConfusionTable", (int)n + 1, table_flags))
+        {
+            return;
+        }
+
+        ImGui::TableNextRow();
+        ImGui::TableSetColumnIndex(0);
+        ImGui::TextDisabled("exp\\pred");
+
+        for (u32 p = 0; p < n; p++)
+        {
+            ImGui::TableSetColumnIndex((int)p + 1);
+            ImGui::TextDisabled("%u", p);
+        }
+
+        for (u32 e = 0; e < n; e++)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::TextDisabled("%u", e);
+
+            for (u32 p = 0; p < n; p++)
+            {
+                ImGui::TableSetColumnIndex((int)p + 1);
+
+                auto count = report.confusion[e][p];
+                if (e == p)
+                {
+                    ImGui::Text("%u", count);
+                }
+                else if (count)
+                {
+                    ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%u", count);
+                }
+                else
+                {
+                    ImGui::TextDisabled("0");
+                }
+            }
+        }
+
+        ImGui::EndTable();
+    }
+
+
+    // evaluate and compare threads read mlp, mlp_int8 and mlp_half until they set None
     static void reset_ai(DisplayState& state)
     {
-        stop_ai(state);
+        if (state.ai_status != MLStatus::None)
+        {
+            return;
+        }
+
         mlp::destroy(state.ai_state.mlp);
+        mlp::destroy(state.ai_state.mlp_int8);
+        mlp::destroy(state.ai_state.mlp_half);
+        cnn::destroy(state.ai_state.conv);
     }
 
 
@@ -285,7 +431,15 @@ namespace internal
         auto& topology = state.ai_state.topology;
         auto& mlp = state.ai_state.mlp;
 
+        auto& conv_topology = state.ai_state.conv_topology;
+        if (conv_topology.n_layers)
+        {
+            cnn::create(state.ai_state.conv, conv_topology);
+        }
+
         mlp::create(mlp, topology);
+
+        state.ai_state.train_sample = 0;
     }
 
 } // internal
@@ -341,26 +495,32 @@ namespace display
         ImGui::SameLine();
         ImGui::Text("%s", msg);
 
+        ImGui::Text("SIMD: %s", span::simd_level_str(span::simd_level()));
+
         ImGui::BeginGroup();
         internal::image_data_properties(state.ai_state.train_image_data, "Training data");
+        internal::file_progress(state.ai_load_progress.files[(int)mlai::DataFile::TrainImages]);
         ImGui::EndGroup();
 
         ImGui::SameLine();
 
         ImGui::BeginGroup();
         internal::image_data_properties(state.ai_state.test_image_data, "Testing data");
+        internal::file_progress(state.ai_load_progress.files[(int)mlai::DataFile::TestImages]);
         ImGui::EndGroup();
 
         ImGui::SameLine();
 
         ImGui::BeginGroup();
         internal::label_data_properties(state.ai_state.train_label_data, "Training labels");
+        internal::file_progress(state.ai_load_progress.files[(int)mlai::DataFile::TrainLabels]);
         ImGui::EndGroup();
 
         ImGui::SameLine();
 
         ImGui::BeginGroup();
         internal::label_data_properties(state.ai_state.test_label_data, "Testing labels");
+        internal::file_progress(state.ai_load_progress.files[(int)mlai::DataFile::TestLabels]);
         ImGui::EndGroup();
 
         ImGui::End();
@@ -449,12 +609,23 @@ namespace display
         static int n_inner_layers = layer_size_min;
         static int inner_layers[N] = { 0 };
 
+        // after a net is loaded from a file
+        auto const sync_inner_layers = [&]()
+        {
+            n_inner_layers = (int)topology.get_inner_layers();
+            for (int i = 0; i < n_inner_layers; i++)
+            {
+                inner_layers[i] = (int)topology.get_inner_size_at({ u8(i) });
+            }
+        };
+
         if (is_disabled) { ImGui::BeginDisabled(); }
 
         ImGui::Text("Train label(s)");
         ImGui::SameLine();
 
-        static int train_option = mlai::TRAIN_ALL_LABELS;
+        // ai is changed when a training state is loaded
+        int train_option = ai.train_label;
         ImGui::RadioButton("All", &train_option, mlai::TRAIN_ALL_LABELS);
         char train_option_rb_label[2] { '0', 0 };
         for (int i = 0; i < 10; i++)
@@ -476,6 +647,29 @@ namespace display
             topology.set_output_size(2);
         }
 
+        static int n_conv_layers = 0;
+        static int n_conv_filters = 8;
+
+        ImGui::Text("Conv layers");
+        ImGui::SameLine();
+        internal::HelpMarker("5x5 convolutions + reLU + 2x2 max-pool on the raw pixels.\nThey replace the fixed gradient features and train on one thread.");
+        ImGui::SliderInt("##ConvLayers", &n_conv_layers, 0, 2);
+        ImGui::SliderInt("Filters##ConvFilters", &n_conv_filters, 1, 32);
+
+        auto& conv_topology = ai.conv_topology;
+        conv_topology.n_layers = (u32)n_conv_layers;
+
+        for (u32 i = 0; i < conv_topology.n_layers; i++)
+        {
+            conv_topology.layers[i].n_filters = (u32)n_conv_filters;
+        }
+
+        auto n_features = conv_topology.n_layers ? cnn::output_size(conv_topology) : ai.train_features.width;
+        if (data_loaded)
+        {
+            topology.set_input_size(n_features);
+        }
+
         ImGui::Text("Inner layers");
         ImGui::SliderInt("##", &n_inner_layers, 1, (int)N);
 
@@ -510,7 +704,9 @@ namespace display
             topology.set_inner_size_at((u32)inner_layers[i], { u8(i) });
         }
 
-        ImGui::Text("Bytes: %u", mlp::mlp_bytes(topology));
+        auto n_bytes = mlp::mlp_bytes(topology) + (conv_topology.n_layers ? cnn::conv_bytes(conv_topology) : 0);
+
+        ImGui::Text("Bytes: %llu", (unsigned long long)n_bytes);
 
         if (state.ai_data_status == DataStatus::Loaded)
         {
@@ -532,11 +728,120 @@ namespace display
 
         if (memory_allocated)
         {
+            // training, testing and evaluating threads read the nets until they return
+            auto reset_disabled = state.ai_status != MLStatus::None;
+
+            if (reset_disabled) { ImGui::BeginDisabled(); }
+
             ImGui::SameLine();
             if (ImGui::Button("Reset"))
             {
                 internal::reset_ai(state);
             }
+
+            if (reset_disabled) { ImGui::EndDisabled(); }
+        }
+
+        auto model_path = state.ai_files.model_path;
+        if (model_path && data_loaded)
+        {
+            static cstr model_msg = "";
+
+            // weights are not saved while they are being trained, conv layers are not saved at all
+            auto save_disabled = !memory_allocated || state.ai_status != MLStatus::None;
+            auto load_disabled = memory_allocated || conv_topology.n_layers;
+
+            if (save_disabled) { ImGui::BeginDisabled(); }
+
+            if (ImGui::Button("Save model"))
+            {
+                model_msg = mlp::save(mlp, model_path) ? "Saved" : "Save failed";
+            }
+
+            if (save_disabled) { ImGui::EndDisabled(); }
+
+            ImGui::SameLine();
+
+            if (load_disabled) { ImGui::BeginDisabled(); }
+
+            if (ImGui::Button("Load model"))
+            {
+                model_msg = "Load failed";
+
+                if (mlp::load(mlp, model_path))
+                {
+                    auto loaded = mlp.topology;
+
+                    if (loaded.get_input_size() == n_features && loaded.get_output_size() == topology.get_output_size())
+                    {
+                        topology = loaded;
+                        sync_inner_layers();
+
+                        // training starts over with the loaded weights
+                        ai.train_sample = 0;
+
+                        // copies of the weights that were replaced
+                        mlp::destroy(ai.mlp_int8);
+                        mlp::destroy(ai.mlp_half);
+
+                        model_msg = "Loaded";
+                    }
+                    else
+                    {
+                        mlp::destroy(mlp);
+                        model_msg = "Model does not match the data";
+                    }
+                }
+            }
+
+            if (load_disabled) { ImGui::EndDisabled(); }
+
+            ImGui::SameLine();
+            ImGui::Text("%s", model_msg);
+        }
+
+        auto state_path = state.ai_files.state_path;
+        if (state_path && data_loaded)
+        {
+            static cstr state_msg = "";
+
+            // the checkpoint writer uses the same file until training has returned
+            auto save_disabled = !memory_allocated || state.ai_status != MLStatus::None || conv_topology.n_layers;
+            auto load_disabled = memory_allocated || state.ai_status != MLStatus::None || conv_topology.n_layers;
+
+            if (save_disabled) { ImGui::BeginDisabled(); }
+
+            if (ImGui::Button("Save state"))
+            {
+                state_msg = mlai::save_state(ai, state_path) ? "Saved" : "Save failed";
+            }
+
+            if (save_disabled) { ImGui::EndDisabled(); }
+
+            ImGui::SameLine();
+
+            if (load_disabled) { ImGui::BeginDisabled(); }
+
+            if (ImGui::Button("Load state"))
+            {
+                state_msg = "Load failed";
+
+                if (mlai::load_state(ai, state_path))
+                {
+                    sync_inner_layers();
+                    state_msg = "Loaded";
+                }
+            }
+
+            if (load_disabled) { ImGui::EndDisabled(); }
+
+            ImGui::SameLine();
+            internal::HelpMarker(
+                "Weights, training settings, position in the sample order and metrics.\n"
+                "Start continues training where it stopped.");
+
+            ImGui::SameLine();
+            ImGui::Text("%s", state_msg);
         }
 
         ImGui::End();
@@ -575,20 +880,122 @@ namespace display
 
         if (stop_disabled) { ImGui::EndDisabled(); }
 
-        constexpr int data_count = 256;
+        if (state.ai_status == MLStatus::Stopping)
+        {
+            ImGui::SameLine();
+            ImGui::Text("Stopping...");
+        }
+
+        constexpr int batch_size_min = 1;
+        constexpr int batch_size_max = 256;
+
+        // settings are read back from ai, a loaded training state replaces them
+        int batch_size = (int)ai.batch_size;
+
+        auto options_disabled = state.ai_status != MLStatus::None;
+
+        if (options_disabled) { ImGui::BeginDisabled(); }
+
+        static int const n_threads_max = (int)num::clamp(std::thread::hardware_concurrency(), 1u, mlai::MAX_TRAIN_THREADS);
+
+        int n_threads = (int)ai.n_threads;
+
+        ImGui::SetNextItemWidth(-100);
+        ImGui::SliderInt("Batch size", &batch_size, batch_size_min, batch_size_max);
+
+        int parallel_mode = (int)ai.parallel_mode;
+
+        ImGui::SetNextItemWidth(-100);
+        ImGui::SliderInt("Threads", &n_threads, 1, n_threads_max);
+
+        ImGui::RadioButton("Hogwild", &parallel_mode, (int)mlai::ParallelMode::Hogwild);
+        ImGui::SameLine();
+        ImGui::RadioButton("Synchronous", &parallel_mode, (int)mlai::ParallelMode::Sync);
+        ImGui::SameLine();
+        internal::HelpMarker(
+            "Hogwild: threads update the shared weights without locking.\n"
+            "Synchronous: each batch is split across the threads, the gradients are summed and applied once. "
+            "Runs with the same settings give identical weights.");
+
+        int shuffle_mode = (int)ai.shuffle_mode;
+
+        ImGui::Text("Shuffle");
+        ImGui::SameLine();
+        ImGui::RadioButton("Off", &shuffle_mode, (int)mlai::ShuffleMode::Off);
+        ImGui::SameLine();
+        ImGui::RadioButton("Full", &shuffle_mode, (int)mlai::ShuffleMode::Full);
+        ImGui::SameLine();
+        ImGui::RadioButton("Blocks", &shuffle_mode, (int)mlai::ShuffleMode::Block);
+        ImGui::SameLine();
+        internal::HelpMarker(
+            "A new sample order every epoch.\n"
+            "Full: any sample can follow any other.\n"
+            "Blocks: blocks of consecutive samples in random order, shuffled within each block. "
+            "Memory is read mostly in order.");
+
+        constexpr int checkpoint_never = 0;
+        constexpr int checkpoint_by_samples = 1;
+        constexpr int checkpoint_by_seconds = 2;
+
+        static int checkpoint_mode = checkpoint_never;
+        static int checkpoint_samples = 60000;
+        static int checkpoint_seconds = 60;
+
+        ImGui::Text("Checkpoint");
+        ImGui::SameLine();
+        ImGui::RadioButton("Never", &checkpoint_mode, checkpoint_never);
+        ImGui::SameLine();
+        ImGui::RadioButton("Samples", &checkpoint_mode, checkpoint_by_samples);
+        ImGui::SameLine();
+        ImGui::RadioButton("Seconds", &checkpoint_mode, checkpoint_by_seconds);
+        ImGui::SameLine();
+        internal::HelpMarker(
+            "The training state is written to the state file while training, Load state continues from it.\n"
+            "It is copied and saved on a background thread, training does not wait for the disk.");
+
+        if (checkpoint_mode == checkpoint_by_samples)
+        {
+            ImGui::SetNextItemWidth(-100);
+            ImGui::InputInt("Every##CheckpointSamples", &checkpoint_samples, 1000, 10000);
+            checkpoint_samples = num::max(checkpoint_samples, 1);
+        }
+        else if (checkpoint_mode == checkpoint_by_seconds)
+        {
+            ImGui::SetNextItemWidth(-100);
+            ImGui::InputInt("Every##CheckpointSeconds", &checkpoint_seconds, 1, 10);
+            checkpoint_seconds = num::max(checkpoint_seconds, 1);
+        }
+
+        if (options_disabled) { ImGui::EndDisabled(); }
+
+        ai.batch_size = (u32)batch_size;
+        ai.n_threads = (u32)n_threads;
+        ai.parallel_mode = (mlai::ParallelMode)parallel_mode;
+        ai.shuffle_mode = (mlai::ShuffleMode)shuffle_mode;
+
+        ai.checkpoint_path = state.ai_files.state_path;
+        ai.checkpoint_samples = checkpoint_mode == checkpoint_by_samples ? (u64)checkpoint_samples : 0;
+        ai.checkpoint_seconds = checkpoint_mode == checkpoint_by_seconds ? (u32)checkpoint_seconds : 0;
+
+        if (checkpoint_mode != checkpoint_never)
+        {
+            ImGui::Text("Checkpoints written: %u", ai.n_checkpoints.load(std::memory_order_relaxed));
+        }
+
+        constexpr int data_count = (int)mlai::TrainHistory::LENGTH;
         constexpr f32 plot_min = 0.0f;
         constexpr f32 plot_max = 1.0f;
         constexpr auto plot_size = ImVec2(0, 80.0f);
         constexpr auto data_stride = sizeof(f32);
 
-        static f32 error_plot_data[data_count] = { 0 };
-
-        static u8 prediction_history[data_count] = { 0 };
-        static u32 total_pred_ok = 0;
-
-        static f32 prediction_plot_data[data_count] = { 0 };
+        // saved with the training state
+        auto& history = ai.train_history;
 
-        static u8 data_offset = 0;
+        auto& error_plot_data = history.error;
+        auto& prediction_history = history.prediction_ok;
+        auto& total_pred_ok = history.total_ok;
+        auto& prediction_plot_data = history.accuracy;
+        auto& data_offset = history.offset;
 
         if (state.ai_status == MLStatus::Training)
         {
@@ -626,6 +1033,22 @@ namespace display
             ImGui::Text("Data %u/%u", ai.data_id, ai.train_image_data.image_count);
             ImGui::SameLine();
             ImGui::Text("Epochs completed: %u", ai.epoch_id);
+
+            f32 total = 0.0f;
+            for (u32 t = 0; t < ai.n_threads; t++)
+            {
+                total += ai.samples_per_sec[t];
+            }
+
+            ImGui::Text("Samples/sec: %.0f", total);
+
+            if (ai.n_threads > 1)
+            {
+                for (u32 t = 0; t < ai.n_threads; t++)
+                {
+                    ImGui::Text(" thread %2u: %.0f", t, ai.samples_per_sec[t]);
+                }
+            }
         }
 
         ImGui::End();
@@ -637,7 +1060,8 @@ namespace display
         auto& ai = state.ai_state;
         auto& mlp = ai.mlp;
 
-        auto start_disabled = !mlp.memory.ok || state.ai_status == MLStatus::Testing;
+        // a test started while training is stopping would be ended by the training thread
+        auto start_disabled = !mlp.memory.ok || state.ai_status != MLStatus::None;
         auto stop_disabled = state.ai_status != MLStatus::Testing;
 
         ImGui::Begin("Test");
@@ -715,6 +1139,128 @@ namespace display
             ImGui::Text("Data %u/%u", ai.data_id, ai.test_image_data.image_count);
         }        
 
+        ImGui::Separator();
+
+        auto eval_disabled = !mlp.memory.ok || state.ai_status != MLStatus::None;
+
+        if (eval_disabled) { ImGui::BeginDisabled(); }
+
+        if (ImGui::Button("Evaluate all"))
+        {
+            internal::run_ai_evaluate_async(state);
+        }
+
+        if (eval_disabled) { ImGui::EndDisabled(); }
+
+        ImGui::SameLine();
+        internal::HelpMarker("Runs the whole test set on all cores");
+
+        auto& report = ai.test_report;
+
+        if (state.ai_status == MLStatus::Evaluating)
+        {
+            ImGui::Text("Evaluating...");
+        }
+        else if (report.n_samples)
+        {
+            ImGui::Text("Accuracy: %.2f%% (%u/%u)", 100.0f * report.accuracy, report.n_correct, report.n_samples);
+            ImGui::Text("Loss: %.4f  Error: %.4f", report.mean_loss, report.mean_error);
+            ImGui::Text("Time: %.3f sec", report.seconds);
+
+            internal::confusion_table(report);
+        }
+
+        ImGui::Separator();
+
+        auto has_int8 = ai.mlp_int8.layers.length > 0;
+        auto has_half = ai.mlp_half.layers.length > 0;
+
+        auto copy_disabled = !mlp.memory.ok || state.ai_status != MLStatus::None;
+
+        if (copy_disabled) { ImGui::BeginDisabled(); }
+
+        if (ImGui::Button("Quantize int8"))
+        {
+            mlai::quantize(ai);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("To f16"))
+        {
+            mlai::to_half(ai, span::HalfFormat::F16);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("To bf16"))
+        {
+            mlai::to_half(ai, span::HalfFormat::BF16);
+        }
+
+        if (copy_disabled) { ImGui::EndDisabled(); }
+
+        ImGui::SameLine();
+        internal::HelpMarker(
+            "Copies of the weights for inference, the f32 weights are the ones that are trained.\n"
+            "int8: a scale per row, the inputs of each layer are quantized per sample.\n"
+            "f16/bf16: half the bytes of f32, the sums stay f32. "
+            "f16 is more precise, bf16 keeps the f32 range. "
+            "There is one half copy at a time.\n"
+            "Training drops the copies, make them again afterwards.");
+
+        auto test_disabled = state.ai_status != MLStatus::None;
+
+        if (test_disabled) { ImGui::BeginDisabled(); }
+
+        int test_precision = (int)ai.test_precision;
+
+        ImGui::Text("Test with");
+        ImGui::SameLine();
+        ImGui::RadioButton("f32", &test_precision, (int)mlai::Precision::F32);
+
+        if (!has_int8) { ImGui::BeginDisabled(); }
+
+        ImGui::SameLine();
+        ImGui::RadioButton("int8", &test_precision, (int)mlai::Precision::Int8);
+        ImGui::SameLine();
+        if (ImGui::Button("Compare int8"))
+        {
+            internal::run_ai_compare_async(state, mlai::Precision::Int8);
+        }
+
+        if (!has_int8) { ImGui::EndDisabled(); }
+
+        if (!has_half) { ImGui::BeginDisabled(); }
+
+        ImGui::SameLine();
+        ImGui::RadioButton(mlai::precision_str(ai, mlai::Precision::Half), &test_precision, (int)mlai::Precision::Half);
+        ImGui::SameLine();
+        if (ImGui::Button("Compare half"))
+        {
+            internal::run_ai_compare_async(state, mlai::Precision::Half);
+        }
+
+        if (!has_half) { ImGui::EndDisabled(); }
+
+        ai.test_precision = (mlai::Precision)test_precision;
+
+        if (test_disabled) { ImGui::EndDisabled(); }
+
+        auto& quant = state.ai_quant_report;
+
+        if (quant.report_quant.n_samples && state.ai_status != MLStatus::Evaluating)
+        {
+            auto& r32 = quant.report_f32;
+            auto& rq = quant.report_quant;
+            auto name = quant.name;
+
+            ImGui::Text("Accuracy f32: %.2f%%  %s: %.2f%%", 100.0f * r32.accuracy, name, 100.0f * rq.accuracy);
+            ImGui::Text("Loss f32: %.4f  %s: %.4f", r32.mean_loss, name, rq.mean_loss);
+            ImGui::Text("Same prediction: %.2f%% (%u/%u)", 100.0f * quant.agreement, quant.n_agree, rq.n_samples);
+            ImGui::Text("Time f32: %.3f sec  %s: %.3f sec (%s)", r32.seconds, name, rq.seconds, quant.kernel);
+            ImGui::Text("Weights f32: %llu bytes  %s: %llu bytes",
+                (unsigned long long)quant.weight_bytes_f32, name, (unsigned long long)quant.weight_bytes_quant);
+        }
+
         ImGui::End();
     }
 
@@ -1,74 +1,1991 @@
 #pragma once
 
 #include "mlai.hpp"
+#include "../../../libs/util/stopwatch.hpp"
+#include "../../../libs/util/rng.hpp"
 
+#include <atomic>
+#include <barrier>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+
+namespace mlai
+{
+    static u32 increment_wrap(u32 value, u32 max_value)
+    {
+        value += 1;
+        return value > max_value ? 0 : value;
+    }
+}
+
+
+/* load progress */
+
+namespace mlai
+{
+    static FileProgress& file_progress(LoadProgress& progress, DataFile file)
+    {
+        return progress.files[(int)file];
+    }
+
+
+    static void start_stage(FileProgress& fp, LoadStage stage, u64 bytes_total)
+    {
+        fp.bytes_done = 0;
+        fp.bytes_total = bytes_total;
+        fp.stage = stage;
+    }
+
+
+    static void add_bytes(FileProgress& fp, u64 n_bytes)
+    {
+        fp.bytes_done.fetch_add(n_bytes, std::memory_order_relaxed);
+    }
+}
+
+
+/* features */
+
+namespace mlai
+{
+    static mlp::Matrix32 push_features(MemoryBuffer<f32>& buffer, u32 n_images, u32 n_features)
+    {
+        mlp::Matrix32 mat{};
+
+        mat.matrix_data_ = mb::push_elements(buffer, (u64)n_images * n_features);
+        mat.width = n_features;
+        mat.height = n_images;
+
+        return mat;
+    }
+
+
+    static void convert_features(mnist::ImageData const& data, mnist::ImageChunk const& chunk, mlp::Matrix32 const& dst, u32 part, u32 n_parts, FileProgress& fp)
+    {
+        constexpr u32 REPORT_IMAGES = 256;
+
+        auto image_bytes = (u64)data.image_width * data.image_height;
+        auto n_images = chunk.end - chunk.begin;
+
+        auto begin = chunk.begin + (u32)((u64)n_images * part / n_parts);
+        auto end = chunk.begin + (u32)((u64)n_images * (part + 1) / n_parts);
+
+        u32 n_report = 0;
+
+        for (u32 id = begin; id < end; id++)
+        {
+            img::gradient_pool(mnist::image_at(data, chunk, id), img::row_span(dst, id));
+
+            if (++n_report == REPORT_IMAGES)
+            {
+                add_bytes(fp, n_report * image_bytes);
+                n_report = 0;
+            }
+        }
+
+        add_bytes(fp, n_report * image_bytes);
+    }
+
+
+    // a streamed file is converted one resident chunk at a time
+    static void convert_features(mnist::ImageData const& data, mlp::Matrix32 const& dst, u32 n_threads, FileProgress& fp)
+    {
+        std::thread threads[MAX_TRAIN_THREADS];
+
+        start_stage(fp, LoadStage::Features, (u64)data.image_count * data.image_width * data.image_height);
+
+        for (u32 id = 0; id < data.image_count;)
+        {
+            auto chunk = mnist::stream_chunk(data, id);
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t] = std::thread([&, t](){ convert_features(data, chunk, dst, t, n_threads, fp); });
+            }
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t].join();
+            }
+
+            id = chunk.end;
+        }
+    }
+
+
+    // converts every image once so that training and testing only read rows
+    static bool compute_features(AI_State& state, u32 w_gradient, u32 h_gradient, LoadProgress& progress)
+    {
+        auto& train = state.train_image_data;
+        auto& test = state.test_image_data;
+
+        auto w_pool = w_gradient / 2;
+        auto h_pool = h_gradient / 2;
+        auto n_features = 2 * w_pool * h_pool;
+
+        u32 n_threads = std::thread::hardware_concurrency();
+        n_threads = n_threads < 1 ? 1 : (n_threads > MAX_TRAIN_THREADS ? MAX_TRAIN_THREADS : n_threads);
+
+        auto n_elements = ((u64)train.image_count + test.image_count) * n_features;
+        if (!mb::create_buffer(state.feature_buffer, n_elements, "cnn features"))
+        {
+            return false;
+        }
+
+        state.train_features = push_features(state.feature_buffer, train.image_count, n_features);
+        state.test_features = push_features(state.feature_buffer, test.image_count, n_features);
+
+        // both sets at once, threads in proportion to the images so that they finish together
+        auto n_images = (u64)train.image_count + test.image_count;
+
+        u32 n_train = 1;
+        u32 n_test = 1;
+
+        if (n_threads > 1)
+        {
+            n_train = (u32)((u64)n_threads * train.image_count / n_images);
+            n_train = n_train < 1 ? 1 : (n_train > n_threads - 1 ? n_threads - 1 : n_train);
+            n_test = n_threads - n_train;
+        }
+
+        auto& train_fp = file_progress(progress, DataFile::TrainImages);
+        auto& test_fp = file_progress(progress, DataFile::TestImages);
+
+        std::thread train_thread([&](){ convert_features(train, state.train_features, n_train, train_fp); });
+        std::thread test_thread([&](){ convert_features(test, state.test_features, n_test, test_fp); });
+
+        train_thread.join();
+        test_thread.join();
+
+        return true;
+    }
+}
+
+
+/* feature cache */
+
+namespace mlai
+{
+    constexpr u32 FEATURE_CACHE_MAGIC = 0x43464C4D; // "MLFC"
+
+    // increment whenever img::gradient_pool output changes
+    constexpr u32 FEATURE_CACHE_VERSION = 2;
+
+    // features start on a page boundary
+    constexpr u32 FEATURE_CACHE_DATA_OFFSET = 4096;
+
+
+    class FeatureCacheHeader
+    {
+    public:
+        u32 magic;
+        u32 version;
+
+        // source image files
+        u64 train_file_size;
+        u64 test_file_size;
+        u64 train_pixel_hash;
+        u64 test_pixel_hash;
+
+        u32 image_width;
+        u32 image_height;
+        u32 gradient_width;
+        u32 gradient_height;
+        u32 pool_width;
+        u32 pool_height;
+
+        // train rows followed by test rows
+        u32 n_features;
+        u32 train_count;
+        u32 test_count;
+
+        u32 data_offset;
+        u64 data_bytes;
+    };
+
+    // no padding, headers are compared with memcmp
+    static_assert(sizeof(FeatureCacheHeader) == 2 * 4 + 4 * 8 + 10 * 4 + 8);
+
+
+    constexpr u64 HASH_SEED = 0xcbf29ce484222325;
+
+
+    // FNV-1a over 8 byte words, continues from h
+    static u64 hash_bytes(u8 const* data, u64 n_bytes, u64 h)
+    {
+        constexpr u64 PRIME = 0x100000001b3;
+
+        u64 i = 0;
+
+        for (; i + 8 <= n_bytes; i += 8)
+        {
+            u64 word;
+            std::memcpy(&word, data + i, sizeof(word));
+            h = (h ^ word) * PRIME;
+        }
+
+        for (; i < n_bytes; i++)
+        {
+            h = (h ^ data[i]) * PRIME;
+        }
+
+        return h;
+    }
+
+
+    // chunks and slices are a multiple of 8 bytes, same hash streamed or mapped
+    static u64 hash_pixels(mnist::ImageData const& data, FileProgress& fp)
+    {
+        constexpr u64 SLICE_BYTES = 1024 * 1024;
+
+        auto image_bytes = (u64)data.image_width * data.image_height;
+
+        start_stage(fp, LoadStage::Reading, data.image_count * image_bytes);
+
+        auto h = HASH_SEED;
+
+        for (u32 id = 0; id < data.image_count;)
+        {
+            auto chunk = mnist::stream_chunk(data, id);
+            auto n_bytes = (chunk.end - chunk.begin) * image_bytes;
+
+            for (u64 offset = 0; offset < n_bytes; offset += SLICE_BYTES)
+            {
+                auto len = n_bytes - offset < SLICE_BYTES ? n_bytes - offset : SLICE_BYTES;
+
+                h = hash_bytes(chunk.pixels + offset, len, h);
+                add_bytes(fp, len);
+            }
+
+            id = chunk.end;
+        }
+
+        return h;
+    }
+
+
+    // pixel hashes are computed while the files are loaded
+    static FeatureCacheHeader make_cache_header(AI_State const& state, DataFiles const& files, u32 w_gradient, u32 h_gradient, u64 train_hash, u64 test_hash)
+    {
+        auto& train = state.train_image_data;
+        auto& test = state.test_image_data;
+
+        FeatureCacheHeader header{};
+
+        header.magic = FEATURE_CACHE_MAGIC;
+        header.version = FEATURE_CACHE_VERSION;
+
+        header.train_file_size = mapped_file::file_size(files.train_data_path);
+        header.test_file_size = mapped_file::file_size(files.test_data_path);
+        header.train_pixel_hash = train_hash;
+        header.test_pixel_hash = test_hash;
+
+        header.image_width = train.image_width;
+        header.image_height = train.image_height;
+        header.gradient_width = w_gradient;
+        header.gradient_height = h_gradient;
+        header.pool_width = w_gradient / 2;
+        header.pool_height = h_gradient / 2;
+
+        header.n_features = 2 * header.pool_width * header.pool_height;
+        header.train_count = train.image_count;
+        header.test_count = test.image_count;
+
+        header.data_offset = FEATURE_CACHE_DATA_OFFSET;
+        header.data_bytes = ((u64)train.image_count + test.image_count) * header.n_features * sizeof(f32);
+
+        return header;
+    }
+
+
+    static bool map_feature_cache(AI_State& state, cstr cache_path, FeatureCacheHeader const& expected)
+    {
+        auto file = mapped_file::map_read(cache_path);
+        if (!file.ok)
+        {
+            return false;
+        }
+
+        auto ok = file.size >= (u64)expected.data_offset + expected.data_bytes &&
+            std::memcmp(file.data, &expected, sizeof(expected)) == 0;
+
+        if (!ok)
+        {
+            mapped_file::unmap(file);
+            return false;
+        }
+
+        auto data = (f32*)(file.data + expected.data_offset);
+
+        state.train_features.matrix_data_ = data;
+        state.train_features.width = expected.n_features;
+        state.train_features.height = expected.train_count;
+
+        state.test_features.matrix_data_ = data + (u64)expected.train_count * expected.n_features;
+        state.test_features.width = expected.n_features;
+        state.test_features.height = expected.test_count;
+
+        state.feature_file = file;
+        mem::tag_file(file.data, cache_path);
+
+        return true;
+    }
+
+
+    static bool write_feature_cache(AI_State const& state, cstr cache_path, FeatureCacheHeader const& header)
+    {
+        char tmp_path[1024];
+        auto len = qsnprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+        if (len <= 0 || len >= (int)sizeof(tmp_path))
+        {
+            return false;
+        }
+
+        std::ofstream file(tmp_path, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        char padding[FEATURE_CACHE_DATA_OFFSET] = { 0 };
+
+        file.write((char*)&header, sizeof(header));
+        file.write(padding, header.data_offset - sizeof(header));
+        file.write((char*)state.feature_buffer.data_, header.data_bytes);
+        file.close();
+
+        if (file.fail())
+        {
+            std::remove(tmp_path);
+            return false;
+        }
+
+        // readers only ever see a complete file
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, cache_path, ec);
+        if (ec)
+        {
+            std::remove(tmp_path);
+            return false;
+        }
+
+        return true;
+    }
+
+
+    static bool create_features(AI_State& state, DataFiles const& files, u32 w_gradient, u32 h_gradient, u64 const* pixel_hashes, LoadProgress& progress)
+    {
+        auto cache_path = files.feature_cache_path;
+        if (!cache_path)
+        {
+            return compute_features(state, w_gradient, h_gradient, progress);
+        }
+
+        auto header = make_cache_header(state, files, w_gradient, h_gradient, pixel_hashes[0], pixel_hashes[1]);
+
+        if (map_feature_cache(state, cache_path, header))
+        {
+            return true;
+        }
+
+        if (!compute_features(state, w_gradient, h_gradient, progress))
+        {
+            return false;
+        }
+
+        // switch to the mapped file so that other instances share the same pages
+        if (write_feature_cache(state, cache_path, header) && map_feature_cache(state, cache_path, header))
+        {
+            mb::destroy_buffer(state.feature_buffer);
+        }
+
+        return true;
+    }
+}
+
+
+/* conv */
+
+namespace mlai
+{
+    static bool has_conv(AI_State const& state)
+    {
+        return state.conv.layers.length > 0 && state.conv.memory.ok;
+    }
+
+
+    // raw pixels scaled to [0, 1], chunk follows data_id through a streamed file
+    static void conv_input(mnist::ImageData const& data, mnist::ImageChunk& chunk, u32 data_id, Span32 const& dst)
+    {
+        constexpr f32 F = 1.0f / 255.0f;
+
+        auto image = mnist::stream_image_at(data, chunk, data_id);
+        auto src = image.matrix_data_;
+
+        assert(dst.length == image.width * image.height);
+
+        for (u32 i = 0; i < dst.length; i++)
+        {
+            dst.data[i] = F * src[i];
+        }
+    }
+}
+
+
+/* sample rate */
+
+namespace mlai
+{
+    class SampleRate
+    {
+    public:
+        Stopwatch sw;
+        u64 n_samples = 0;
+    };
+
+
+    static void start_rate(SampleRate& sr)
+    {
+        sr.n_samples = 0;
+        sr.sw.start();
+    }
+
+
+    static void count_samples(SampleRate& sr, u32 n_samples, f32& samples_per_sec)
+    {
+        constexpr f64 interval_ms = 500.0;
+
+        sr.n_samples += n_samples;
+
+        auto ms = sr.sw.get_time_milli();
+        if (ms >= interval_ms)
+        {
+            samples_per_sec = (f32)(1000.0 * sr.n_samples / ms);
+            start_rate(sr);
+        }
+    }
+}
+
+
+/* training state */
+
+namespace mlai
+{
+    constexpr u32 TRAIN_STATE_MAGIC = 0x53544C4D; // "MLTS"
+
+    // 2: no padding in the header
+    constexpr u32 TRAIN_STATE_VERSION = 2;
+
+    // params start on a page boundary
+    constexpr u32 TRAIN_STATE_PARAM_OFFSET = 4096;
+
+
+    class TrainStateHeader
+    {
+    public:
+        u32 magic;
+        u32 version;
+
+        mlp::NetTopology topology;
+
+        // training data the position refers to
+        u32 train_count;
+        u32 n_features;
+
+        // settings, the same sample order and batches only with the same settings
+        int train_label;
+        u32 batch_size;
+        u32 n_threads;
+        u32 shuffle_block;
+        u32 reserved_0;
+        u64 shuffle_seed;
+        ParallelMode parallel_mode;
+        ShuffleMode shuffle_mode;
+
+        b8 prediction_ok;
+
+        // the history is written by the ui thread, not part of checkpoints
+        b8 has_history;
+        u32 reserved_1;
+
+        u64 train_sample;
+        u32 data_id;
+        u32 epoch_id;
+
+        f32 train_error;
+        f32 test_error;
+
+        TestReport test_report;
+        TrainHistory train_history;
+
+        u64 param_offset;
+        u64 param_count;
+    };
+
+    // no padding, the header is written as is
+    static_assert(sizeof(TestReport) == 6 * 4 + 8 + MAX_CLASSES * MAX_CLASSES * 4);
+    static_assert(sizeof(TrainHistory) == TrainHistory::LENGTH * (4 + 4 + 1) + 4 + 4);
+    static_assert(sizeof(TrainStateHeader) ==
+        2 * 4 + sizeof(mlp::NetTopology) + 7 * 4 + 8 + 4 * 1 + 4 + 8 + 4 * 4 + sizeof(TestReport) + sizeof(TrainHistory) + 2 * 8);
+    static_assert(sizeof(TrainStateHeader) <= TRAIN_STATE_PARAM_OFFSET);
+
+
+    // everything but the position and the history
+    static TrainStateHeader make_state_header(AI_State const& state)
+    {
+        // value-initialized, the reserved fields are zero and there is no padding
+        TrainStateHeader header{};
+
+        header.magic = TRAIN_STATE_MAGIC;
+        header.version = TRAIN_STATE_VERSION;
+
+        header.topology = state.mlp.topology;
+
+        header.train_count = state.train_image_data.image_count;
+        header.n_features = state.train_features.width;
+
+        header.train_label = state.train_label;
+        header.batch_size = state.batch_size;
+        header.n_threads = state.n_threads;
+        header.shuffle_block = state.shuffle_block;
+        header.shuffle_seed = state.shuffle_seed;
+        header.parallel_mode = state.parallel_mode;
+        header.shuffle_mode = state.shuffle_mode;
+
+        header.test_error = state.test_error;
+        header.test_report = state.test_report;
+
+        header.param_offset = TRAIN_STATE_PARAM_OFFSET;
+        header.param_count = state.mlp.params.length;
+
+        return header;
+    }
+
+
+    static void set_position(TrainStateHeader& header, AI_State const& state, u64 train_sample)
+    {
+        header.train_sample = train_sample;
+        header.data_id = state.data_id;
+        header.epoch_id = state.epoch_id;
+        header.train_error = state.train_error;
+        header.prediction_ok = state.prediction_ok;
+    }
+
+
+    static bool write_state(TrainStateHeader const& header, Span32 const& params, cstr file_path)
+    {
+        if (params.length != header.param_count)
+        {
+            return false;
+        }
+
+        char tmp_path[1024];
+        auto len = qsnprintf(tmp_path, sizeof(tmp_path), "%s.tmp", file_path);
+        if (len <= 0 || len >= (int)sizeof(tmp_path))
+        {
+            return false;
+        }
+
+        std::ofstream file(tmp_path, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        char padding[TRAIN_STATE_PARAM_OFFSET] = { 0 };
+
+        file.write((char*)&header, sizeof(header));
+        file.write(padding, header.param_offset - sizeof(header));
+        file.write((char*)params.data, params.length * sizeof(f32));
+        file.close();
+
+        if (file.fail())
+        {
+            std::remove(tmp_path);
+            return false;
+        }
+
+        // readers only ever see a complete file
+        std::error_code ec;
+        std::filesystem::rename(tmp_path, file_path, ec);
+        if (ec)
+        {
+            std::remove(tmp_path);
+            return false;
+        }
+
+        return true;
+    }
+
+
+    static bool valid_state(TrainStateHeader const& header, AI_State const& state, u64 file_size)
+    {
+        auto topology = header.topology;
+
+        u64 n_bytes = 0;
+        u64 end = 0;
+
+        // one output per label, or is / is not the label, expected_at writes that many
+        auto n_outputs = header.train_label == TRAIN_ALL_LABELS ? MAX_CLASSES : 2u;
+
+        auto valid_settings =
+            header.train_label >= TRAIN_ALL_LABELS && header.train_label < (int)MAX_CLASSES &&
+            header.batch_size > 0 &&
+            header.n_threads > 0 && header.n_threads <= MAX_TRAIN_THREADS &&
+            header.parallel_mode <= ParallelMode::Sync &&
+            header.shuffle_mode <= ShuffleMode::Block &&
+            header.train_history.total_ok <= TrainHistory::LENGTH &&
+            header.test_report.n_classes <= MAX_CLASSES;
+
+        return header.magic == TRAIN_STATE_MAGIC &&
+            header.version == TRAIN_STATE_VERSION &&
+            header.param_offset >= sizeof(header) &&
+            mem::mul_size(header.param_count, sizeof(f32), n_bytes) &&
+            mem::add_size(header.param_offset, n_bytes, end) &&
+            end <= file_size &&
+            valid_settings &&
+            header.train_count == state.train_image_data.image_count &&
+            header.n_features == state.train_features.width &&
+            topology.get_input_size() == header.n_features &&
+            topology.get_output_size() == n_outputs;
+    }
+}
+
+
+/* checkpoints */
+
+namespace mlai
+{
+    // params are copied into staging on the training thread, written to disk on the writer thread
+    class Checkpointer
+    {
+    public:
+        cstr file_path = 0;
+
+        u64 every_samples = 0;
+        f64 every_sec = 0.0;
+
+        u64 next_sample = 0;
+        Stopwatch sw;
+
+        // settings when training started, the position when staging was copied
+        TrainStateHeader header{};
+        MemoryBuffer<f32> staging;
+
+        // staging holds params that are not written yet
+        std::atomic<bool> busy = false;
+        bool stop = false;
+
+        std::atomic<u32>* n_written = 0;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread writer;
+    };
+
+
+    static void run_writer(Checkpointer& cp)
+    {
+        auto params = span::make_view(cp.staging);
+
+        std::unique_lock<std::mutex> lock(cp.mutex);
+
+        while (true)
+        {
+            cp.cv.wait(lock, [&](){ return cp.busy || cp.stop; });
+
+            if (!cp.busy)
+            {
+                break;
+            }
+
+            lock.unlock();
+
+            if (write_state(cp.header, params, cp.file_path))
+            {
+                cp.n_written->fetch_add(1, std::memory_order_relaxed);
+            }
+
+            lock.lock();
+
+            cp.busy = false;
+        }
+    }
+
+
+    static void create_checkpointer(Checkpointer& cp, AI_State& state)
+    {
+        auto off = !state.checkpoint_path || (!state.checkpoint_samples && !state.checkpoint_seconds);
+
+        // the saved mlp would not load without its conv layers
+        if (off || has_conv(state) || !state.mlp.params.length)
+        {
+            return;
+        }
+
+        if (!mb::create_buffer(cp.staging, state.mlp.params.length, "checkpoint"))
+        {
+            return;
+        }
+
+        cp.file_path = state.checkpoint_path;
+        cp.every_samples = state.checkpoint_samples;
+        cp.every_sec = state.checkpoint_seconds;
+        cp.next_sample = state.train_sample + state.checkpoint_samples;
+        cp.header = make_state_header(state);
+        cp.n_written = &state.n_checkpoints;
+
+        cp.sw.start();
+
+        cp.writer = std::thread([&](){ run_writer(cp); });
+    }
+
+
+    // waits for a checkpoint in progress
+    static void destroy_checkpointer(Checkpointer& cp)
+    {
+        if (cp.writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(cp.mutex);
+                cp.stop = true;
+            }
+
+            cp.cv.notify_one();
+            cp.writer.join();
+        }
+
+        mb::destroy_buffer(cp.staging);
+    }
+
+
+    // never waits for the disk, a checkpoint that is due while the last one is still being written is skipped
+    // params must not be modified during the copy, except by hogwild workers
+    // sample is the next one to train, the progress fields of state are those of the sample before
+    static void checkpoint(Checkpointer& cp, AI_State const& state, u64 sample)
+    {
+        if (!cp.writer.joinable())
+        {
+            return;
+        }
+
+        auto due = (cp.every_samples && sample >= cp.next_sample) ||
+            (cp.every_sec > 0.0 && cp.sw.get_time_sec() >= cp.every_sec);
+
+        if (!due || cp.busy.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        span::copy(state.mlp.params, span::make_view(cp.staging));
+        set_position(cp.header, state, sample);
+
+        cp.next_sample = sample + cp.every_samples;
+        cp.sw.start();
+
+        {
+            std::lock_guard<std::mutex> lock(cp.mutex);
+            cp.busy = true;
+        }
+
+        cp.cv.notify_one();
+    }
+}
+
+
+/* epoch order */
+
+namespace mlai
+{
+    // data ids of three consecutive epochs, a thread builds the next one while the current one is trained
+    class EpochOrder
+    {
+    public:
+        static constexpr u32 N_SLOTS = 3;
+        static constexpr u64 NO_EPOCH = UINT64_MAX;
+
+        u32 count = 0;
+
+        ShuffleMode mode = ShuffleMode::Off;
+        u32 block_size = 0;
+        bool shuffle_blocks = true;
+        u64 seed = 0;
+
+        u32* slots[N_SLOTS] = { 0 };
+        u64 slot_epoch[N_SLOTS] = { NO_EPOCH, NO_EPOCH, NO_EPOCH };
+
+        // ids read from each slot by cursors that have moved on, a slot is reused once all count are read
+        u64 slot_reads[N_SLOTS] = { 0 };
+
+        // training continues at sample first_epoch * count + first_skipped
+        // the skipped ids count as read
+        u64 first_epoch = 0;
+        u32 first_skipped = 0;
+
+        // Block mode
+        u32* block_ids = 0;
+        u32 n_blocks = 0;
+
+        MemoryBuffer<u32> memory;
+
+        // latest epoch a trainer has entered, the builder stays at most one epoch ahead of it
+        u64 reader_epoch = 0;
+        u64 build_epoch = 0;
+
+        bool stop = false;
+
+        std::mutex mutex;
+        std::condition_variable build_cv;
+        std::condition_variable ready_cv;
+        std::thread builder;
+    };
+
+
+    // each training thread keeps its own
+    class OrderCursor
+    {
+    public:
+        u64 epoch = EpochOrder::NO_EPOCH;
+        u32 const* data_ids = 0;
+
+        // since entering epoch
+        u64 reads = 0;
+    };
+
+
+    // a pure function of (seed, epoch), runs with the same settings see the same order
+    static void build_order(EpochOrder& order, u64 epoch, u32* dst)
+    {
+        auto rng = rng::seed(order.seed, epoch);
+
+        if (order.mode == ShuffleMode::Full)
+        {
+            for (u32 i = 0; i < order.count; i++)
+            {
+                dst[i] = i;
+            }
+
+            rng::shuffle(rng, dst, order.count);
+            return;
+        }
+
+        // whole blocks in random order, then shuffled within each block
+        // rows of consecutive images are read together
+        auto B = order.block_size;
+
+        for (u32 b = 0; b < order.n_blocks; b++)
+        {
+            order.block_ids[b] = b;
+        }
+
+        if (order.shuffle_blocks)
+        {
+            rng::shuffle(rng, order.block_ids, order.n_blocks);
+        }
+
+        u32 d = 0;
+        for (u32 i = 0; i < order.n_blocks; i++)
+        {
+            auto begin = order.block_ids[i] * B;
+            auto end = begin + B < order.count ? begin + B : order.count;
+
+            auto block = dst + d;
+
+            for (u32 id = begin; id < end; id++)
+            {
+                dst[d++] = id;
+            }
+
+            rng::shuffle(rng, block, end - begin);
+        }
+    }
+
+
+    static void run_builder(EpochOrder& order)
+    {
+        std::unique_lock<std::mutex> lock(order.mutex);
+
+        while (!order.stop)
+        {
+            auto epoch = order.build_epoch;
+            auto slot = epoch % EpochOrder::N_SLOTS;
+
+            // the slot still holds epoch - 3, a slow worker may not have read all of it yet
+            auto ahead = epoch > order.reader_epoch + 1;
+            auto in_use = epoch >= order.first_epoch + EpochOrder::N_SLOTS && order.slot_reads[slot] < order.count;
+
+            if (ahead || in_use)
+            {
+                order.build_cv.wait(lock);
+                continue;
+            }
+
+            order.slot_reads[slot] = epoch == order.first_epoch ? order.first_skipped : 0;
+
+            lock.unlock();
+
+            build_order(order, epoch, order.slots[slot]);
+
+            lock.lock();
+
+            order.slot_epoch[slot] = epoch;
+            order.build_epoch++;
+
+            order.ready_cv.notify_all();
+        }
+    }
+
+
+    static bool create_order(EpochOrder& order, AI_State const& state, bool sequential_blocks)
+    {
+        order.count = state.train_image_data.image_count;
+        order.mode = state.shuffle_mode;
+        order.seed = state.shuffle_seed;
+
+        if (order.mode == ShuffleMode::Off || order.count < 2)
+        {
+            order.mode = ShuffleMode::Off;
+            return true;
+        }
+
+        order.first_epoch = state.train_sample / order.count;
+        order.first_skipped = (u32)(state.train_sample % order.count);
+
+        order.reader_epoch = order.first_epoch;
+        order.build_epoch = order.first_epoch;
+
+        order.block_size = state.shuffle_block > 0 ? state.shuffle_block : 1;
+
+        // chunks in file order, shuffled within each chunk
+        if (sequential_blocks)
+        {
+            order.mode = ShuffleMode::Block;
+            order.block_size = STREAM_CHUNK_IMAGES;
+            order.shuffle_blocks = false;
+        }
+        order.n_blocks = (order.count + order.block_size - 1) / order.block_size;
+
+        auto n_elements = (u64)EpochOrder::N_SLOTS * order.count + order.n_blocks;
+        if (!mb::create_buffer(order.memory, n_elements, "epoch order"))
+        {
+            order.mode = ShuffleMode::Off;
+            return false;
+        }
+
+        for (u32 i = 0; i < EpochOrder::N_SLOTS; i++)
+        {
+            order.slots[i] = mb::push_elements(order.memory, order.count);
+        }
+
+        order.block_ids = mb::push_elements(order.memory, order.n_blocks);
+
+        order.builder = std::thread([&](){ run_builder(order); });
+
+        return true;
+    }
+
+
+    static void destroy_order(EpochOrder& order)
+    {
+        if (order.builder.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(order.mutex);
+                order.stop = true;
+            }
+
+            order.build_cv.notify_one();
+            order.builder.join();
+        }
+
+        mb::destroy_buffer(order.memory);
+    }
+
+
+    // hands the reads of the current epoch back to the builder
+    static void leave_epoch(EpochOrder& order, OrderCursor& cursor)
+    {
+        if (cursor.epoch != EpochOrder::NO_EPOCH)
+        {
+            order.slot_reads[cursor.epoch % EpochOrder::N_SLOTS] += cursor.reads;
+        }
+
+        cursor.epoch = EpochOrder::NO_EPOCH;
+        cursor.data_ids = 0;
+        cursor.reads = 0;
+    }
+
+
+    // waits only if the builder has not caught up, i.e. at the very start
+    static void enter_epoch(EpochOrder& order, OrderCursor& cursor, u64 epoch)
+    {
+        std::unique_lock<std::mutex> lock(order.mutex);
+
+        leave_epoch(order, cursor);
+
+        if (epoch > order.reader_epoch)
+        {
+            order.reader_epoch = epoch;
+        }
+
+        order.build_cv.notify_one();
+
+        auto slot = epoch % EpochOrder::N_SLOTS;
+
+        order.ready_cv.wait(lock, [&](){ return order.slot_epoch[slot] == epoch; });
+
+        cursor.epoch = epoch;
+        cursor.data_ids = order.slots[slot];
+    }
+
+
+    // a worker thread that stops early, others may be waiting on its reads
+    static void release_cursor(EpochOrder& order, OrderCursor& cursor)
+    {
+        if (order.mode == ShuffleMode::Off)
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(order.mutex);
+            leave_epoch(order, cursor);
+        }
+
+        order.build_cv.notify_one();
+    }
+
+
+    // sample is counted from the start of training across epochs
+    // each sample is read once, progress reports reuse the id already read
+    static u32 data_id_at(EpochOrder& order, OrderCursor& cursor, u64 sample)
+    {
+        auto epoch = sample / order.count;
+        auto i = (u32)(sample % order.count);
+
+        if (order.mode == ShuffleMode::Off)
+        {
+            return i;
+        }
+
+        if (epoch != cursor.epoch)
+        {
+            enter_epoch(order, cursor, epoch);
+        }
+
+        cursor.reads++;
+
+        return cursor.data_ids[i];
+    }
+}
+
+
+namespace mlai
+{
+    using expected_f = std::function<Span32()>;
+
+
+    static void train_batch(AI_State& state, EpochOrder& order, Checkpointer& cp, expected_f const& get_expected, bool_f const& train_condition)
+    {
+        auto& data = state.train_image_data;
+        auto& features = state.train_features;
+        auto& mlp = state.mlp;
+
+        u32 data_count = data.image_count;
+
+        OrderCursor cursor{};
+        u64 sample = state.train_sample;
+
+        mlp::MiniBatch batch{};
+        if (!mlp::create_batch(batch, mlp, state.batch_size))
+        {
+            return;
+        }
+
+        auto last = batch.batch_size - 1;
+
+        SampleRate sr;
+        start_rate(sr);
+
+        while (train_condition())
+        {
+            for (u32 r = 0; r < batch.batch_size; r++)
+            {
+                state.data_id = data_id_at(order, cursor, sample++);
+
+                span::copy(img::row_span(features, state.data_id), img::row_span(batch.input, r));
+                span::copy(get_expected(), img::row_span(batch.expected, r));
+            }
+
+            state.epoch_id = (u32)(sample / data_count);
+
+            auto res = mlp::update_batch(mlp, batch);
+
+            state.train_error = res.abs_error;
+
+            auto p = res.label;
+
+            state.prediction_ok = p >= 0 && img::row_span(batch.expected, last).data[p] > 0.5f;
+
+            checkpoint(cp, state, sample);
+
+            count_samples(sr, batch.batch_size, state.samples_per_sec[0]);
+        }
+
+        state.train_sample = sample;
+        state.samples_per_sec[0] = 0.0f;
+
+        mlp::destroy(batch);
+    }
+}
+
+
+namespace mlai
+{
+    static void train_single(AI_State& state, EpochOrder& order, Checkpointer& cp, expected_f const& get_expected, bool_f const& train_condition)
+    {
+        auto& data = state.train_image_data;
+        auto& features = state.train_features;
+        auto& mlp = state.mlp;
+
+        u32 data_count = data.image_count;
+
+        OrderCursor cursor{};
+        u64 sample = state.train_sample;
+
+        SampleRate sr;
+        start_rate(sr);
+
+        while (train_condition())
+        {
+            state.data_id = data_id_at(order, cursor, sample++);
+
+            mlp::set_input(mlp, img::row_begin(features, state.data_id));
+            auto expected = get_expected();
+            
+            auto res = mlp::update(mlp, expected);
+
+            state.train_error = res.abs_error;
+
+            auto p = res.label;
+
+            state.prediction_ok = p >= 0 && expected.data[p] > 0.5f;
+
+            state.epoch_id = (u32)(sample / data_count);
+
+            checkpoint(cp, state, sample);
+
+            count_samples(sr, 1, state.samples_per_sec[0]);
+        }
+
+        state.train_sample = sample;
+        state.samples_per_sec[0] = 0.0f;
+    }
+}
+
+
+namespace mlai
+{
+    // one sample at a time, on the calling thread
+    static void train_conv(AI_State& state, EpochOrder& order, expected_f const& get_expected, bool_f const& train_condition)
+    {
+        auto& data = state.train_image_data;
+        auto& conv = state.conv;
+        auto& mlp = state.mlp;
+
+        u32 data_count = data.image_count;
+
+        mnist::ImageChunk chunk{};
+
+        OrderCursor cursor{};
+        u64 sample = state.train_sample;
+
+        SampleRate sr;
+        start_rate(sr);
+
+        while (train_condition())
+        {
+            state.data_id = data_id_at(order, cursor, sample++);
+
+            conv_input(data, chunk, state.data_id, conv.input);
+            auto expected = get_expected();
+
+            auto res = cnn::update(conv, mlp, expected);
+
+            state.train_error = res.abs_error;
+
+            auto p = res.label;
+
+            state.prediction_ok = p >= 0 && expected.data[p] > 0.5f;
+
+            state.epoch_id = (u32)(sample / data_count);
+
+            count_samples(sr, 1, state.samples_per_sec[0]);
+        }
+
+        state.train_sample = sample;
+        state.samples_per_sec[0] = 0.0f;
+    }
+}
+
+
+/* hogwild */
+
+namespace mlai
+{
+    class TrainWorker
+    {
+    public:
+        // activations etc. are per worker, weights are shared with state.mlp
+        mlp::Net net;
+        mlp::MiniBatch batch;
+
+        // evaluation of the copies only
+        mlp::QuantizedNet net_int8;
+        mlp::HalfNet net_half;
+
+        // synchronous mode only
+        mlp::NetGradient gradient;
+        mlp::EvalResult result;
+        u32 last_data_id = 0;
+
+        Span32 expected;
+    };
+
+
+    enum class WorkerMode : u8
+    {
+        Hogwild,
+        Sync,
+        Evaluate
+    };
+
+
+    // n workers on the heap, their activations, batches and gradients carved from one buffer
+    // instead of two or three allocations per worker
+    class WorkerPool
+    {
+    public:
+        TrainWorker* workers = 0;
+        u32 n_workers = 0;
+
+        // the replica evaluate workers get
+        Precision precision = Precision::F32;
+
+        MemoryBuffer<f32> memory;
+    };
+
+
+    // rows of the batch a worker trains, a shard of at least one sample in synchronous mode
+    static u32 worker_batch_size(AI_State const& state, WorkerMode mode, u32 n_workers, u32 worker_id)
+    {
+        if (mode == WorkerMode::Evaluate)
+        {
+            return 1;
+        }
+
+        if (mode == WorkerMode::Hogwild)
+        {
+            return state.batch_size;
+        }
+
+        auto begin = state.batch_size * worker_id / n_workers;
+        auto end = state.batch_size * (worker_id + 1) / n_workers;
+
+        return end - begin;
+    }
+
+
+    // expected, then a replica, a batch or a batch and a gradient, 0 if the size does not fit in 64 bits
+    static u64 worker_elements(AI_State const& state, WorkerMode mode, Precision precision, u32 batch_size)
+    {
+        auto& net = state.mlp;
+
+        u64 n_elements = net.output.length;
+        u64 n_net = 0;
+
+        if (mode == WorkerMode::Evaluate && precision == Precision::Int8)
+        {
+            n_net = mlp::replica_elements(state.mlp_int8);
+        }
+        else if (mode == WorkerMode::Evaluate && precision == Precision::Half)
+        {
+            n_net = mlp::replica_elements(state.mlp_half);
+        }
+        else if (mode == WorkerMode::Sync)
+        {
+            n_net = mlp::batch_elements(net, batch_size);
+            n_net = n_net && mem::add_size(n_net, mlp::gradient_elements(net), n_net) ? n_net : 0;
+        }
+        else
+        {
+            n_net = batch_size > 1 ? mlp::batch_elements(net, batch_size) : mlp::replica_elements(net);
+        }
+
+        return n_net && mem::add_size(n_elements, n_net, n_elements) ? n_elements : 0;
+    }
+
+
+    static bool create_worker(TrainWorker& worker, AI_State const& state, WorkerMode mode, Precision precision, u32 batch_size, MemoryBuffer<f32>& buffer)
+    {
+        worker.expected = span::push_span(buffer, state.mlp.output.length);
+
+        if (mode == WorkerMode::Evaluate && precision == Precision::Int8)
+        {
+            return mlp::create_replica(worker.net_int8, state.mlp_int8, buffer);
+        }
+        else if (mode == WorkerMode::Evaluate && precision == Precision::Half)
+        {
+            return mlp::create_replica(worker.net_half, state.mlp_half, buffer);
+        }
+        else if (mode == WorkerMode::Sync)
+        {
+            // shards are always mini-batches, even of 1 sample
+            return mlp::create_batch(worker.batch, state.mlp, batch_size, buffer) && mlp::create_gradient(worker.gradient, state.mlp, buffer);
+        }
+        else if (batch_size > 1)
+        {
+            return mlp::create_batch(worker.batch, state.mlp, batch_size, buffer);
+        }
+
+        return mlp::create_replica(worker.net, state.mlp, buffer);
+    }
+
+
+    static void destroy_workers(WorkerPool& pool)
+    {
+        for (u32 t = 0; t < pool.n_workers; t++)
+        {
+            // the buffers of the worker are in pool.memory
+            pool.workers[t].~TrainWorker();
+        }
+
+        if (pool.workers)
+        {
+            mem::free(pool.workers);
+        }
+
+        mb::destroy_buffer(pool.memory);
+
+        pool.workers = 0;
+        pool.n_workers = 0;
+    }
+
+
+    // false if any worker could not be created, destroy_workers is called either way
+    static bool create_workers(WorkerPool& pool, AI_State const& state, u32 n_workers, WorkerMode mode)
+    {
+        u64 n_elements = 0;
+        for (u32 t = 0; t < n_workers; t++)
+        {
+            auto n = worker_elements(state, mode, pool.precision, worker_batch_size(state, mode, n_workers, t));
+            if (!n || !mem::add_size(n_elements, n, n_elements))
+            {
+                return false;
+            }
+        }
+
+        pool.workers = mem::malloc<TrainWorker>(n_workers, "train workers");
+        if (!pool.workers)
+        {
+            return false;
+        }
+
+        for (u32 t = 0; t < n_workers; t++)
+        {
+            new (pool.workers + t) TrainWorker();
+        }
+
+        pool.n_workers = n_workers;
+
+        if (!mb::create_buffer(pool.memory, n_elements, "train workers"))
+        {
+            return false;
+        }
+
+        for (u32 t = 0; t < n_workers; t++)
+        {
+            if (!create_worker(pool.workers[t], state, mode, pool.precision, worker_batch_size(state, mode, n_workers, t), pool.memory))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    // output index that should be 1 for a label
+    static u32 expected_class(AI_State const& state, u8 label)
+    {
+        if (state.train_label == TRAIN_ALL_LABELS)
+        {
+            return label;
+        }
+
+        return label == (u8)state.train_label ? 0 : 1;
+    }
+
+
+    // label_data_at/label_equals_at write to a buffer shared by the label data
+    static void expected_at(AI_State const& state, mnist::LabelData const& labels, u32 data_id, Span32 const& dst)
+    {
+        auto c = expected_class(state, mnist::label_at(labels, data_id));
+
+        for (u32 i = 0; i < dst.length; i++)
+        {
+            dst.data[i] = c == i ? 1.0f : 0.0f;
+        }
+    }
+
+
+    static void run_worker(AI_State& state, TrainWorker& worker, u32 thread_id, EpochOrder& order, Checkpointer& cp, std::atomic<u64>& sample_id, bool_f const& train_condition)
+    {
+        auto& data = state.train_image_data;
+        auto& features = state.train_features;
+
+        OrderCursor cursor{};
+
+        u64 const data_count = data.image_count;
+        u32 const batch_size = state.batch_size;
+
+        auto& batch = worker.batch;
+        auto& rate = state.samples_per_sec[thread_id];
+
+        SampleRate sr;
+        start_rate(sr);
+
+        while (train_condition())
+        {
+            auto id = sample_id.fetch_add(batch_size, std::memory_order_relaxed);
+
+            mlp::EvalResult res{};
+            Span32 expected{};
+            u32 data_id = 0;
+
+            if (batch_size > 1)
+            {
+                for (u32 r = 0; r < batch_size; r++)
+                {
+                    data_id = data_id_at(order, cursor, id + r);
+
+                    span::copy(img::row_span(features, data_id), img::row_span(batch.input, r));
+                    expected_at(state, state.train_label_data, data_id, img::row_span(batch.expected, r));
+                }
+
+                // no locks, other workers may be updating the same weights
+                res = mlp::update_batch(state.mlp, batch);
+                expected = img::row_span(batch.expected, batch_size - 1);
+            }
+            else
+            {
+                data_id = data_id_at(order, cursor, id);
+
+                mlp::set_input(worker.net, img::row_begin(features, data_id));
+                expected_at(state, state.train_label_data, data_id, worker.expected);
+
+                res = mlp::update(worker.net, worker.expected);
+                expected = worker.expected;
+            }
+
+            count_samples(sr, batch_size, rate);
+
+            // the first worker reports progress
+            if (thread_id == 0)
+            {
+                auto last = id + batch_size - 1;
+
+                state.train_error = res.abs_error;
+                state.prediction_ok = res.label >= 0 && expected.data[res.label] > 0.5f;
+
+                state.data_id = data_id;
+                state.epoch_id = (u32)(last / data_count);
+
+                // the other workers keep updating, the copy may mix old and new weights like any hogwild read
+                checkpoint(cp, state, last + 1);
+            }
+        }
+
+        release_cursor(order, cursor);
+
+        rate = 0.0f;
+    }
+
+
+    static void train_hogwild(AI_State& state, EpochOrder& order, Checkpointer& cp, bool_f const& train_condition)
+    {
+        auto n_threads = state.n_threads;
+
+        assert(n_threads > 0 && n_threads <= MAX_TRAIN_THREADS);
+
+        WorkerPool pool{};
+        std::thread threads[MAX_TRAIN_THREADS];
+
+        if (!create_workers(pool, state, n_threads, WorkerMode::Hogwild))
+        {
+            destroy_workers(pool);
+            return;
+        }
+
+        auto workers = pool.workers;
+
+        std::atomic<u64> sample_id = state.train_sample;
+
+        for (u32 t = 0; t < n_threads; t++)
+        {
+            threads[t] = std::thread([&, t](){ run_worker(state, workers[t], t, order, cp, sample_id, train_condition); });
+        }
+
+        for (u32 t = 0; t < n_threads; t++)
+        {
+            threads[t].join();
+        }
+
+        // every sample handed out was trained
+        state.train_sample = sample_id;
+
+        destroy_workers(pool);
+    }
+}
+
+
+/* synchronous */
+
+namespace mlai
+{
+    class SyncControl
+    {
+    public:
+        std::barrier<> barrier;
+
+        u32 n_threads = 0;
+        bool running = false;
+
+        // state.train_sample is written when all workers are done
+        u64 first_sample = 0;
+        u64 end_sample = 0;
+
+        SyncControl(u32 n) : barrier(n), n_threads(n) {}
+    };
+
+
+    static void run_sync_worker(AI_State& state, TrainWorker* workers, u32 thread_id, EpochOrder& order, Checkpointer& cp, SyncControl& ctrl, bool_f const& train_condition)
+    {
+        auto& data = state.train_image_data;
+        auto& features = state.train_features;
+        auto& worker = workers[thread_id];
+        auto& batch = worker.batch;
+
+        OrderCursor cursor{};
+
+        auto const n_threads = ctrl.n_threads;
+        u64 const data_count = data.image_count;
+        u64 const batch_size = state.batch_size;
+
+        // rows [shard_begin, shard_begin + shard_size) of every batch
+        u64 const shard_begin = batch_size * thread_id / n_threads;
+        u32 const shard_size = batch.batch_size;
+
+        SampleRate sr;
+        start_rate(sr);
+
+        for (u64 step = 0; ; step++)
+        {
+            auto step_sample = ctrl.first_sample + step * batch_size;
+
+            if (thread_id == 0)
+            {
+                ctrl.running = train_condition();
+                ctrl.end_sample = step_sample;
+            }
+
+            // previous update finished
+            ctrl.barrier.arrive_and_wait();
+
+            if (!ctrl.running)
+            {
+                break;
+            }
+
+            // weights are only read until the gradients are summed, the copy is consistent
+            if (thread_id == 0)
+            {
+                checkpoint(cp, state, step_sample);
+            }
+
+            auto first = step_sample + shard_begin;
+
+            for (u32 r = 0; r < shard_size; r++)
+            {
+                auto data_id = data_id_at(order, cursor, first + r);
+
+                span::copy(img::row_span(features, data_id), img::row_span(batch.input, r));
+                expected_at(state, state.train_label_data, data_id, img::row_span(batch.expected, r));
+
+                worker.last_data_id = data_id;
+            }
+
+            worker.result = mlp::eval_gradient(state.mlp, batch, worker.gradient);
+
+            ctrl.barrier.arrive_and_wait();
+
+            // pairwise sums in a fixed order, the result does not depend on thread timing
+            for (u32 stride = 1; stride < n_threads; stride *= 2)
+            {
+                if (thread_id % (2 * stride) == 0 && thread_id + stride < n_threads)
+                {
+                    mlp::add_gradient(workers[thread_id + stride].gradient, worker.gradient);
+                }
+
+                ctrl.barrier.arrive_and_wait();
+            }
+
+            mlp::apply_gradient(state.mlp, workers[0].gradient, thread_id, n_threads);
+
+            count_samples(sr, shard_size, state.samples_per_sec[thread_id]);
+
+            if (thread_id == 0)
+            {
+                f32 abs_error = 0.0f;
+                for (u32 t = 0; t < n_threads; t++)
+                {
+                    abs_error += workers[t].result.abs_error * workers[t].batch.batch_size;
+                }
+
+                auto& last_worker = workers[n_threads - 1];
+                auto& last_batch = last_worker.batch;
+                auto p = last_worker.result.label;
+
+                auto last = step_sample + batch_size - 1;
+
+                state.train_error = abs_error / batch_size;
+                state.prediction_ok = p >= 0 && img::row_span(last_batch.expected, last_batch.batch_size - 1).data[p] > 0.5f;
+
+                state.data_id = last_worker.last_data_id;
+                state.epoch_id = (u32)(last / data_count);
+            }
+        }
+
+        release_cursor(order, cursor);
+
+        state.samples_per_sec[thread_id] = 0.0f;
+    }
+
+
+    static void train_sync(AI_State& state, EpochOrder& order, Checkpointer& cp, bool_f const& train_condition)
+    {
+        // at least one sample per shard
+        auto n_threads = state.n_threads < state.batch_size ? state.n_threads : state.batch_size;
+
+        assert(n_threads > 0 && n_threads <= MAX_TRAIN_THREADS);
+
+        WorkerPool pool{};
+        std::thread threads[MAX_TRAIN_THREADS];
+
+        if (create_workers(pool, state, n_threads, WorkerMode::Sync))
+        {
+            auto workers = pool.workers;
+
+            SyncControl ctrl(n_threads);
+            ctrl.first_sample = state.train_sample;
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t] = std::thread([&, t](){ run_sync_worker(state, workers, t, order, cp, ctrl, train_condition); });
+            }
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t].join();
+            }
+
+            state.train_sample = ctrl.end_sample;
+        }
+
+        destroy_workers(pool);
+    }
+}
+
+
+/* evaluate */
 
 namespace mlai
 {
-    static u32 increment_wrap(u32 value, u32 max_value)
+    static bool has_net(AI_State const& state, Precision precision)
     {
-        value += 1;
-        return value > max_value ? 0 : value;
+        switch (precision)
+        {
+        case Precision::Int8: return state.mlp_int8.layers.length > 0;
+        case Precision::Half: return state.mlp_half.layers.length > 0;
+        default: return state.mlp.memory.ok;
+        }
     }
 
 
-    static void cnn_convert(img::GrayView const& src, img::GrayView grad, img::GrayView pool, Span32 const& dst)
+    class EvalChunk
+    {
+    public:
+        u32 begin = 0;
+        u32 end = 0;
+
+        u32 n_correct = 0;
+        f64 total_loss = 0.0;
+        f64 total_error = 0.0;
+
+        u32 confusion[MAX_CLASSES][MAX_CLASSES] = { 0 };
+
+        // worker.net, net_int8 or net_half
+        Precision precision = Precision::F32;
+
+        // optional, predicted class of each sample
+        u8* predictions = 0;
+    };
+
+
+    static void run_eval_worker(AI_State const& state, TrainWorker& worker, EvalChunk& chunk)
     {
-        /*img::GrayView grad{};        
-        grad.width = src.width - 2;
-        grad.height = src.height - 2;
+        auto& features = state.test_features;
+        auto& labels = state.test_label_data;
+
+        mnist::ImageChunk images{};
+
+        for (u32 id = chunk.begin; id < chunk.end; id++)
+        {
+            f32* input = 0;
+
+            if (has_conv(state))
+            {
+                conv_input(state.test_image_data, images, id, state.conv.input);
+                cnn::eval(state.conv);
+                input = state.conv.output.data;
+            }
+            else
+            {
+                input = img::row_begin(features, id);
+            }
+
+            auto expected = expected_class(state, mnist::label_at(labels, id));
+            expected_at(state, labels, id, worker.expected);
+
+            mlp::EvalResult res{};
+
+            switch (chunk.precision)
+            {
+            case Precision::Int8:
+                mlp::set_input(worker.net_int8, input);
+                res = mlp::eval(worker.net_int8, worker.expected);
+                break;
+
+            case Precision::Half:
+                mlp::set_input(worker.net_half, input);
+                res = mlp::eval(worker.net_half, worker.expected);
+                break;
+
+            default:
+                mlp::set_input(worker.net, input);
+                res = mlp::eval(worker.net, worker.expected);
+                break;
+            }
+
+            if (chunk.predictions)
+            {
+                chunk.predictions[id] = (u8)res.argmax;
+            }
 
-        img::GrayView pool{};        
-        pool.width = grad.width / 2;
-        pool.height = grad.height / 2;
-        */
-        
-        assert("*** bad gradient image dimensions ***" && grad.width == src.width - 2 && grad.height == src.height - 2);
-        assert("*** bad pooling image dimensions ***" && pool.width == grad.width / 2 && pool.height == grad.height / 2);
-        assert("*** f32 buffer wrong size ***" && dst.length == 2 * pool.width * pool.height);
-                
-        auto const len = pool.width * pool.height;
+            chunk.n_correct += res.argmax == expected;
+            chunk.total_loss += res.loss;
+            chunk.total_error += res.abs_error;
+            chunk.confusion[expected][res.argmax]++;
+        }
+    }
 
-        constexpr auto F = 1.0f / 255.0f;        
 
-        img::gradient_x(src, grad);
-        img::scale_down_max(grad, pool);
+    static TestReport evaluate(AI_State const& state, u32 n_threads, Precision precision, u8* predictions)
+    {
+        TestReport report{};
+
+        auto const n_samples = state.test_image_data.image_count;
+        auto const n_classes = state.mlp.output.length;
 
-        auto d = dst.data;
-        for (u32 i = 0; i < len; i++)
+        if (!n_samples || !has_net(state, precision) || n_classes > MAX_CLASSES)
         {
-            d[i] = F * pool.matrix_data_[i];
+            return report;
         }
 
-        img::gradient_y(src, grad);
-        img::scale_down_max(grad, pool);
+        n_threads = n_threads < 1 ? 1 : (n_threads > MAX_TRAIN_THREADS ? MAX_TRAIN_THREADS : n_threads);
+
+        // the convolutions have a single set of activations
+        n_threads = has_conv(state) ? 1 : n_threads;
+
+        Stopwatch sw;
+        sw.start();
+
+        WorkerPool pool{};
+        EvalChunk chunks[MAX_TRAIN_THREADS];
+        std::thread threads[MAX_TRAIN_THREADS];
+
+        pool.precision = precision;
 
-        d += len;
-        for (u32 i = 0; i < len; i++)
+        auto ok = create_workers(pool, state, n_threads, WorkerMode::Evaluate);
+        auto workers = pool.workers;
+
+        for (u32 t = 0; t < n_threads; t++)
+        {
+            chunks[t].precision = precision;
+            chunks[t].predictions = predictions;
+            chunks[t].begin = (u32)((u64)n_samples * t / n_threads);
+            chunks[t].end = (u32)((u64)n_samples * (t + 1) / n_threads);
+        }
+
+        if (ok)
         {
-            d[i] = F * pool.matrix_data_[i];
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t] = std::thread([&, t](){ run_eval_worker(state, workers[t], chunks[t]); });
+            }
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                threads[t].join();
+            }
+
+            f64 total_loss = 0.0;
+            f64 total_error = 0.0;
+
+            for (u32 t = 0; t < n_threads; t++)
+            {
+                auto& chunk = chunks[t];
+
+                report.n_correct += chunk.n_correct;
+                total_loss += chunk.total_loss;
+                total_error += chunk.total_error;
+
+                for (u32 e = 0; e < n_classes; e++)
+                {
+                    for (u32 p = 0; p < n_classes; p++)
+                    {
+                        report.confusion[e][p] += chunk.confusion[e][p];
+                    }
+                }
+            }
+
+            report.n_samples = n_samples;
+            report.n_classes = n_classes;
+            report.accuracy = (f32)report.n_correct / n_samples;
+            report.mean_loss = (f32)(total_loss / n_samples);
+            report.mean_error = (f32)(total_error / n_samples);
         }
+
+        destroy_workers(pool);
+
+        report.seconds = sw.get_time_sec();
+
+        return report;
     }
 }
 
 
 namespace mlai
 {
-    bool load_data(AI_State& state, DataFiles files)
+    // mapped unless the file is too big to keep resident
+    static mnist::ImageData load_image_data(cstr filepath, u64 stream_min_bytes)
+    {
+        if (stream_min_bytes && mapped_file::file_size(filepath) >= stream_min_bytes)
+        {
+            return mnist::open_image_stream(filepath, STREAM_CHUNK_IMAGES, STREAM_CHUNKS);
+        }
+
+        return mnist::load_image_data(filepath);
+    }
+
+
+    // the pixels are read once here only when they are needed for the feature cache
+    static void load_images(mnist::ImageData& data, cstr filepath, DataFiles const& files, u64& pixel_hash, FileProgress& fp)
     {
-        state.train_image_data = mnist::load_image_data(files.train_data_path);
-        state.test_image_data = mnist::load_image_data(files.test_data_path);
-        state.train_label_data = mnist::load_label_data(files.train_labels_path);
-        state.test_label_data = mnist::load_label_data(files.test_labels_path);
+        start_stage(fp, LoadStage::Reading, 0);
 
-        auto ok = state.train_image_data.ok &&
-            state.test_image_data.ok &&
-            state.train_label_data.ok &&
-            state.test_label_data.ok;
-        
-        if (!ok)
+        data = load_image_data(filepath, files.stream_min_bytes);
+        if (!data.ok)
         {
-            return false;
+            fp.stage = LoadStage::Fail;
+            return;
+        }
+
+        if (files.feature_cache_path)
+        {
+            pixel_hash = hash_pixels(data, fp);
+        }
+    }
+
+
+    // every label has to index an output
+    static void load_labels(mnist::LabelData& data, cstr filepath, FileProgress& fp)
+    {
+        constexpr u32 SLICE_BYTES = 64 * 1024;
+
+        start_stage(fp, LoadStage::Reading, 0);
+
+        data = mnist::load_label_data(filepath);
+        if (!data.ok)
+        {
+            fp.stage = LoadStage::Fail;
+            return;
+        }
+
+        start_stage(fp, LoadStage::Reading, data.label_count);
+
+        auto labels = data.label_buffer.data_;
+        u8 max_label = 0;
+
+        for (u32 begin = 0; begin < data.label_count; begin += SLICE_BYTES)
+        {
+            auto end = data.label_count - begin < SLICE_BYTES ? data.label_count : begin + SLICE_BYTES;
+
+            for (u32 i = begin; i < end; i++)
+            {
+                max_label = labels[i] > max_label ? labels[i] : max_label;
+            }
+
+            add_bytes(fp, end - begin);
+        }
+
+        fp.stage = max_label < MAX_CLASSES ? LoadStage::Done : LoadStage::Fail;
+    }
+
+
+    bool load_data(AI_State& state, DataFiles files, LoadProgress& progress)
+    {
+        auto& train_fp = file_progress(progress, DataFile::TrainImages);
+        auto& test_fp = file_progress(progress, DataFile::TestImages);
+        auto& train_labels_fp = file_progress(progress, DataFile::TrainLabels);
+        auto& test_labels_fp = file_progress(progress, DataFile::TestLabels);
+
+        u64 pixel_hashes[2] = { 0 };
+
+        // the files do not depend on each other, a cold start takes as long as the largest one
+        std::thread threads[(int)DataFile::Count];
+
+        threads[0] = std::thread([&](){ load_images(state.train_image_data, files.train_data_path, files, pixel_hashes[0], train_fp); });
+        threads[1] = std::thread([&](){ load_images(state.test_image_data, files.test_data_path, files, pixel_hashes[1], test_fp); });
+        threads[2] = std::thread([&](){ load_labels(state.train_label_data, files.train_labels_path, train_labels_fp); });
+        threads[3] = std::thread([&](){ load_labels(state.test_label_data, files.test_labels_path, test_labels_fp); });
+
+        for (auto& th : threads)
+        {
+            th.join();
+        }
+
+        for (auto& fp : progress.files)
+        {
+            if (fp.stage == LoadStage::Fail)
+            {
+                return false;
+            }
         }
 
         auto w = state.train_image_data.image_width;
@@ -80,30 +1997,56 @@ namespace mlai
         auto w_pool = w_gradient / 2;
         auto h_pool = h_gradient / 2;
 
-        auto cnn_pixels = w_gradient * h_gradient + w_pool * h_pool;
-        state.cnn_buffer = img::create_buffer8(cnn_pixels, "cnn pixels");
-        if (!state.cnn_buffer.ok)
+        state.topology.set_input_size(2 * w_pool * h_pool);
+
+        state.conv_topology.input_width = w;
+        state.conv_topology.input_height = h;
+        state.conv_topology.input_channels = 1;
+
+        if (!create_features(state, files, w_gradient, h_gradient, pixel_hashes, progress))
         {
+            train_fp.stage = LoadStage::Fail;
+            test_fp.stage = LoadStage::Fail;
             return false;
         }
 
-        state.cnn_gradient = img::make_view(w_gradient, h_gradient, state.cnn_buffer);
-        state.cnn_pool = img::make_view(w_pool, h_pool, state.cnn_buffer);
+        // from here on pixels are only read by the conv layers and the data view
+        mnist::advise(state.train_image_data, mapped_file::Access::Normal);
+        mnist::advise(state.test_image_data, mapped_file::Access::Normal);
 
-        state.topology.set_input_size(2 * w_pool * h_pool);
+        train_fp.stage = LoadStage::Done;
+        test_fp.stage = LoadStage::Done;
 
         return true;
     }
 
 
+    bool load_data(AI_State& state, DataFiles files)
+    {
+        LoadProgress progress;
+
+        return load_data(state, files, progress);
+    }
+
+
     void destroy(AI_State& state)
     {
         mnist::destroy_data(state.train_image_data);
         mnist::destroy_data(state.test_image_data);
         mnist::destroy_data(state.train_label_data);
         mnist::destroy_data(state.test_label_data);
-        mb::destroy_buffer(state.cnn_buffer);
+        mb::destroy_buffer(state.feature_buffer);
+
+        if (state.feature_file.ok)
+        {
+            mem::untag(state.feature_file.data);
+            mapped_file::unmap(state.feature_file);
+        }
+
         mlp::destroy(state.mlp);
+        mlp::destroy(state.mlp_int8);
+        mlp::destroy(state.mlp_half);
+        cnn::destroy(state.conv);
     }
 
 
@@ -112,18 +2055,13 @@ namespace mlai
         auto& data = state.train_image_data;
         auto& labels = state.train_label_data;
 
-        auto& grad = state.cnn_gradient;
-        auto& pool = state.cnn_pool;
-        auto& mlp = state.mlp;
-        auto& mlp_input = mlp.input;
-
-        u32 data_count = data.image_count;
-        state.data_id = 0;
-        state.epoch_id = 0;
+        state.epoch_id = (u32)(state.train_sample / data.image_count);
 
-        
+        // copies of the weights before training
+        mlp::destroy(state.mlp_int8);
+        mlp::destroy(state.mlp_half);
 
-        std::function<Span32()> get_expected;
+        expected_f get_expected;
         if (state.train_label == TRAIN_ALL_LABELS)
         {
             get_expected = [&](){ return mnist::label_data_at(labels, state.data_id); };
@@ -133,24 +2071,130 @@ namespace mlai
             get_expected = [&](){ return mnist::label_equals_at(labels, (u8)state.train_label, state.data_id); };
         }
 
-        while (train_condition())
+        // a streamed file can only be prefetched in order
+        auto sequential_blocks = has_conv(state) && data.stream;
+
+        EpochOrder order;
+        create_order(order, state, sequential_blocks);
+
+        Checkpointer cp;
+        create_checkpointer(cp, state);
+
+        // batch size, threads and checkpoints do not apply to the convolutions
+        if (has_conv(state))
+        {
+            train_conv(state, order, get_expected, train_condition);
+        }
+        else if (state.n_threads > 1)
         {
-            auto image = mnist::image_at(data, state.data_id);
+            if (state.parallel_mode == ParallelMode::Sync)
+            {
+                train_sync(state, order, cp, train_condition);
+            }
+            else
+            {
+                train_hogwild(state, order, cp, train_condition);
+            }
+        }
+        else if (state.batch_size > 1)
+        {
+            train_batch(state, order, cp, get_expected, train_condition);
+        }
+        else
+        {
+            train_single(state, order, cp, get_expected, train_condition);
+        }
+
+        destroy_checkpointer(cp);
+        destroy_order(order);
+    }
 
-            cnn_convert(image, grad, pool, mlp_input);
-            auto expected = get_expected();
-            
-            mlp::update(mlp, expected);
 
-            state.train_error = mlp::abs_error(mlp);
+    bool save_state(AI_State const& state, cstr file_path)
+    {
+        // conv weights are not part of the file
+        if (!state.mlp.params.length || has_conv(state))
+        {
+            return false;
+        }
 
-            auto p = mlp::prediction_label(mlp);
+        auto header = make_state_header(state);
+        set_position(header, state, state.train_sample);
 
-            state.prediction_ok = p >= 0 && expected.data[p] > 0.5f;
+        header.has_history = 1;
+        header.train_history = state.train_history;
 
-            state.data_id = increment_wrap(state.data_id, data_count - 1);
-            state.epoch_id += state.data_id == 0;
+        return write_state(header, state.mlp.params, file_path);
+    }
+
+
+    bool load_state(AI_State& state, cstr file_path)
+    {
+        // the mlp would read the conv output instead of the features it was trained on
+        if (has_conv(state))
+        {
+            return false;
+        }
+
+        auto file = mapped_file::map_read(file_path);
+        if (!file.ok)
+        {
+            return false;
+        }
+
+        TrainStateHeader header{};
+
+        auto ok = file.size >= sizeof(header);
+        if (ok)
+        {
+            std::memcpy(&header, file.data, sizeof(header));
+        }
+
+        if (!ok || !valid_state(header, state, file.size))
+        {
+            mapped_file::unmap(file);
+            return false;
+        }
+
+        auto params = span::to_span((f32*)(file.data + header.param_offset), header.param_count);
+
+        mlp::destroy(state.mlp);
+        mlp::destroy(state.mlp_int8);
+        mlp::destroy(state.mlp_half);
+        ok = mlp::create(state.mlp, header.topology, params);
+
+        mapped_file::unmap(file);
+
+        if (!ok)
+        {
+            return false;
+        }
+
+        state.topology = header.topology;
+
+        state.train_label = header.train_label;
+        state.batch_size = header.batch_size;
+        state.n_threads = header.n_threads;
+        state.shuffle_block = header.shuffle_block;
+        state.shuffle_seed = header.shuffle_seed;
+        state.parallel_mode = header.parallel_mode;
+        state.shuffle_mode = header.shuffle_mode;
+
+        state.train_sample = header.train_sample;
+        state.data_id = header.data_id;
+        state.epoch_id = header.epoch_id;
+        state.train_error = header.train_error;
+        state.prediction_ok = header.prediction_ok;
+
+        state.test_error = header.test_error;
+        state.test_report = header.test_report;
+
+        if (header.has_history)
+        {
+            state.train_history = header.train_history;
         }
+
+        return true;
     }
 
 
@@ -158,17 +2202,16 @@ namespace mlai
     {
         auto& data = state.test_image_data;
         auto& labels = state.test_label_data;
-
-        auto& grad = state.cnn_gradient;
-        auto& pool = state.cnn_pool;
+        auto& features = state.test_features;
         auto& mlp = state.mlp;
-        auto& mlp_input = mlp.input;
 
         u32 data_count = data.image_count;
         state.data_id = 0;
         state.epoch_id = 0;
 
-        std::function<Span32()> get_expected;
+        mnist::ImageChunk chunk{};
+
+        expected_f get_expected;
         if (state.train_label == TRAIN_ALL_LABELS)
         {
             get_expected = [&](){ return mnist::label_data_at(labels, state.data_id); };
@@ -178,22 +2221,166 @@ namespace mlai
             get_expected = [&](){ return mnist::label_equals_at(labels, (u8)state.train_label, state.data_id); };
         }
 
-        while (test_condition())
+        auto& mlp_int8 = state.mlp_int8;
+        auto& mlp_half = state.mlp_half;
+
+        auto precision = state.test_precision;
+        if (precision == Precision::F32 || !has_net(state, precision))
         {
-            auto image = mnist::image_at(data, state.data_id);
+            precision = Precision::F32;
+        }
 
-            cnn_convert(image, grad, pool, mlp_input);
+        while (test_condition())
+        {
             auto expected = get_expected();
 
-            mlp::eval(mlp, expected);
+            mlp::EvalResult res{};
+
+            if (precision != Precision::F32)
+            {
+                f32* input = 0;
 
-            state.test_error = mlp::abs_error(mlp);
+                if (has_conv(state))
+                {
+                    conv_input(data, chunk, state.data_id, state.conv.input);
+                    cnn::eval(state.conv);
+                    input = state.conv.output.data;
+                }
+                else
+                {
+                    input = img::row_begin(features, state.data_id);
+                }
 
-            auto p = mlp::prediction_label(mlp);
+                if (precision == Precision::Int8)
+                {
+                    mlp::set_input(mlp_int8, input);
+                    res = mlp::eval(mlp_int8, expected);
+                }
+                else
+                {
+                    mlp::set_input(mlp_half, input);
+                    res = mlp::eval(mlp_half, expected);
+                }
+            }
+            else if (has_conv(state))
+            {
+                conv_input(data, chunk, state.data_id, state.conv.input);
+                res = cnn::eval(state.conv, mlp, expected);
+            }
+            else
+            {
+                mlp::set_input(mlp, img::row_begin(features, state.data_id));
+                res = mlp::eval(mlp, expected);
+            }
+
+            state.test_error = res.abs_error;
+
+            auto p = res.label;
 
             state.prediction_ok = p >= 0 && expected.data[p] > 0.5f;
 
             state.data_id = increment_wrap(state.data_id, data_count - 1);
         }
     }
-}
\ No newline at end of file
+
+
+    TestReport evaluate(AI_State const& state, u32 n_threads)
+    {
+        return evaluate(state, n_threads, Precision::F32, 0);
+    }
+
+
+    bool quantize(AI_State& state)
+    {
+        mlp::destroy(state.mlp_int8);
+
+        if (!state.mlp.memory.ok)
+        {
+            return false;
+        }
+
+        mlp::quantize(state.mlp_int8, state.mlp);
+
+        return state.mlp_int8.layers.length > 0;
+    }
+
+
+    bool to_half(AI_State& state, span::HalfFormat format)
+    {
+        mlp::destroy(state.mlp_half);
+
+        if (!state.mlp.memory.ok)
+        {
+            return false;
+        }
+
+        mlp::to_half(state.mlp_half, state.mlp, format);
+
+        return state.mlp_half.layers.length > 0;
+    }
+
+
+    QuantReport compare(AI_State const& state, u32 n_threads, Precision precision)
+    {
+        QuantReport report{};
+        report.precision = precision;
+        report.name = precision_str(state, precision);
+
+        auto n_samples = state.test_image_data.image_count;
+
+        if (!n_samples || precision == Precision::F32 || !has_net(state, precision))
+        {
+            return report;
+        }
+
+        MemoryBuffer<u8> predictions;
+        if (!mb::create_buffer(predictions, 2 * (u64)n_samples, "compare predictions"))
+        {
+            return report;
+        }
+
+        auto pred_f32 = mb::push_elements(predictions, n_samples);
+        auto pred_quant = mb::push_elements(predictions, n_samples);
+
+        // one after the other, the times are comparable
+        report.report_f32 = evaluate(state, n_threads, Precision::F32, pred_f32);
+        report.report_quant = evaluate(state, n_threads, precision, pred_quant);
+
+        for (u32 i = 0; i < n_samples; i++)
+        {
+            report.n_agree += pred_f32[i] == pred_quant[i];
+        }
+
+        report.agreement = (f32)report.n_agree / n_samples;
+
+        report.weight_bytes_f32 = mlp::weight_bytes(state.mlp);
+
+        auto level = span::simd_level_str(span::simd_level());
+
+        if (precision == Precision::Int8)
+        {
+            report.weight_bytes_quant = mlp::weight_bytes(state.mlp_int8);
+            report.kernel = span::simd_vnni() ? "VNNI" : level;
+        }
+        else
+        {
+            report.weight_bytes_quant = mlp::weight_bytes(state.mlp_half);
+            report.kernel = span::simd_f16c() ? "F16C" : "Scalar";
+        }
+
+        mb::destroy_buffer(predictions);
+
+        return report;
+    }
+
+
+    cstr precision_str(AI_State const& state, Precision precision)
+    {
+        switch (precision)
+        {
+        case Precision::Int8: return "int8";
+        case Precision::Half: return span::half_format_str(state.mlp_half.format);
+        default: return "f32";
+        }
+    }
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "../../../libs/mnist/mnist.hpp"
-#include "../../../libs/nn/nn_mlp.hpp"
+#include "../../../libs/nn/nn_conv.hpp"
+#include "../../../libs/mapped_file/mapped_file.hpp"
 
+#include <atomic>
 #include <functional>
 
 
@@ -14,6 +16,115 @@ namespace mlai
 
     constexpr int TRAIN_ALL_LABELS = -1;
 
+    constexpr u32 MAX_TRAIN_THREADS = 64;
+
+
+    constexpr u32 MAX_CLASSES = 10;
+
+
+    // ring of a streamed image file, peak memory is STREAM_CHUNKS * STREAM_CHUNK_IMAGES images
+    constexpr u32 STREAM_CHUNK_IMAGES = 4096;
+    constexpr u32 STREAM_CHUNKS = 3;
+
+
+    class TestReport
+    {
+    public:
+        u32 n_samples = 0;
+        u32 n_correct = 0;
+
+        f32 accuracy = 0.0f;
+        f32 mean_loss = 0.0f;
+        f32 mean_error = 0.0f;
+
+        // rows are the expected class, columns the predicted class
+        u32 n_classes = 0;
+
+        f64 seconds = 0.0;
+
+        u32 confusion[MAX_CLASSES][MAX_CLASSES] = { 0 };
+    };
+
+
+    // weights used for inference, the f32 mlp is always the one that is trained
+    enum class Precision : u8
+    {
+        F32 = 0,
+
+        // mlp_int8
+        Int8,
+
+        // mlp_half, f16 or bf16
+        Half
+    };
+
+
+    // the test set scored with the f32 mlp and one of its copies
+    class QuantReport
+    {
+    public:
+        Precision precision = Precision::F32;
+
+        // precision_str of the copy
+        cstr name = "";
+
+        TestReport report_f32;
+        TestReport report_quant;
+
+        // samples where both predict the same class
+        u32 n_agree = 0;
+        f32 agreement = 0.0f;
+
+        u64 weight_bytes_f32 = 0;
+        u64 weight_bytes_quant = 0;
+
+        // kernels used by the copy
+        cstr kernel = "";
+    };
+
+
+    // plotted by the ui while training, one entry per frame
+    class TrainHistory
+    {
+    public:
+        // offset wraps at LENGTH
+        static constexpr u32 LENGTH = 256;
+
+        f32 error[LENGTH] = { 0 };
+        f32 accuracy[LENGTH] = { 0 };
+
+        u8 prediction_ok[LENGTH] = { 0 };
+        u32 total_ok = 0;
+
+        u8 offset = 0;
+
+        // saved with the training state, no padding
+        u8 reserved[3] = { 0 };
+    };
+
+
+    enum class ParallelMode : u8
+    {
+        // workers update the shared weights without locking
+        Hogwild = 0,
+
+        // batch split across workers, gradients summed and applied once
+        Sync
+    };
+
+
+    enum class ShuffleMode : u8
+    {
+        // file order
+        Off = 0,
+
+        // a new permutation of all samples every epoch
+        Full,
+
+        // blocks of consecutive samples in random order, shuffled within each block
+        Block
+    };
+
 
     class AI_State
     {
@@ -27,12 +138,24 @@ namespace mlai
         mnist::ImageData test_image_data;
         mnist::LabelData test_label_data;
 
-        img::GrayView cnn_gradient;
-        img::GrayView cnn_pool;
+        // cnn features of every image, one row per image
+        mlp::Matrix32 train_features;
+        mlp::Matrix32 test_features;
+
+        // optional learned convolutions on the raw pixels, in front of the mlp
+        cnn::ConvTopology conv_topology{};
+        cnn::ConvNet conv;
 
         mlp::NetTopology topology{};
         mlp::Net mlp;
 
+        // copies of mlp for inference, made from it and dropped when training changes the weights
+        mlp::QuantizedNet mlp_int8;
+        mlp::HalfNet mlp_half;
+
+        // test() uses the copy when it exists
+        Precision test_precision = Precision::F32;
+
         f32 train_error = 1.0f;
         f32 test_error = 1.0f;
 
@@ -40,7 +163,41 @@ namespace mlai
         u32 epoch_id = 0;
         b8 prediction_ok = 0;
 
-        img::Buffer8 cnn_buffer;
+        // samples trained since the mlp was created, training continues from here
+        u64 train_sample = 0;
+
+        // samples per weight update, 1 = update after every image
+        u32 batch_size = 1;
+
+        // training threads
+        u32 n_threads = 1;
+        ParallelMode parallel_mode = ParallelMode::Hogwild;
+
+        // order of the training samples, a new one every epoch
+        ShuffleMode shuffle_mode = ShuffleMode::Block;
+        u32 shuffle_block = 256;
+        u64 shuffle_seed = 1;
+
+        // training state written to checkpoint_path on a background thread while training, 0 = never
+        // either interval starts a checkpoint, conv layers are not checkpointed
+        u64 checkpoint_samples = 0;
+        u32 checkpoint_seconds = 0;
+        cstr checkpoint_path = 0;
+
+        // written by the checkpoint thread, read by the ui
+        std::atomic<u32> n_checkpoints = 0;
+
+        // training throughput of each thread, 0 when idle
+        f32 samples_per_sec[MAX_TRAIN_THREADS] = { 0 };
+
+        // last full test set evaluation
+        TestReport test_report;
+
+        TrainHistory train_history;
+
+        // features are either computed into feature_buffer or mapped from the cache file
+        MemoryBuffer<f32> feature_buffer;
+        MappedFile feature_file;
     };
 
 
@@ -51,14 +208,95 @@ namespace mlai
         cstr test_data_path;
         cstr train_labels_path;
         cstr test_labels_path;
+
+        // optional, created on first load and mapped afterwards
+        cstr feature_cache_path;
+
+        // optional, where the mlp is saved and loaded from
+        cstr model_path;
+
+        // optional, training state for continuing a run, also where checkpoints are written
+        cstr state_path;
+
+        // image files of at least this size are streamed from disk instead of mapped, 0 = never
+        u64 stream_min_bytes = 0;
+    };
+
+
+    // files of DataFiles, each one is loaded on its own thread
+    enum class DataFile : u8
+    {
+        TrainImages = 0,
+        TestImages,
+        TrainLabels,
+        TestLabels,
+
+        Count
+    };
+
+
+    enum class LoadStage : u8
+    {
+        Waiting = 0,
+
+        // hashing the pixels for the feature cache, checking the labels
+        Reading,
+
+        // converting the pixels to features, skipped when the cache is valid
+        Features,
+
+        Done,
+        Fail
+    };
+
+
+    // written by the loader threads, polled by the ui
+    class FileProgress
+    {
+    public:
+        std::atomic<LoadStage> stage = LoadStage::Waiting;
+
+        // of the current stage
+        std::atomic<u64> bytes_done = 0;
+        std::atomic<u64> bytes_total = 0;
+    };
+
+
+    class LoadProgress
+    {
+    public:
+        FileProgress files[(int)DataFile::Count];
     };
 
 
+    bool load_data(AI_State& state, DataFiles files, LoadProgress& progress);
+
     bool load_data(AI_State& state, DataFiles files);
 
     void destroy(AI_State& state);
 
     void train(AI_State& state, bool_f const& train_condition);
 
+    // mlp params, training settings, position in the sample order and metrics
+    // training continues exactly where it stopped, except with several hogwild threads
+    bool save_state(AI_State const& state, cstr file_path);
+
+    // replaces state.mlp, the data must be loaded and match the data the state was saved with
+    bool load_state(AI_State& state, cstr file_path);
+
     void test(AI_State& state, bool_f const& test_condition);
+
+    // whole test set split across n_threads, weights are not modified
+    TestReport evaluate(AI_State const& state, u32 n_threads);
+
+    // post-training, weights to int8 with a scale per row
+    bool quantize(AI_State& state);
+
+    // post-training, weights to f16 or bf16
+    bool to_half(AI_State& state, span::HalfFormat format);
+
+    // evaluate with mlp and its copy of the given precision, the copy must be up to date
+    QuantReport compare(AI_State const& state, u32 n_threads, Precision precision);
+
+    cstr precision_str(AI_State const& state, Precision precision);
 }
\ No newline at end of file
@@ -3,7 +3,9 @@
 #include "../../mlai/mlai.cpp"
 #include "../../../../libs/image/image.cpp"
 #include "../../../../libs/mnist/mnist.cpp"
+#include "../../../../libs/mapped_file/mapped_file.cpp"
 #include "../../../../libs/nn/nn_mlp.cpp"
+#include "../../../../libs/nn/nn_conv.cpp"
 #include "../../../../libs/alloc_type/alloc_type.cpp"
 #include "../../../../libs/span/span.cpp"
 #include "../../../../libs/qsprintf/qsprintf.cpp"
\ No newline at end of file
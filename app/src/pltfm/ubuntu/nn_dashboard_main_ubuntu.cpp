@@ -55,7 +55,10 @@ namespace
         ROOT "train-images.idx3-ubyte",
         ROOT "t10k-images.idx3-ubyte",
         ROOT "train-labels.idx1-ubyte",
-        ROOT "t10k-labels.idx1-ubyte"
+        ROOT "t10k-labels.idx1-ubyte",
+        ROOT "features.cache",
+        ROOT "model.mlp",
+        ROOT "train.state"
     };
 }
 
@@ -7,6 +7,7 @@
 #include <cassert>
 #include <vector>
 #include <cstdio>
+#include <mutex>
 
 template <typename T>
 using List = std::vector<T>;
@@ -33,9 +34,9 @@ namespace mem
     }
 
 
-    void tag_any(void* ptr, u32 n_bytes, cstr tag)
+    void tag_any(void* ptr, u64 n_bytes, cstr tag)
     {
-        alloc_type_log("tag_any(%p, %u, %s)\n", ptr, n_bytes, tag);
+        alloc_type_log("tag_any(%p, %llu, %s)\n", ptr, (unsigned long long)n_bytes, tag);
     }
 
 
@@ -45,13 +46,19 @@ namespace mem
     }
 
     
-    void* malloc_memory(u32 n_elements, u32 element_size, cstr tag)
+    void* malloc_memory(u64 n_elements, u32 element_size, cstr tag)
     {
-        alloc_type_log("malloc_memory(%u, %u, %s)\n", n_elements, element_size, tag);
+        alloc_type_log("malloc_memory(%llu, %u, %s)\n", (unsigned long long)n_elements, element_size, tag);
+
+        u64 n_bytes = 0;
+        if (!mul_size(n_elements, element_size, n_bytes) || n_bytes > SIZE_MAX)
+        {
+            return 0;
+        }
 
 #if defined _WIN32
 
-        return std::malloc(n_elements * element_size);
+        return std::malloc((size_t)n_bytes);
 
 #else
         size_t alignment = 1;
@@ -62,11 +69,11 @@ namespace mem
         case 4:
         case 8:
             alignment = element_size;
-            return std::aligned_alloc(alignment, n_elements * element_size);
+            return std::aligned_alloc(alignment, (size_t)n_bytes);
             break;
         
         default:
-            return std::malloc(n_elements * element_size);
+            return std::malloc((size_t)n_bytes);
         }
 
 #endif
@@ -80,9 +87,9 @@ namespace mem
     }
 
 
-    void tag_memory(void* ptr, u32 n_elements, u32 element_size, cstr tag)
+    void tag_memory(void* ptr, u64 n_elements, u32 element_size, cstr tag)
     {
-        alloc_type_log("tag_memory(%p, %u, %u, %s)\n", ptr, n_elements, element_size, tag);
+        alloc_type_log("tag_memory(%p, %llu, %u, %s)\n", ptr, (unsigned long long)n_elements, element_size, tag);
     }
 
 
@@ -125,9 +132,9 @@ namespace counts
     public:
         List<cstr> tags;
         List<cstr> actions;
-        List<u32> sizes;
+        List<u64> sizes;
         List<u32> n_allocs;
-        List<u32> n_bytes;
+        List<u64> n_bytes;
 
         AllocLog()
         {
@@ -152,12 +159,12 @@ namespace counts
         cstr type_name = bit_width_str(ELE_SZ);
 
         void* keys[max_allocations] = { 0 };
-        u32 byte_counts[max_allocations] = { 0 };
-        u32 element_counts[max_allocations] = { 0 };
+        u64 byte_counts[max_allocations] = { 0 };
+        u64 element_counts[max_allocations] = { 0 };
         cstr tags[max_allocations] = { 0 };
 
-        u32 bytes_allocated = 0;
-        u32 elements_allocated = 0;
+        u64 bytes_allocated = 0;
+        u64 elements_allocated = 0;
         u32 n_allocations = 0;
 
         AllocLog<MAX_ALLOC> log;
@@ -184,18 +191,18 @@ namespace counts
         ac.log.n_allocs.push_back(ac.n_allocations);
         ac.log.n_bytes.push_back(ac.bytes_allocated);
 
-        alloc_type_log("%s<%u> %s | %u/%u (%u)\n", action, ac.element_size, ac.tags[slot], ac.n_allocations, ac.max_allocations, ac.bytes_allocated);
+        alloc_type_log("%s<%u> %s | %u/%u (%llu)\n", action, ac.element_size, ac.tags[slot], ac.n_allocations, ac.max_allocations, (unsigned long long)ac.bytes_allocated);
     }
 
 
     template <class AC>
-    static void* add_allocation(AC& ac, u32 n_elements, cstr tag)
+    static void* add_allocation(AC& ac, u64 n_elements, cstr tag)
     {
         static_assert(ac.max_allocations <= mem::AllocationStatus::MAX_SLOTS);
 
         // find next available slot
         u32 i = 0; 
-        for (;ac.keys[i] && i < ac.max_allocations; i++)
+        for (; i < ac.max_allocations && ac.keys[i]; i++)
         { }
 
         assert(i < ac.max_allocations && "Allocation limit reached");
@@ -205,14 +212,19 @@ namespace counts
             return 0;
         }
 
-        size_t const n_bytes = n_elements * ac.element_size;
+        u64 n_bytes = 0;
+        if (!mem::mul_size(n_elements, ac.element_size, n_bytes) || n_bytes > SIZE_MAX)
+        {
+            alloc_type_log("Allocation size overflow (%u)\n", ac.element_size);
+            return 0;
+        }
 
         void* data = 0;
 
         #if defined _WIN32
-        data = std::malloc(n_bytes);
+        data = std::malloc((size_t)n_bytes);
         #else
-        data = std::aligned_alloc(ac.element_size, n_bytes);
+        data = std::aligned_alloc(ac.element_size, (size_t)n_bytes);
         #endif
         
         assert(data && "Allocation failed");
@@ -242,7 +254,7 @@ namespace counts
 
         // find slot
         u32 i = 0;
-        for (; ac.keys[i] != ptr && i < ac.max_allocations; i++)
+        for (; i < ac.max_allocations && ac.keys[i] != ptr; i++)
         { }
         
         if (i >= ac.max_allocations)
@@ -268,13 +280,13 @@ namespace counts
 
 
     template <class AC>
-    static void tag_allocation(AC& ac, void* ptr, u32 n_elements, cstr tag)
+    static void tag_allocation(AC& ac, void* ptr, u64 n_elements, cstr tag)
     {
         static_assert(ac.max_allocations <= mem::AllocationStatus::MAX_SLOTS);
 
         // find slot, if any
         u32 i = 0;
-        for (; ac.keys[i] != ptr && i < ac.max_allocations; i++)
+        for (; i < ac.max_allocations && ac.keys[i] != ptr; i++)
         { }
 
         if (i < ac.max_allocations)
@@ -285,7 +297,7 @@ namespace counts
 
         // find next available slot
         i = 0; 
-        for (;ac.keys[i] && i < ac.max_allocations; i++)
+        for (; i < ac.max_allocations && ac.keys[i]; i++)
         { }
 
         assert(i < ac.max_allocations && "Allocation limit reached");
@@ -295,7 +307,11 @@ namespace counts
             return;
         }
 
-        size_t const n_bytes = n_elements * ac.element_size;
+        u64 n_bytes = 0;
+        if (!mem::mul_size(n_elements, ac.element_size, n_bytes))
+        {
+            return;
+        }
 
         ac.bytes_allocated += n_bytes;
         ac.keys[i] = ptr;
@@ -317,7 +333,7 @@ namespace counts
         
         // find slot
         u32 i = 0;
-        for (; ac.keys[i] != ptr && i < ac.max_allocations; i++)
+        for (; i < ac.max_allocations && ac.keys[i] != ptr; i++)
         { }
         
         if (i >= ac.max_allocations)
@@ -355,6 +371,9 @@ namespace mem
     Counts_16 alloc_16{};
     Counts_32 alloc_32{};
     Counts_64 alloc_64{};    
+
+    // data files are loaded on several threads at once
+    std::mutex alloc_mutex;
 }
 
 
@@ -362,8 +381,16 @@ namespace mem
 
 namespace mem
 {
-    void* malloc_memory(u32 n_elements, u32 element_size, cstr tag)
+    void* malloc_memory(u64 n_elements, u32 element_size, cstr tag)
     {
+        u64 n_bytes = 0;
+        if (!mul_size(n_elements, element_size, n_bytes))
+        {
+            return 0;
+        }
+
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         switch (element_size)
         {
         case 1:
@@ -380,7 +407,7 @@ namespace mem
         
         default:
             // TODO: custom alignments
-            return counts::add_allocation(alloc_8, n_elements * element_size, tag);
+            return counts::add_allocation(alloc_8, n_bytes, tag);
         }
     }
 }
@@ -418,6 +445,8 @@ namespace mem
 
     void free_memory(void* ptr, u32 element_size)
     {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         bool result = false;
 
         switch (element_size)
@@ -455,7 +484,7 @@ namespace mem
 
 namespace mem
 {
-    static long file_size(cstr file_path)
+    static u64 file_size(cstr file_path)
     {
         auto file = fopen(file_path, "rb");
         if (!file)
@@ -468,7 +497,7 @@ namespace mem
         auto size = ftell(file);
         fclose(file);
 
-        return size;
+        return size < 0 ? 0 : (u64)size;
     }
 
 
@@ -485,8 +514,16 @@ namespace mem
     }
 
 
-    void tag_memory(void* ptr, u32 n_elements, u32 element_size, cstr tag)
+    void tag_memory(void* ptr, u64 n_elements, u32 element_size, cstr tag)
     {
+        u64 n_bytes = 0;
+        if (!mul_size(n_elements, element_size, n_bytes))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         switch (element_size)
         {
         case 1:
@@ -506,7 +543,7 @@ namespace mem
             break;
         
         default:
-            counts::tag_allocation(alloc_8, ptr, n_elements * element_size, tag);
+            counts::tag_allocation(alloc_8, ptr, n_bytes, tag);
             break;
         }
     }
@@ -517,6 +554,8 @@ namespace mem
         alloc_type_log("tag_file_memory(%p, %u, %s)", ptr, n_elements, file_path);
 
         auto size = file_size(file_path);
+
+        std::lock_guard<std::mutex> lock(alloc_mutex);
         counts::tag_allocation(alloc_8, ptr, size, get_file_name(file_path));
     }
 }
@@ -528,6 +567,8 @@ namespace mem
 {
     void untag_memory(void* ptr, u32 element_size)
     {
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         switch (element_size)
         {
         case 1:
@@ -595,9 +636,9 @@ namespace mem
         {
             dst.tags = (cstr*)log.tags.data();
             dst.actions = (cstr*)log.actions.data();
-            dst.sizes = (u32*)log.sizes.data();
+            dst.sizes = (u64*)log.sizes.data();
             dst.n_allocs = (u32*)log.n_allocs.data();
-            dst.n_bytes = (u32*)log.n_bytes.data();
+            dst.n_bytes = (u64*)log.n_bytes.data();
         }
     }
 
@@ -606,6 +647,8 @@ namespace mem
     {
         AllocationStatus status{};
 
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         switch (element_size)
         {
         case 1:
@@ -637,6 +680,8 @@ namespace mem
     {
         AllocationHistory history{};
 
+        std::lock_guard<std::mutex> lock(alloc_mutex);
+
         switch (element_size)
         {
         case 1:
@@ -8,11 +8,11 @@
 
 namespace mem
 {    
-    void* malloc_memory(u32 n_elements, u32 element_size, cstr tag);
+    void* malloc_memory(u64 n_elements, u32 element_size, cstr tag);
 
     void free_memory(void* ptr, u32 element_size);    
 
-    void tag_memory(void* ptr, u32 n_elements, u32 element_size, cstr tag);
+    void tag_memory(void* ptr, u64 n_elements, u32 element_size, cstr tag);
 
     void tag_file_memory(void* ptr, u32 element_size, cstr file_path);
 
@@ -20,10 +20,41 @@ namespace mem
 }
 
 
+/* size arithmetic */
+
+namespace mem
+{
+    // false if a * b does not fit in 64 bits
+    inline bool mul_size(u64 a, u64 b, u64& res)
+    {
+        if (a && b > UINT64_MAX / a)
+        {
+            return false;
+        }
+
+        res = a * b;
+        return true;
+    }
+
+
+    // false if a + b does not fit in 64 bits
+    inline bool add_size(u64 a, u64 b, u64& res)
+    {
+        if (b > UINT64_MAX - a)
+        {
+            return false;
+        }
+
+        res = a + b;
+        return true;
+    }
+}
+
+
 namespace mem
 {
     template <typename T>
-    inline T* malloc(u32 n_elements, cstr tag)
+    inline T* malloc(u64 n_elements, cstr tag)
     {
         return (T*)malloc_memory(n_elements, (u32)sizeof(T), tag);
     }
@@ -51,7 +82,7 @@ namespace mem
 
 
     template <typename T>
-    inline void tag(T* data, u32 n_elements, cstr tag)
+    inline void tag(T* data, u64 n_elements, cstr tag)
     {
         tag_memory((void*)data, n_elements, (u32)sizeof(T), tag);
     }
@@ -84,14 +115,14 @@ namespace mem
         u32 element_size = 0;
         u32 max_allocations = 0;
 
-        u32 bytes_allocated = 0;
-        u32 elements_allocated = 0;
+        u64 bytes_allocated = 0;
+        u64 elements_allocated = 0;
 
         u32 n_allocations = 0;
 
         // TODO: max allocations
         cstr slot_tags[MAX_SLOTS] = { 0 };
-        u32 slot_sizes[MAX_SLOTS] = { 0 };
+        u64 slot_sizes[MAX_SLOTS] = { 0 };
     };
 
 
@@ -105,9 +136,9 @@ namespace mem
 
         cstr* tags = 0;
         cstr* actions = 0;
-        u32* sizes = 0;
+        u64* sizes = 0;
         u32* n_allocs = 0;
-        u32* n_bytes = 0;
+        u64* n_bytes = 0;
 
     };
 
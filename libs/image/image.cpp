@@ -112,6 +112,356 @@ namespace image
 
 /* gradient */
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMAGE_X86
+#endif
+
+#ifdef IMAGE_X86
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+
+#define IMAGE_TARGET_128
+#define IMAGE_TARGET_256
+
+#else
+
+#define IMAGE_TARGET_128 __attribute__((target("sse4.1")))
+#define IMAGE_TARGET_256 __attribute__((target("avx2")))
+
+#endif
+
+#endif
+
+
+namespace image
+{
+    using gradient_row_f = void (*)(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width);
+
+
+    // weights are 0.25 and 0.5, s = 4 * gradient
+    // rounds half up, negative gradients are 0
+    static inline u8 round_gradient(int s)
+    {
+        s = (s + 2) >> 2;
+
+        return (u8)(s < 0 ? 0 : (s > 255 ? 255 : s));
+    }
+
+
+    static void gradient_x_row_32(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        for (u32 x = 0; x < width; x++)
+        {
+            d[x] = round_gradient((r1[x + 2] - r1[x]) + 2 * (r2[x + 2] - r2[x]) + (r3[x + 2] - r3[x]));
+        }
+    }
+
+
+    static void gradient_y_row_32(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        for (u32 x = 0; x < width; x++)
+        {
+            d[x] = round_gradient((r3[x] - r1[x]) + 2 * (r3[x + 1] - r1[x + 1]) + (r3[x + 2] - r1[x + 2]));
+        }
+    }
+}
+
+
+#ifdef IMAGE_X86
+
+namespace image
+{
+    // 8 pixels widened to i16
+    IMAGE_TARGET_128
+    static inline __m128i load_8x16(u8 const* p)
+    {
+        return _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)p));
+    }
+
+
+    // (a + 2b + c) for 8 pixels
+    IMAGE_TARGET_128
+    static inline __m128i sum_x_128(u8 const* r1, u8 const* r2, u8 const* r3)
+    {
+        auto a = _mm_sub_epi16(load_8x16(r1 + 2), load_8x16(r1));
+        auto b = _mm_sub_epi16(load_8x16(r2 + 2), load_8x16(r2));
+        auto c = _mm_sub_epi16(load_8x16(r3 + 2), load_8x16(r3));
+
+        return _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+    }
+
+
+    IMAGE_TARGET_128
+    static inline __m128i sum_y_128(u8 const* r1, u8 const* r3)
+    {
+        auto a = _mm_sub_epi16(load_8x16(r3), load_8x16(r1));
+        auto b = _mm_sub_epi16(load_8x16(r3 + 1), load_8x16(r1 + 1));
+        auto c = _mm_sub_epi16(load_8x16(r3 + 2), load_8x16(r1 + 2));
+
+        return _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+    }
+
+
+    // round_gradient for 16 pixels, packus saturates to [0, 255]
+    IMAGE_TARGET_128
+    static inline __m128i round_pack_128(__m128i lo, __m128i hi)
+    {
+        auto const two = _mm_set1_epi16(2);
+
+        lo = _mm_srai_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srai_epi16(_mm_add_epi16(hi, two), 2);
+
+        return _mm_packus_epi16(lo, hi);
+    }
+
+
+    // 16 output pixels
+    IMAGE_TARGET_128
+    static inline void gradient_x_block_128(u8 const* r1, u8 const* r2, u8 const* r3, u8* d)
+    {
+        auto lo = sum_x_128(r1, r2, r3);
+        auto hi = sum_x_128(r1 + 8, r2 + 8, r3 + 8);
+
+        _mm_storeu_si128((__m128i*)d, round_pack_128(lo, hi));
+    }
+
+
+    IMAGE_TARGET_128
+    static inline void gradient_y_block_128(u8 const* r1, u8 const* r3, u8* d)
+    {
+        auto lo = sum_y_128(r1, r3);
+        auto hi = sum_y_128(r1 + 8, r3 + 8);
+
+        _mm_storeu_si128((__m128i*)d, round_pack_128(lo, hi));
+    }
+
+
+    IMAGE_TARGET_128
+    static void gradient_x_row_128(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        constexpr u32 N = 16;
+
+        if (width < N)
+        {
+            gradient_x_row_32(r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            gradient_x_block_128(r1 + x, r2 + x, r3 + x, d + x);
+        }
+
+        // the last block overlaps the previous one
+        gradient_x_block_128(r1 + x_last, r2 + x_last, r3 + x_last, d + x_last);
+    }
+
+
+    IMAGE_TARGET_128
+    static void gradient_y_row_128(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        constexpr u32 N = 16;
+
+        if (width < N)
+        {
+            gradient_y_row_32(r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            gradient_y_block_128(r1 + x, r3 + x, d + x);
+        }
+
+        // the last block overlaps the previous one
+        gradient_y_block_128(r1 + x_last, r3 + x_last, d + x_last);
+    }
+
+
+    // 16 pixels widened to i16
+    IMAGE_TARGET_256
+    static inline __m256i load_16x16(u8 const* p)
+    {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)p));
+    }
+
+
+    IMAGE_TARGET_256
+    static inline __m256i sum_x_256(u8 const* r1, u8 const* r2, u8 const* r3)
+    {
+        auto a = _mm256_sub_epi16(load_16x16(r1 + 2), load_16x16(r1));
+        auto b = _mm256_sub_epi16(load_16x16(r2 + 2), load_16x16(r2));
+        auto c = _mm256_sub_epi16(load_16x16(r3 + 2), load_16x16(r3));
+
+        return _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1));
+    }
+
+
+    IMAGE_TARGET_256
+    static inline __m256i sum_y_256(u8 const* r1, u8 const* r3)
+    {
+        auto a = _mm256_sub_epi16(load_16x16(r3), load_16x16(r1));
+        auto b = _mm256_sub_epi16(load_16x16(r3 + 1), load_16x16(r1 + 1));
+        auto c = _mm256_sub_epi16(load_16x16(r3 + 2), load_16x16(r1 + 2));
+
+        return _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1));
+    }
+
+
+    IMAGE_TARGET_256
+    static inline __m256i round_pack_256(__m256i lo, __m256i hi)
+    {
+        auto const two = _mm256_set1_epi16(2);
+
+        lo = _mm256_srai_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srai_epi16(_mm256_add_epi16(hi, two), 2);
+
+        // packus works per 128 bit lane, restore the pixel order
+        return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+    }
+
+
+    // 32 output pixels
+    IMAGE_TARGET_256
+    static inline void gradient_x_block_256(u8 const* r1, u8 const* r2, u8 const* r3, u8* d)
+    {
+        auto lo = sum_x_256(r1, r2, r3);
+        auto hi = sum_x_256(r1 + 16, r2 + 16, r3 + 16);
+
+        _mm256_storeu_si256((__m256i*)d, round_pack_256(lo, hi));
+    }
+
+
+    IMAGE_TARGET_256
+    static inline void gradient_y_block_256(u8 const* r1, u8 const* r3, u8* d)
+    {
+        auto lo = sum_y_256(r1, r3);
+        auto hi = sum_y_256(r1 + 16, r3 + 16);
+
+        _mm256_storeu_si256((__m256i*)d, round_pack_256(lo, hi));
+    }
+
+
+    IMAGE_TARGET_256
+    static void gradient_x_row_256(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        constexpr u32 N = 32;
+
+        if (width < N)
+        {
+            gradient_x_row_128(r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            gradient_x_block_256(r1 + x, r2 + x, r3 + x, d + x);
+        }
+
+        // the last block overlaps the previous one
+        gradient_x_block_256(r1 + x_last, r2 + x_last, r3 + x_last, d + x_last);
+    }
+
+
+    IMAGE_TARGET_256
+    static void gradient_y_row_256(u8 const* r1, u8 const* r2, u8 const* r3, u8* d, u32 width)
+    {
+        constexpr u32 N = 32;
+
+        if (width < N)
+        {
+            gradient_y_row_128(r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            gradient_y_block_256(r1 + x, r3 + x, d + x);
+        }
+
+        // the last block overlaps the previous one
+        gradient_y_block_256(r1 + x_last, r3 + x_last, d + x_last);
+    }
+}
+
+#endif
+
+
+namespace image
+{
+    static gradient_row_f gradient_x_row()
+    {
+    #ifdef IMAGE_X86
+
+        switch (span::simd_level())
+        {
+        case span::SimdLevel::AVX512:
+        case span::SimdLevel::AVX2: return gradient_x_row_256;
+        case span::SimdLevel::SSE4: return gradient_x_row_128;
+        default: break;
+        }
+
+    #endif
+
+        return gradient_x_row_32;
+    }
+
+
+    static gradient_row_f gradient_y_row()
+    {
+    #ifdef IMAGE_X86
+
+        switch (span::simd_level())
+        {
+        case span::SimdLevel::AVX512:
+        case span::SimdLevel::AVX2: return gradient_y_row_256;
+        case span::SimdLevel::SSE4: return gradient_y_row_128;
+        default: break;
+        }
+
+    #endif
+
+        return gradient_y_row_32;
+    }
+
+
+    static void gradient_rows(GrayView const& src, GrayView const& dst, gradient_row_f row_f)
+    {
+        auto r1 = row_begin(src, 0);
+        auto r2 = row_begin(src, 1);
+        auto r3 = row_begin(src, 2);
+        auto d = row_begin(dst, 0);
+
+        auto sw = src.width;
+        auto dw = dst.width;
+
+        for (u32 y = 0; y < dst.height; y++)
+        {
+            row_f(r1, r2, r3, d, dw);
+
+            r1 += sw;
+            r2 += sw;
+            r3 += sw;
+            d += dw;
+        }
+    }
+}
+
+
 namespace image
 {
     void gradient_x(GrayView const& src, GrayView const& dst)
@@ -129,24 +479,7 @@ namespace image
         };
         */
 
-        auto r1 = row_begin(src, 0);
-        auto r2 = row_begin(src, 1);
-        auto r3 = row_begin(src, 2);
-        auto d = row_begin(dst, 0);
-
-        for (u32 y = 0; y < dst.height; y++)
-        {
-            for (u32 x = 0; x < dst.width; x++)
-            {
-                auto g = 0.25f * (r1[x + 2] - r1[x] + r3[x + 2] - r3[x]) + 0.5f * (r2[x + 2] - r2[x]);
-                d[x] = num::round_to_unsigned<u8>(g);
-            }
-
-            r1 += src.width;
-            r2 += src.width;
-            r3 += src.width;
-            d += dst.width;
-        }
+        gradient_rows(src, dst, gradient_x_row());
     }
 
 
@@ -165,27 +498,7 @@ namespace image
         };
         */
 
-        auto r1 = row_begin(src, 0);
-        auto r2 = row_begin(src, 1);
-        auto r3 = row_begin(src, 2);
-        auto d = row_begin(dst, 0);
-
-        auto sw = src.width;
-        auto dw = dst.width;
-
-        for (u32 y = 0; y < dst.height; y++)
-        {
-            for (u32 x = 0; x < dst.width; x++)
-            {
-                auto g = 0.25f * (r3[x] - r1[x] + r3[x + 2] - r1[x + 2]) + 0.5f * (r3[x + 1] - r1[x + 1]);
-                d[x] = num::round_to_unsigned<u8>(g);
-            }
-
-            r1 += sw;
-            r2 += sw;
-            r3 += sw;
-            d += dw;
-        }
+        gradient_rows(src, dst, gradient_y_row());
     }
 }
 
@@ -224,4 +537,293 @@ namespace image
             d += dw;
         }
     }
-}
\ No newline at end of file
+}
+
+/* gradient pool */
+
+namespace image
+{
+    // rows r0..r3 of the source give gradient rows 2y and 2y + 1
+    using gradient_pool_row_f = void (*)(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width);
+
+    constexpr f32 GRADIENT_SCALE = 1.0f / 255.0f;
+
+
+    static inline int sum_x_32(u8 const* r1, u8 const* r2, u8 const* r3, u32 x)
+    {
+        return (r1[x + 2] - r1[x]) + 2 * (r2[x + 2] - r2[x]) + (r3[x + 2] - r3[x]);
+    }
+
+
+    static inline int sum_y_32(u8 const* r1, u8 const* r3, u32 x)
+    {
+        return (r3[x] - r1[x]) + 2 * (r3[x + 1] - r1[x + 1]) + (r3[x + 2] - r1[x + 2]);
+    }
+
+
+    static inline int max_32(int a, int b, int c, int d)
+    {
+        auto ab = a > b ? a : b;
+        auto cd = c > d ? c : d;
+
+        return ab > cd ? ab : cd;
+    }
+
+
+    static void gradient_x_pool_row_32(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        for (u32 x = 0; x < width; x++)
+        {
+            auto gx = 2 * x;
+            auto s = max_32(
+                sum_x_32(r0, r1, r2, gx), sum_x_32(r0, r1, r2, gx + 1),
+                sum_x_32(r1, r2, r3, gx), sum_x_32(r1, r2, r3, gx + 1));
+
+            d[x] = GRADIENT_SCALE * round_gradient(s);
+        }
+    }
+
+
+    static void gradient_y_pool_row_32(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        for (u32 x = 0; x < width; x++)
+        {
+            auto gx = 2 * x;
+            auto s = max_32(
+                sum_y_32(r0, r2, gx), sum_y_32(r0, r2, gx + 1),
+                sum_y_32(r1, r3, gx), sum_y_32(r1, r3, gx + 1));
+
+            d[x] = GRADIENT_SCALE * round_gradient(s);
+        }
+    }
+}
+
+
+#ifdef IMAGE_X86
+
+namespace image
+{
+    // max of 2x2 blocks of i16 gradient sums, rounded and scaled
+    // (a, b) are vertically adjacent rows, adjacent columns share a 32 bit lane
+    IMAGE_TARGET_128
+    static inline __m128 pool_scale_128(__m128i a, __m128i b)
+    {
+        auto m = _mm_max_epi16(a, b);
+        m = _mm_max_epi16(m, _mm_srli_epi32(m, 16));
+
+        // low 16 bits of each lane, sign extended
+        auto s = _mm_srai_epi32(_mm_slli_epi32(m, 16), 16);
+        s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(2)), 2);
+        s = _mm_max_epi32(s, _mm_setzero_si128());
+
+        return _mm_mul_ps(_mm_cvtepi32_ps(s), _mm_set1_ps(GRADIENT_SCALE));
+    }
+
+
+    // 4 outputs from 8 gradient columns
+    IMAGE_TARGET_128
+    static inline void gradient_x_pool_block_128(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d)
+    {
+        _mm_storeu_ps(d, pool_scale_128(sum_x_128(r0, r1, r2), sum_x_128(r1, r2, r3)));
+    }
+
+
+    IMAGE_TARGET_128
+    static inline void gradient_y_pool_block_128(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d)
+    {
+        _mm_storeu_ps(d, pool_scale_128(sum_y_128(r0, r2), sum_y_128(r1, r3)));
+    }
+
+
+    IMAGE_TARGET_128
+    static void gradient_x_pool_row_128(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        constexpr u32 N = 4;
+
+        if (width < N)
+        {
+            gradient_x_pool_row_32(r0, r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            auto gx = 2 * x;
+            gradient_x_pool_block_128(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x);
+        }
+
+        // the last block overlaps the previous one
+        auto gx = 2 * x_last;
+        gradient_x_pool_block_128(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x_last);
+    }
+
+
+    IMAGE_TARGET_128
+    static void gradient_y_pool_row_128(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        constexpr u32 N = 4;
+
+        if (width < N)
+        {
+            gradient_y_pool_row_32(r0, r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            auto gx = 2 * x;
+            gradient_y_pool_block_128(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x);
+        }
+
+        // the last block overlaps the previous one
+        auto gx = 2 * x_last;
+        gradient_y_pool_block_128(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x_last);
+    }
+
+
+    IMAGE_TARGET_256
+    static inline __m256 pool_scale_256(__m256i a, __m256i b)
+    {
+        auto m = _mm256_max_epi16(a, b);
+        m = _mm256_max_epi16(m, _mm256_srli_epi32(m, 16));
+
+        auto s = _mm256_srai_epi32(_mm256_slli_epi32(m, 16), 16);
+        s = _mm256_srai_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(2)), 2);
+        s = _mm256_max_epi32(s, _mm256_setzero_si256());
+
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(s), _mm256_set1_ps(GRADIENT_SCALE));
+    }
+
+
+    // 8 outputs from 16 gradient columns
+    IMAGE_TARGET_256
+    static inline void gradient_x_pool_block_256(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d)
+    {
+        _mm256_storeu_ps(d, pool_scale_256(sum_x_256(r0, r1, r2), sum_x_256(r1, r2, r3)));
+    }
+
+
+    IMAGE_TARGET_256
+    static inline void gradient_y_pool_block_256(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d)
+    {
+        _mm256_storeu_ps(d, pool_scale_256(sum_y_256(r0, r2), sum_y_256(r1, r3)));
+    }
+
+
+    IMAGE_TARGET_256
+    static void gradient_x_pool_row_256(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        constexpr u32 N = 8;
+
+        if (width < N)
+        {
+            gradient_x_pool_row_128(r0, r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            auto gx = 2 * x;
+            gradient_x_pool_block_256(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x);
+        }
+
+        // the last block overlaps the previous one
+        auto gx = 2 * x_last;
+        gradient_x_pool_block_256(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x_last);
+    }
+
+
+    IMAGE_TARGET_256
+    static void gradient_y_pool_row_256(u8 const* r0, u8 const* r1, u8 const* r2, u8 const* r3, f32* d, u32 width)
+    {
+        constexpr u32 N = 8;
+
+        if (width < N)
+        {
+            gradient_y_pool_row_128(r0, r1, r2, r3, d, width);
+            return;
+        }
+
+        auto const x_last = width - N;
+
+        u32 x = 0;
+        for (; x < x_last; x += N)
+        {
+            auto gx = 2 * x;
+            gradient_y_pool_block_256(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x);
+        }
+
+        // the last block overlaps the previous one
+        auto gx = 2 * x_last;
+        gradient_y_pool_block_256(r0 + gx, r1 + gx, r2 + gx, r3 + gx, d + x_last);
+    }
+}
+
+#endif
+
+
+namespace image
+{
+    void gradient_pool(GrayView const& src, SpanView<f32> const& dst)
+    {
+        assert(src.matrix_data_);
+        assert(dst.data);
+        assert(src.width > 3 && src.height > 3);
+
+        auto const width = (src.width - 2) / 2;
+        auto const height = (src.height - 2) / 2;
+        auto const len = width * height;
+
+        assert(dst.length == 2 * len);
+
+        gradient_pool_row_f x_row = gradient_x_pool_row_32;
+        gradient_pool_row_f y_row = gradient_y_pool_row_32;
+
+    #ifdef IMAGE_X86
+
+        switch (span::simd_level())
+        {
+        case span::SimdLevel::AVX512:
+        case span::SimdLevel::AVX2:
+            x_row = gradient_x_pool_row_256;
+            y_row = gradient_y_pool_row_256;
+            break;
+
+        case span::SimdLevel::SSE4:
+            x_row = gradient_x_pool_row_128;
+            y_row = gradient_y_pool_row_128;
+            break;
+
+        default:
+            break;
+        }
+
+    #endif
+
+        auto dx = dst.data;
+        auto dy = dst.data + len;
+
+        for (u32 y = 0; y < height; y++)
+        {
+            auto r0 = row_begin(src, 2 * y);
+            auto r1 = r0 + src.width;
+            auto r2 = r1 + src.width;
+            auto r3 = r2 + src.width;
+
+            x_row(r0, r1, r2, r3, dx, width);
+            y_row(r0, r1, r2, r3, dy, width);
+
+            dx += width;
+            dy += width;
+        }
+    }
+}
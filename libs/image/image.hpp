@@ -237,7 +237,7 @@ namespace image
     {
         SpanView<T> span{};
 
-        span.data = view.matrix_data_ + (u64)(y * view.width) + x_begin;
+        span.data = view.matrix_data_ + (u64)y * view.width + x_begin;
         span.length = x_end - x_begin;
 
         return span;
@@ -341,4 +341,14 @@ namespace image
 namespace image
 {
     void scale_down_max(GrayView const& src, GrayView const& dst);
+}
+
+
+/* gradient pool */
+
+namespace image
+{
+    // gradient_x then gradient_y, each scale_down_max'd and scaled to [0, 1] as f32
+    // dst.length == 2 * ((src.width - 2) / 2) * ((src.height - 2) / 2)
+    void gradient_pool(GrayView const& src, SpanView<f32> const& dst);
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#if defined _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <windows.h>
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+
+#if defined _WIN32
+
+namespace mapped_file
+{
+    static MappedFile map_file(cstr file_path, bool copy_on_write)
+    {
+        MappedFile file{};
+
+        auto fh = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (fh == INVALID_HANDLE_VALUE)
+        {
+            return file;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(fh);
+            return file;
+        }
+
+        auto mh = CreateFileMappingA(fh, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+        if (!mh)
+        {
+            CloseHandle(fh);
+            return file;
+        }
+
+        auto data = MapViewOfFile(mh, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        if (!data)
+        {
+            CloseHandle(mh);
+            CloseHandle(fh);
+            return file;
+        }
+
+        file.data = (u8*)data;
+        file.size = (u64)size.QuadPart;
+        file.file_handle = (void*)fh;
+        file.map_handle = (void*)mh;
+        file.ok = true;
+
+        return file;
+    }
+
+
+    MappedFile map_read(cstr file_path)
+    {
+        return map_file(file_path, false);
+    }
+
+
+    MappedFile map_copy(cstr file_path)
+    {
+        return map_file(file_path, true);
+    }
+
+
+    void unmap(MappedFile& file)
+    {
+        if (file.data)
+        {
+            UnmapViewOfFile(file.data);
+        }
+
+        if (file.map_handle)
+        {
+            CloseHandle((HANDLE)file.map_handle);
+        }
+
+        if (file.file_handle)
+        {
+            CloseHandle((HANDLE)file.file_handle);
+        }
+
+        file = MappedFile{};
+    }
+
+
+    void advise(MappedFile const& file, u64 offset, u64 size, Access access)
+    {
+        if (!file.ok || offset >= file.size)
+        {
+            return;
+        }
+
+        if (size > file.size - offset)
+        {
+            size = file.size - offset;
+        }
+
+        // windows has no access pattern hints, only prefetching
+        switch (access)
+        {
+        case Access::Sequential:
+        case Access::WillNeed:
+        {
+            WIN32_MEMORY_RANGE_ENTRY range;
+            range.VirtualAddress = (PVOID)(file.data + offset);
+            range.NumberOfBytes = (SIZE_T)size;
+
+            PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+        } break;
+
+        default:
+            break;
+        }
+    }
+
+
+    u64 file_size(cstr file_path)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+        if (!GetFileAttributesExA(file_path, GetFileExInfoStandard, &attr))
+        {
+            return 0;
+        }
+
+        return ((u64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    }
+}
+
+#else
+
+namespace mapped_file
+{
+    static MappedFile map_file(cstr file_path, bool copy_on_write)
+    {
+        MappedFile file{};
+
+        auto fd = open(file_path, O_RDONLY);
+        if (fd < 0)
+        {
+            return file;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            close(fd);
+            return file;
+        }
+
+        auto size = (u64)st.st_size;
+
+        // MAP_SHARED, read only pages come from the page cache
+        // MAP_PRIVATE, written pages are private copies, the file is opened read only either way
+        auto data = copy_on_write ?
+            mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+            mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+
+        // the mapping keeps its own reference to the file
+        close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            return file;
+        }
+
+        file.data = (u8*)data;
+        file.size = size;
+        file.ok = true;
+
+        return file;
+    }
+
+
+    MappedFile map_read(cstr file_path)
+    {
+        return map_file(file_path, false);
+    }
+
+
+    MappedFile map_copy(cstr file_path)
+    {
+        return map_file(file_path, true);
+    }
+
+
+    void unmap(MappedFile& file)
+    {
+        if (file.data)
+        {
+            munmap(file.data, file.size);
+        }
+
+        file = MappedFile{};
+    }
+
+
+    void advise(MappedFile const& file, u64 offset, u64 size, Access access)
+    {
+        if (!file.ok || offset >= file.size)
+        {
+            return;
+        }
+
+        if (size > file.size - offset)
+        {
+            size = file.size - offset;
+        }
+
+        // madvise wants a page aligned address
+        auto page = (u64)sysconf(_SC_PAGESIZE);
+        auto begin = offset / page * page;
+        size += offset - begin;
+
+        int advice = POSIX_MADV_NORMAL;
+
+        switch (access)
+        {
+        case Access::Sequential: advice = POSIX_MADV_SEQUENTIAL; break;
+        case Access::Random: advice = POSIX_MADV_RANDOM; break;
+        case Access::WillNeed: advice = POSIX_MADV_WILLNEED; break;
+        default: break;
+        }
+
+        // only a hint, failure is not an error
+        posix_madvise(file.data + begin, size, advice);
+    }
+
+
+    u64 file_size(cstr file_path)
+    {
+        struct stat st;
+        if (stat(file_path, &st) != 0)
+        {
+            return 0;
+        }
+
+        return (u64)st.st_size;
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../util/types.hpp"
+
+
+class MappedFile
+{
+public:
+    u8* data = 0;
+    u64 size = 0;
+
+    bool ok = false;
+
+    // platform handles
+    void* file_handle = 0;
+    void* map_handle = 0;
+};
+
+
+namespace mapped_file
+{
+    enum class Access : u8
+    {
+        Normal,
+        Sequential,
+        Random,
+        WillNeed
+    };
+
+
+    // read only view of the whole file, pages are shared with other processes mapping it
+    MappedFile map_read(cstr file_path);
+
+    // writable view of the whole file, a page is copied on its first write and the file is never modified
+    MappedFile map_copy(cstr file_path);
+
+    void unmap(MappedFile& file);
+
+    // paging hint for the bytes [offset, offset + size) of the mapping
+    void advise(MappedFile const& file, u64 offset, u64 size, Access access);
+
+    inline void advise(MappedFile const& file, Access access) { advise(file, 0, file.size, access); }
+
+    u64 file_size(cstr file_path);
+}
@@ -2,87 +2,377 @@
 
 #include "mnist.hpp"
 
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
+#include <new>
+#include <thread>
 
 namespace mb = memory_buffer;
 
 namespace mnist
 {
-    static u32 reverse_bytes(u32 val)
+    // idx headers are big endian
+    static u32 read_u32(u8 const* src)
     {
-        return ((val >> 24) & 0xff) |       // Move byte 3 to byte 0
-            ((val << 8) & 0xff0000) |    // Move byte 1 to byte 2
-            ((val >> 8) & 0xff00) |      // Move byte 2 to byte 1
-            ((val << 24) & 0xff000000);  // Move byte 0 to byte 3
+        return ((u32)src[0] << 24) | ((u32)src[1] << 16) | ((u32)src[2] << 8) | (u32)src[3];
     }
 
 
-    u32 read_u32(std::ifstream& file)
+    // the buffer does not own the memory, destroy_data unmaps the file
+    static MemoryBuffer<u8> make_file_buffer(MappedFile const& file, u64 offset, u64 n_bytes)
     {
-        u32 val;
-        auto dst = (char*)(&val);
+        MemoryBuffer<u8> buffer{};
+        buffer.data_ = file.data + offset;
+        buffer.capacity_ = n_bytes;
+        buffer.size_ = n_bytes;
+        buffer.ok = true;
 
-        file.read(dst, sizeof(val));
+        return buffer;
+    }
+
+
+    static void release_file_buffer(MemoryBuffer<u8>& buffer, MappedFile& file)
+    {
+        if (file.ok)
+        {
+            mem::untag(file.data);
+            mapped_file::unmap(file);
+        }
 
-        return reverse_bytes(val);
+        buffer = MemoryBuffer<u8>{};
     }
 }
 
 
+/* stream */
+
 namespace mnist
 {
-    ImageData load_image_data(cstr filepath)
+    class ImageStream
+    {
+    public:
+        u32 image_count = 0;
+        u64 image_bytes = 0;
+        u64 data_offset = 0;
+
+        u32 chunk_images = 0;
+        u64 chunk_bytes = 0;
+
+        // chunks in the file, buffers in the ring
+        u32 n_chunks = 0;
+        u32 n_slots = 0;
+
+        MemoryBuffer<u8> ring;
+        MemoryBuffer<u8> scratch;
+
+        // chunks are numbered in the order they are read, chunk = seq % n_chunks, slot = seq % n_slots
+        u64 slot_seq[MAX_STREAM_CHUNKS] = { 0 };
+        b8 slot_ready[MAX_STREAM_CHUNKS] = { 0 };
+
+        // the chunk the consumer is on, the ring holds it and the ones after it
+        u64 head_seq = 0;
+
+        bool stop = false;
+
+        // read by the prefetch thread only
+        std::ifstream file;
+
+        // image_at misses, under the lock
+        std::ifstream random_file;
+
+        std::mutex mutex;
+        std::condition_variable prefetch_cv;
+        std::condition_variable ready_cv;
+        std::thread prefetch;
+    };
+
+
+    static u32 window_size(ImageStream const& s)
+    {
+        return s.n_slots < s.n_chunks ? s.n_slots : s.n_chunks;
+    }
+
+
+    static u64 chunk_offset(ImageStream const& s, u32 chunk)
+    {
+        return s.data_offset + (u64)chunk * s.chunk_bytes;
+    }
+
+
+    static u64 chunk_length(ImageStream const& s, u32 chunk)
+    {
+        auto begin = (u64)chunk * s.chunk_images;
+        auto end = begin + s.chunk_images;
+        end = end < s.image_count ? end : s.image_count;
+
+        return (end - begin) * s.image_bytes;
+    }
+
+
+    static void run_prefetch(ImageStream& s)
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+
+        while (!s.stop)
+        {
+            // first chunk of the window that is not resident, closest to the consumer first
+            u64 seq = 0;
+            auto found = false;
+
+            auto n_window = window_size(s);
+            for (u32 i = 0; i < n_window && !found; i++)
+            {
+                seq = s.head_seq + i;
+                found = s.slot_seq[seq % s.n_slots] != seq;
+            }
+
+            if (!found)
+            {
+                s.prefetch_cv.wait(lock);
+                continue;
+            }
+
+            auto slot = (u32)(seq % s.n_slots);
+            auto chunk = (u32)(seq % s.n_chunks);
+
+            s.slot_seq[slot] = seq;
+            s.slot_ready[slot] = 0;
+
+            lock.unlock();
+
+            auto dst = s.ring.data_ + (u64)slot * s.chunk_bytes;
+
+            auto len = chunk_length(s, chunk);
+
+            s.file.seekg((std::streamoff)chunk_offset(s, chunk));
+            s.file.read((char*)dst, (std::streamsize)len);
+
+            // the size was checked when the stream was opened, a failed read leaves the chunk black
+            if (!s.file.good())
+            {
+                assert("*** mnist stream read failed ***" && false);
+                span::fill_u8(dst, 0, len);
+                s.file.clear();
+            }
+
+            lock.lock();
+
+            s.slot_ready[slot] = 1;
+
+            s.ready_cv.notify_all();
+        }
+    }
+
+
+    // seq of chunk in the current window, or a new one past everything read so far
+    static u64 find_seq(ImageStream const& s, u32 chunk)
+    {
+        auto n_window = window_size(s);
+        for (u32 i = 0; i < n_window; i++)
+        {
+            auto seq = s.head_seq + i;
+            if (seq % s.n_chunks == chunk)
+            {
+                return seq;
+            }
+        }
+
+        return ((s.head_seq + s.n_slots) / s.n_chunks + 1) * s.n_chunks + chunk;
+    }
+
+
+    static void destroy_stream(ImageStream* stream)
+    {
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            stream->stop = true;
+        }
+
+        stream->prefetch_cv.notify_one();
+
+        if (stream->prefetch.joinable())
+        {
+            stream->prefetch.join();
+        }
+
+        mb::destroy_buffer(stream->ring);
+        mb::destroy_buffer(stream->scratch);
+
+        stream->~ImageStream();
+        mem::free(stream);
+    }
+}
+
+
+namespace mnist
+{
+    ImageData open_image_stream(cstr filepath, u32 chunk_images, u32 n_chunks)
     {
         constexpr u32 CODE = 2051;
+        constexpr u32 HEADER_BYTES = 16;
 
         ImageData data{};
         data.ok = false;
 
+        assert(chunk_images > 0);
+        assert(n_chunks >= 2 && n_chunks <= MAX_STREAM_CHUNKS);
+
         std::ifstream file(filepath, std::ios::binary);
         if (!file.is_open())
         {
             return data;
         }
 
-        auto code = read_u32(file);
+        u8 header[HEADER_BYTES];
+        file.read((char*)header, HEADER_BYTES);
+        if (!file.good() || read_u32(header) != CODE)
+        {
+            return data;
+        }
+
+        file.close();
+
+        auto n_images = read_u32(header + 4);
+        auto n_rows = read_u32(header + 8);
+        auto n_cols = read_u32(header + 12);
+
+        // chunks stay a multiple of 8 bytes so that they can be hashed one after the other
+        chunk_images = (chunk_images + 7) / 8 * 8;
+
+        u64 n_pixels = 0;
+        u64 n_bytes = 0;
+        u64 chunk_bytes = 0;
+        u64 ring_bytes = 0;
+
+        auto ok = mem::mul_size(n_rows, n_cols, n_pixels) &&
+            mem::mul_size(n_images, n_pixels, n_bytes) &&
+            mem::mul_size(chunk_images, n_pixels, chunk_bytes);
 
-        if (code != CODE)
+        // corrupt header or truncated file
+        if (!ok || n_bytes == 0 || mapped_file::file_size(filepath) - HEADER_BYTES < n_bytes)
         {
             return data;
         }
 
-        auto n_images = read_u32(file);
-        auto n_rows = read_u32(file);
-        auto n_cols = read_u32(file);
+        auto n_file_chunks = (n_images + chunk_images - 1) / chunk_images;
 
-        auto n_bytes = n_images * n_rows * n_cols;
+        // no point in more buffers than chunks
+        n_chunks = n_chunks < n_file_chunks ? n_chunks : n_file_chunks;
 
-        MemoryBuffer<u8> buffer8;
+        if (!mem::mul_size(n_chunks, chunk_bytes, ring_bytes))
+        {
+            return data;
+        }
 
-        mb::create_buffer<u8>(buffer8, n_bytes, "mnist data pixels");
-        if (!buffer8.ok)
+        auto stream = mem::malloc<ImageStream>(1, "mnist stream");
+        if (!stream)
         {
-            file.close();
             return data;
         }
 
-        file.read((char*)buffer8.data_, n_bytes);
+        new (stream) ImageStream();
 
-        file.close();
+        auto& s = *stream;
+        s.image_count = n_images;
+        s.image_bytes = n_pixels;
+        s.data_offset = HEADER_BYTES;
+        s.chunk_images = chunk_images;
+        s.chunk_bytes = chunk_bytes;
+        s.n_chunks = n_file_chunks;
+        s.n_slots = n_chunks;
+
+        // nothing is resident
+        for (u32 i = 0; i < MAX_STREAM_CHUNKS; i++)
+        {
+            s.slot_seq[i] = UINT64_MAX;
+        }
+
+        s.file.open(filepath, std::ios::binary);
+        s.random_file.open(filepath, std::ios::binary);
+
+        ok = s.file.is_open() && s.random_file.is_open() &&
+            mb::create_buffer(s.ring, ring_bytes, "mnist stream ring") &&
+            mb::create_buffer(s.scratch, n_pixels, "mnist stream image") &&
+            mb::create_buffer(data.input_buffer, n_pixels, "mnist data input");
+
+        if (!ok)
+        {
+            mb::destroy_buffer(data.input_buffer);
+            destroy_stream(stream);
+            return data;
+        }
+
+        s.prefetch = std::thread([stream](){ run_prefetch(*stream); });
+
+        data.image_count = n_images;
+        data.image_width = n_cols;
+        data.image_height = n_rows;
+        data.stream = stream;
+        data.ok = true;
+
+        return data;
+    }
+}
+
+
+namespace mnist
+{
+    ImageData load_image_data(cstr filepath)
+    {
+        constexpr u32 CODE = 2051;
+        constexpr u32 HEADER_BYTES = 16;
+
+        ImageData data{};
+        data.ok = false;
+
+        auto file = mapped_file::map_read(filepath);
+        if (!file.ok)
+        {
+            return data;
+        }
+
+        if (file.size < HEADER_BYTES || read_u32(file.data) != CODE)
+        {
+            mapped_file::unmap(file);
+            return data;
+        }
+
+        auto n_images = read_u32(file.data + 4);
+        auto n_rows = read_u32(file.data + 8);
+        auto n_cols = read_u32(file.data + 12);
+
+        u64 n_pixels = 0;
+        u64 n_bytes = 0;
+
+        auto ok = mem::mul_size(n_rows, n_cols, n_pixels) &&
+            mem::mul_size(n_images, n_pixels, n_bytes);
+
+        // corrupt header or truncated file
+        if (!ok || n_bytes == 0 || file.size - HEADER_BYTES < n_bytes)
+        {
+            mapped_file::unmap(file);
+            return data;
+        }
 
         MemoryBuffer<f32> buffer32;
-        mb::create_buffer<f32>(buffer32, n_rows * n_cols, "mnist data input");
+        mb::create_buffer<f32>(buffer32, n_pixels, "mnist data input");
         if (!buffer32.ok)
         {
-            mb::destroy_buffer(buffer8);
+            mapped_file::unmap(file);
             return data;
         }
 
+        // the pixels are read front to back when the features are built
+        mapped_file::advise(file, HEADER_BYTES, n_bytes, mapped_file::Access::Sequential);
+        mem::tag_file(file.data, filepath);
+
         data.image_count = n_images;
         data.image_width = n_cols;
         data.image_height = n_rows;
-        data.pixel_buffer = buffer8;
+        data.pixel_buffer = make_file_buffer(file, HEADER_BYTES, n_bytes);
         data.input_buffer = buffer32;
+        data.file = file;
         data.ok = true;
 
         return data;
@@ -92,50 +382,49 @@ namespace mnist
     LabelData load_label_data(cstr filepath)
     {
         constexpr u32 CODE = 2049;
+        constexpr u32 HEADER_BYTES = 8;
 
         LabelData data{};
         data.ok = false;
 
-        std::ifstream file(filepath, std::ios::binary);
-        if (!file.is_open())
+        auto file = mapped_file::map_read(filepath);
+        if (!file.ok)
         {
             return data;
         }
 
-        auto code = read_u32(file);
-
-        if (code != CODE)
+        if (file.size < HEADER_BYTES || read_u32(file.data) != CODE)
         {
+            mapped_file::unmap(file);
             return data;
         }
 
-        auto n_labels = read_u32(file);
+        auto n_labels = read_u32(file.data + 4);
 
         auto n_bytes = n_labels;
 
-        MemoryBuffer<u8> buffer8;
-        mb::create_buffer<u8>(buffer8, n_bytes, "mnist labels");
-        if (!buffer8.ok)
+        if (n_bytes == 0 || file.size - HEADER_BYTES < n_bytes)
         {
-            file.close();
+            mapped_file::unmap(file);
             return data;
         }
 
-        file.read((char*)buffer8.data_, n_bytes);
-
-        file.close();
-
         MemoryBuffer<f32> buffer32;
         mb::create_buffer<f32>(buffer32, 10, "mnist output");
         if (!buffer32.ok)
         {
-            mb::destroy_buffer(buffer8);
+            mapped_file::unmap(file);
             return data;
         }
 
+        // small enough to fault in up front
+        mapped_file::advise(file, mapped_file::Access::WillNeed);
+        mem::tag_file(file.data, filepath);
+
         data.label_count = n_labels;
-        data.label_buffer = buffer8;
+        data.label_buffer = make_file_buffer(file, HEADER_BYTES, n_bytes);
         data.output_buffer = buffer32;
+        data.file = file;
         data.ok = true;
 
         return data;
@@ -144,23 +433,37 @@ namespace mnist
 
     void destroy_data(ImageData& data)
     {
-        mb::destroy_buffer(data.pixel_buffer);
+        if (data.stream)
+        {
+            destroy_stream(data.stream);
+            data.stream = 0;
+        }
+
+        release_file_buffer(data.pixel_buffer, data.file);
         mb::destroy_buffer(data.input_buffer);
     }
 
 
     void destroy_data(LabelData& data)
     {
-        mb::destroy_buffer(data.label_buffer);
+        release_file_buffer(data.label_buffer, data.file);
         mb::destroy_buffer(data.output_buffer);
     }
 
 
+    void advise(ImageData const& data, mapped_file::Access access)
+    {
+        auto offset = (u64)(data.pixel_buffer.data_ - data.file.data);
+
+        mapped_file::advise(data.file, offset, data.pixel_buffer.capacity_, access);
+    }
+
+
     SpanView<f32> raw_input_data_at(ImageData const& data, u32 index)
     {
         auto len = data.image_width * data.image_height;
 
-        auto begin = data.pixel_buffer.data_ + index * len;
+        auto begin = image_at(data, index).matrix_data_;
 
         constexpr f32 F = 1.0f / 255.0f;
 
@@ -205,17 +508,103 @@ namespace mnist
 
     img::GrayView image_at(ImageData const& data, u32 index)
     {
-        auto offset = index * data.image_width * data.image_height;
+        img::GrayView view{};
+        view.width = data.image_width;
+        view.height = data.image_height;
+
+        if (!data.stream)
+        {
+            view.matrix_data_ = data.pixel_buffer.data_ + (u64)index * data.image_width * data.image_height;
+            return view;
+        }
+
+        auto& s = *data.stream;
+        auto chunk = index / s.chunk_images;
+        auto offset = (u64)(index % s.chunk_images) * s.image_bytes;
+
+        view.matrix_data_ = s.scratch.data_;
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        // copy from the ring if the chunk is resident, otherwise read the one image
+        for (u32 slot = 0; slot < s.n_slots; slot++)
+        {
+            if (s.slot_ready[slot] && s.slot_seq[slot] % s.n_chunks == chunk)
+            {
+                span::copy_u8(s.ring.data_ + (u64)slot * s.chunk_bytes + offset, s.scratch.data_, s.image_bytes);
+                return view;
+            }
+        }
+
+        s.random_file.seekg((std::streamoff)(chunk_offset(s, chunk) + offset));
+        s.random_file.read((char*)s.scratch.data_, (std::streamsize)s.image_bytes);
+        s.random_file.clear();
+
+        return view;
+    }
+
+
+    ImageChunk stream_chunk(ImageData const& data, u32 index)
+    {
+        ImageChunk chunk{};
+
+        if (!data.stream)
+        {
+            chunk.begin = 0;
+            chunk.end = data.image_count;
+            chunk.pixels = data.pixel_buffer.data_;
+
+            return chunk;
+        }
+
+        auto& s = *data.stream;
+        auto c = index / s.chunk_images;
+
+        std::unique_lock<std::mutex> lock(s.mutex);
+
+        auto seq = find_seq(s, c);
+        auto slot = (u32)(seq % s.n_slots);
+
+        // chunks before it can be refilled
+        s.head_seq = seq;
+        s.prefetch_cv.notify_one();
+
+        s.ready_cv.wait(lock, [&](){ return s.slot_seq[slot] == seq && s.slot_ready[slot]; });
+
+        chunk.begin = c * s.chunk_images;
+        chunk.end = chunk.begin + (u32)(chunk_length(s, c) / s.image_bytes);
+        chunk.pixels = s.ring.data_ + (u64)slot * s.chunk_bytes;
+
+        return chunk;
+    }
+
+
+    img::GrayView image_at(ImageData const& data, ImageChunk const& chunk, u32 index)
+    {
+        assert(index >= chunk.begin && index < chunk.end);
+
+        auto offset = (u64)(index - chunk.begin) * data.image_width * data.image_height;
 
         img::GrayView view{};
         view.width = data.image_width;
         view.height = data.image_height;
-        view.matrix_data_ = data.pixel_buffer.data_ + offset;
+        view.matrix_data_ = chunk.pixels + offset;
 
         return view;
     }
 
 
+    img::GrayView stream_image_at(ImageData const& data, ImageChunk& chunk, u32 index)
+    {
+        if (!chunk.pixels || index < chunk.begin || index >= chunk.end)
+        {
+            chunk = stream_chunk(data, index);
+        }
+
+        return image_at(data, chunk, index);
+    }
+
+
     u8 label_at(LabelData const& data, u32 index)
     {
         return data.label_buffer.data_[index];
@@ -2,12 +2,17 @@
 
 #include "../image/image.hpp"
 #include "../span/span.hpp"
+#include "../mapped_file/mapped_file.hpp"
 
 namespace img = image;
 
 
 namespace mnist
 {
+    // chunk ring of a streamed image file
+    class ImageStream;
+
+
     class ImageData
     {
     public:
@@ -18,8 +23,25 @@ namespace mnist
         u32 image_width = 0;
         u32 image_height = 0;
 
+        // points into file, past the idx header
         MemoryBuffer<u8> pixel_buffer;
         MemoryBuffer<f32> input_buffer;
+
+        MappedFile file;
+
+        // set instead of file and pixel_buffer when the images are streamed
+        ImageStream* stream = 0;
+    };
+
+
+    // images [begin, end), resident until the consumer asks for another chunk
+    class ImageChunk
+    {
+    public:
+        u32 begin = 0;
+        u32 end = 0;
+
+        u8* pixels = 0;
     };
 
 
@@ -30,8 +52,11 @@ namespace mnist
 
         u32 label_count = 0;
 
+        // points into file, past the idx header
         MemoryBuffer<u8> label_buffer;
         MemoryBuffer<f32> output_buffer;
+
+        MappedFile file;
     };
 }
 
@@ -42,12 +67,22 @@ namespace mnist
 
     LabelData load_label_data(cstr filepath);
 
+    constexpr u32 MAX_STREAM_CHUNKS = 8;
+
+    // for image files larger than memory
+    // a background thread reads the file in chunks of chunk_images into a ring of n_chunks buffers
+    ImageData open_image_stream(cstr filepath, u32 chunk_images, u32 n_chunks);
+
 
     void destroy_data(ImageData& data);
 
     void destroy_data(LabelData& data);
 
 
+    // paging hint for the pixels, e.g. Sequential while converting, Random while training
+    void advise(ImageData const& data, mapped_file::Access access);
+
+
     SpanView<f32> raw_input_data_at(ImageData const& data, u32 index);
 
     SpanView<f32> label_data_at(LabelData const& data, u32 index);
@@ -55,7 +90,19 @@ namespace mnist
     SpanView<f32> label_equals_at(LabelData const& data, u8 label, u32 index);
 
 
+    // streamed data is copied into a scratch image, one caller at a time
     img::GrayView image_at(ImageData const& data, u32 index);
 
+
+    // blocks until the chunk holding index is resident and moves the ring to it
+    // chunks are meant to be read in order by a single consumer, the whole file is one chunk when mapped
+    ImageChunk stream_chunk(ImageData const& data, u32 index);
+
+    // index must be in chunk
+    img::GrayView image_at(ImageData const& data, ImageChunk const& chunk, u32 index);
+
+    // image_at for a sequential reader, chunk is replaced when index leaves it
+    img::GrayView stream_image_at(ImageData const& data, ImageChunk& chunk, u32 index);
+
     u8 label_at(LabelData const& data, u32 index);
 }
\ No newline at end of file
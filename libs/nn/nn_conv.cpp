@@ -0,0 +1,557 @@
+#pragma once
+
+#include "nn_conv.hpp"
+#include "../util/numeric.hpp"
+
+#include <cmath>
+#include <cstdlib>
+
+
+namespace cnn
+{
+    namespace num = numeric;
+
+
+    static Matrix32 push_matrix(u32 width, u32 height, MemoryBuffer<f32>& buffer)
+    {
+        Matrix32 mat{};
+        mat.width = width;
+        mat.height = height;
+        mat.matrix_data_ = mb::push_elements(buffer, width * height);
+
+        return mat;
+    }
+
+
+    static inline Span32 row_span(Matrix32 const& mat, u32 y)
+    {
+        return span::to_span(mat.matrix_data_ + (u64)y * mat.width, mat.width);
+    }
+
+
+    static inline Span32 matrix_span(Matrix32 const& mat)
+    {
+        return span::to_span(mat.matrix_data_, mat.width * mat.height);
+    }
+
+
+    static inline u32 column_length(Conv2D const& layer)
+    {
+        return layer.in_channels * layer.kernel_size * layer.kernel_size;
+    }
+
+
+    static inline u32 conv_length(Conv2D const& layer)
+    {
+        return layer.conv_height * layer.conv_width;
+    }
+
+
+    static inline u32 output_length(Conv2D const& layer)
+    {
+        return layer.n_filters * layer.out_height * layer.out_width;
+    }
+
+
+    // geometry only, no memory
+    static Conv2D layer_shape(ConvLayerTopology const& t, u32 in_channels, u32 in_height, u32 in_width)
+    {
+        assert(t.kernel_size > 0 && t.stride > 0 && t.n_filters > 0);
+        assert(t.pool == 1 || t.pool == 2);
+        assert(in_height + 2 * t.padding >= t.kernel_size);
+        assert(in_width + 2 * t.padding >= t.kernel_size);
+
+        Conv2D layer{};
+
+        layer.in_channels = in_channels;
+        layer.in_height = in_height;
+        layer.in_width = in_width;
+
+        layer.kernel_size = t.kernel_size;
+        layer.stride = t.stride;
+        layer.padding = t.padding;
+        layer.pool = t.pool;
+
+        layer.n_filters = t.n_filters;
+        layer.conv_height = (in_height + 2 * t.padding - t.kernel_size) / t.stride + 1;
+        layer.conv_width = (in_width + 2 * t.padding - t.kernel_size) / t.stride + 1;
+
+        layer.out_height = layer.conv_height / t.pool;
+        layer.out_width = layer.conv_width / t.pool;
+
+        return layer;
+    }
+
+
+    template <class FN>
+    static void for_each_layer_shape(ConvTopology const& topology, FN const& fn)
+    {
+        auto c = topology.input_channels;
+        auto h = topology.input_height;
+        auto w = topology.input_width;
+
+        for (u32 i = 0; i < topology.n_layers; i++)
+        {
+            auto layer = layer_shape(topology.layers[i], c, h, w);
+
+            fn(i, layer);
+
+            c = layer.n_filters;
+            h = layer.out_height;
+            w = layer.out_width;
+        }
+    }
+
+
+    constexpr u64 GEMM_SCRATCH_ALIGN = 64;
+
+
+    static Span32 push_gemm_scratch(MemoryBuffer<f32>& buffer)
+    {
+        auto address = (u64)(uintptr_t)(buffer.data_ + buffer.size_);
+        auto n_pad = (GEMM_SCRATCH_ALIGN - address % GEMM_SCRATCH_ALIGN) % GEMM_SCRATCH_ALIGN / sizeof(f32);
+
+        if (n_pad)
+        {
+            mb::push_elements(buffer, n_pad);
+        }
+
+        return span::push_span(buffer, span::GEMM_SCRATCH_ELEMENTS);
+    }
+
+
+    static u64 conv_element_count(ConvTopology const& topology)
+    {
+        u64 n_elements = (u64)topology.input_channels * topology.input_height * topology.input_width;
+
+        for_each_layer_shape(topology, [&](u32 i, Conv2D const& layer)
+        {
+            auto n_col = (u64)column_length(layer) * conv_length(layer);
+            auto n_conv = (u64)layer.n_filters * conv_length(layer);
+
+            // weights, bias
+            n_elements += (u64)layer.n_filters * column_length(layer) + layer.n_filters;
+
+            // columns, activation, delta
+            n_elements += n_col + 2 * n_conv;
+
+            // column_error
+            if (i > 0)
+            {
+                n_elements += n_col;
+            }
+
+            // output, output_error
+            if (layer.pool > 1)
+            {
+                n_elements += output_length(layer);
+            }
+
+            n_elements += output_length(layer);
+        });
+
+        // gemm scratch, 64 byte aligned
+        n_elements += span::GEMM_SCRATCH_ELEMENTS + GEMM_SCRATCH_ALIGN / sizeof(f32);
+
+        return n_elements;
+    }
+}
+
+
+/* im2col */
+
+namespace cnn
+{
+    // columns(row = (c, ky, kx), col = (oy, ox)) = input(c, oy * stride - padding + ky, ox * stride - padding + kx)
+    static void im2col(Conv2D const& layer)
+    {
+        auto const k = layer.kernel_size;
+        auto const s = layer.stride;
+        auto const p = (int)layer.padding;
+        auto const in_h = (int)layer.in_height;
+        auto const in_w = (int)layer.in_width;
+
+        auto const in_plane = layer.in_height * layer.in_width;
+
+        u32 row = 0;
+
+        for (u32 c = 0; c < layer.in_channels; c++)
+        {
+            auto src = layer.input.data + c * in_plane;
+
+            for (u32 ky = 0; ky < k; ky++)
+            {
+                for (u32 kx = 0; kx < k; kx++)
+                {
+                    auto d = row_span(layer.columns, row++).data;
+
+                    for (u32 oy = 0; oy < layer.conv_height; oy++)
+                    {
+                        auto iy = (int)(oy * s + ky) - p;
+
+                        if (iy < 0 || iy >= in_h)
+                        {
+                            for (u32 ox = 0; ox < layer.conv_width; ox++)
+                            {
+                                d[ox] = 0.0f;
+                            }
+                        }
+                        else
+                        {
+                            auto src_row = src + iy * in_w;
+
+                            for (u32 ox = 0; ox < layer.conv_width; ox++)
+                            {
+                                auto ix = (int)(ox * s + kx) - p;
+                                d[ox] = (ix < 0 || ix >= in_w) ? 0.0f : src_row[ix];
+                            }
+                        }
+
+                        d += layer.conv_width;
+                    }
+                }
+            }
+        }
+    }
+
+
+    // input_error = sum of column_error over every column that read the pixel
+    static void col2im(Conv2D const& layer)
+    {
+        auto const k = layer.kernel_size;
+        auto const s = layer.stride;
+        auto const p = (int)layer.padding;
+        auto const in_h = (int)layer.in_height;
+        auto const in_w = (int)layer.in_width;
+
+        auto const in_plane = layer.in_height * layer.in_width;
+
+        span::fill(layer.input_error, 0.0f);
+
+        u32 row = 0;
+
+        for (u32 c = 0; c < layer.in_channels; c++)
+        {
+            auto dst = layer.input_error.data + c * in_plane;
+
+            for (u32 ky = 0; ky < k; ky++)
+            {
+                for (u32 kx = 0; kx < k; kx++)
+                {
+                    auto e = row_span(layer.column_error, row++).data;
+
+                    for (u32 oy = 0; oy < layer.conv_height; oy++)
+                    {
+                        auto iy = (int)(oy * s + ky) - p;
+
+                        if (iy >= 0 && iy < in_h)
+                        {
+                            auto dst_row = dst + iy * in_w;
+
+                            for (u32 ox = 0; ox < layer.conv_width; ox++)
+                            {
+                                auto ix = (int)(ox * s + kx) - p;
+                                if (ix >= 0 && ix < in_w)
+                                {
+                                    dst_row[ix] += e[ox];
+                                }
+                            }
+                        }
+
+                        e += layer.conv_width;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/* pool */
+
+namespace cnn
+{
+    static void max_pool(Conv2D const& layer)
+    {
+        auto const cw = layer.conv_width;
+
+        auto d = layer.output.data;
+
+        for (u32 f = 0; f < layer.n_filters; f++)
+        {
+            auto a = row_span(layer.activation, f).data;
+
+            for (u32 y = 0; y < layer.out_height; y++)
+            {
+                auto r1 = a + 2 * y * cw;
+                auto r2 = r1 + cw;
+
+                for (u32 x = 0; x < layer.out_width; x++)
+                {
+                    auto m1 = num::max(r1[2 * x], r1[2 * x + 1]);
+                    auto m2 = num::max(r2[2 * x], r2[2 * x + 1]);
+
+                    *d++ = num::max(m1, m2);
+                }
+            }
+        }
+    }
+
+
+    // output error to the activation that won each 2x2 block, through the reLU
+    static void max_pool_delta(Conv2D const& layer)
+    {
+        auto const cw = layer.conv_width;
+
+        span::fill(matrix_span(layer.delta), 0.0f);
+
+        auto out = layer.output.data;
+        auto err = layer.output_error.data;
+
+        for (u32 f = 0; f < layer.n_filters; f++)
+        {
+            auto a = row_span(layer.activation, f).data;
+            auto d = row_span(layer.delta, f).data;
+
+            for (u32 y = 0; y < layer.out_height; y++)
+            {
+                for (u32 x = 0; x < layer.out_width; x++)
+                {
+                    auto m = *out++;
+                    auto e = *err++;
+
+                    if (m <= 0.0f)
+                    {
+                        continue;
+                    }
+
+                    auto i = 2 * y * cw + 2 * x;
+
+                    // first position holding the max, same as the forward pass
+                    i = a[i] == m ? i : (a[i + 1] == m ? i + 1 : (a[i + cw] == m ? i + cw : i + cw + 1));
+
+                    d[i] = e;
+                }
+            }
+        }
+    }
+}
+
+
+/* forward/backward */
+
+namespace cnn
+{
+    static void eval_forward(Conv2D const& layer, Span32 const& scratch)
+    {
+        im2col(layer);
+
+        // activation = reLU(W * columns + bias)
+        span::gemm(layer.weights, layer.columns, layer.activation, 1.0f, 0.0f, scratch);
+
+        for (u32 f = 0; f < layer.n_filters; f++)
+        {
+            auto a = row_span(layer.activation, f);
+            auto b = layer.bias.data[f];
+
+            for (u32 i = 0; i < a.length; i++)
+            {
+                auto sum = a.data[i] + b;
+                a.data[i] = sum < 0.0f ? 0.0f : sum;
+            }
+        }
+
+        if (layer.pool > 1)
+        {
+            max_pool(layer);
+        }
+    }
+
+
+    static void update_back(Conv2D const& layer, Span32 const& scratch)
+    {
+        f32 eta = 0.000001f;
+
+        if (layer.pool > 1)
+        {
+            max_pool_delta(layer);
+        }
+        else
+        {
+            auto act = matrix_span(layer.activation);
+            auto err = layer.output_error;
+            auto delta = matrix_span(layer.delta);
+
+            for (u32 i = 0; i < delta.length; i++)
+            {
+                delta.data[i] = (act.data[i] > 0.0f) ? err.data[i] : 0.0f;
+            }
+        }
+
+        for (u32 f = 0; f < layer.n_filters; f++)
+        {
+            auto d = row_span(layer.delta, f);
+
+            f32 sum = 0.0f;
+            for (u32 i = 0; i < d.length; i++)
+            {
+                sum += d.data[i];
+            }
+
+            layer.bias.data[f] += eta * sum;
+        }
+
+        // input error = col2im(W^T * delta), using the weights from before the update
+        if (layer.input_error.data)
+        {
+            span::gemm_at(layer.weights, layer.delta, layer.column_error, 1.0f, 0.0f, scratch);
+            col2im(layer);
+        }
+
+        // W += eta * delta * columns^T
+        span::gemm_bt(layer.delta, layer.columns, layer.weights, eta, 1.0f, scratch);
+    }
+}
+
+
+namespace cnn
+{
+    u32 output_size(ConvTopology const& topology)
+    {
+        u32 size = topology.input_channels * topology.input_height * topology.input_width;
+
+        for_each_layer_shape(topology, [&](u32, Conv2D const& layer)
+        {
+            size = output_length(layer);
+        });
+
+        return size;
+    }
+
+
+    u64 conv_bytes(ConvTopology const& topology)
+    {
+        return conv_element_count(topology) * sizeof(f32);
+    }
+
+
+    void create(ConvNet& net, ConvTopology const& topology)
+    {
+        assert(topology.n_layers > 0 && topology.n_layers <= ConvTopology::MAX_LAYERS);
+
+        auto& buffer = net.memory;
+        if (!mb::create_buffer(buffer, conv_element_count(topology), "cnn"))
+        {
+            assert("*** cnn buffer failed ***" && false);
+            return;
+        }
+
+        net.layers.data = net.layer_data;
+        net.layers.length = topology.n_layers;
+
+        auto& layers = net.layers.data;
+
+        auto n_input = topology.input_channels * topology.input_height * topology.input_width;
+        net.input = span::push_span(buffer, n_input);
+
+        for_each_layer_shape(topology, [&](u32 i, Conv2D const& shape)
+        {
+            auto& layer = layers[i];
+            layer = shape;
+
+            auto n_col = column_length(layer);
+            auto n_conv = conv_length(layer);
+
+            layer.weights = push_matrix(n_col, layer.n_filters, buffer);
+            layer.bias = span::push_span(buffer, layer.n_filters);
+
+            if (i == 0)
+            {
+                layer.input = net.input;
+                layer.input_error = {};
+            }
+            else
+            {
+                layer.input = layers[i - 1].output;
+                layer.input_error = layers[i - 1].output_error;
+            }
+
+            layer.columns = push_matrix(n_conv, n_col, buffer);
+            layer.column_error = i > 0 ? push_matrix(n_conv, n_col, buffer) : Matrix32{};
+
+            layer.activation = push_matrix(n_conv, layer.n_filters, buffer);
+            layer.delta = push_matrix(n_conv, layer.n_filters, buffer);
+
+            layer.output = layer.pool > 1 ? span::push_span(buffer, output_length(layer)) : matrix_span(layer.activation);
+            layer.output_error = span::push_span(buffer, output_length(layer));
+
+            // uniform in +/- sqrt(6 / fan_in), filters need negative weights to find edges
+            auto r = std::sqrt(6.0f / n_col);
+            auto w = matrix_span(layer.weights);
+            for (u32 j = 0; j < w.length; j++)
+            {
+                w.data[j] = r * (2.0f * rand() / RAND_MAX - 1.0f);
+            }
+
+            span::fill(layer.bias, 0.0f);
+        });
+
+        auto& last = layers[topology.n_layers - 1];
+
+        net.output = last.output;
+        net.error = last.output_error;
+
+        net.gemm_scratch = push_gemm_scratch(buffer);
+    }
+
+
+    void eval(ConvNet const& net)
+    {
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward(net.layers.data[i], net.gemm_scratch);
+        }
+    }
+
+
+    void update(ConvNet const& net)
+    {
+        for (int i = net.layers.length - 1; i >= 0; i--)
+        {
+            update_back(net.layers.data[i], net.gemm_scratch);
+        }
+    }
+}
+
+
+/* conv + mlp */
+
+namespace cnn
+{
+    mlp::EvalResult eval(ConvNet const& conv, mlp::Net& net, Span32 const& expected)
+    {
+        assert(net.input.length == conv.output.length);
+
+        eval(conv);
+
+        mlp::set_input(net, conv.output.data);
+
+        return mlp::eval(net, expected);
+    }
+
+
+    mlp::EvalResult update(ConvNet const& conv, mlp::Net& net, Span32 const& expected)
+    {
+        assert(net.input.length == conv.output.length);
+
+        eval(conv);
+
+        mlp::set_input(net, conv.output.data);
+
+        auto res = mlp::update(net, expected, conv.error);
+
+        update(conv);
+
+        return res;
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "nn_mlp.hpp"
+
+
+namespace cnn
+{
+    using Span32 = SpanView<f32>;
+    using Matrix32 = MatrixView2D<f32>;
+
+
+    class ConvLayerTopology
+    {
+    public:
+        u32 n_filters = 8;
+        u32 kernel_size = 5;
+        u32 stride = 1;
+        u32 padding = 2;
+
+        // 1 = no pooling, 2 = 2x2 max-pool
+        u32 pool = 2;
+    };
+
+
+    class ConvTopology
+    {
+    public:
+        constexpr static u32 MAX_LAYERS = 4;
+
+        u32 input_width = 1;
+        u32 input_height = 1;
+        u32 input_channels = 1;
+
+        u32 n_layers = 0;
+
+        ConvLayerTopology layers[MAX_LAYERS];
+    };
+
+
+    // convolution + bias + reLU + optional max-pool
+    // images are stored channel by channel, row by row
+    class Conv2D
+    {
+    public:
+        u32 in_channels = 0;
+        u32 in_height = 0;
+        u32 in_width = 0;
+
+        u32 kernel_size = 0;
+        u32 stride = 0;
+        u32 padding = 0;
+        u32 pool = 0;
+
+        // before pooling
+        u32 n_filters = 0;
+        u32 conv_height = 0;
+        u32 conv_width = 0;
+
+        // after pooling
+        u32 out_height = 0;
+        u32 out_width = 0;
+
+        // n_filters x (in_channels * kernel_size * kernel_size)
+        Matrix32 weights;
+        Span32 bias;
+
+        Span32 input;
+
+        // not computed for the first layer
+        Span32 input_error;
+
+        // im2col of the input, one column per output pixel
+        Matrix32 columns;
+        Matrix32 column_error;
+
+        // n_filters x (conv_height * conv_width)
+        Matrix32 activation;
+        Matrix32 delta;
+
+        // activation itself when there is no pooling
+        Span32 output;
+        Span32 output_error;
+    };
+
+
+    class ConvNet
+    {
+    public:
+        constexpr static u32 MAX_LAYERS = ConvTopology::MAX_LAYERS;
+
+        SpanView<Conv2D> layers;
+
+        Span32 input;
+        Span32 output;
+
+        // error of the output, written by the network that follows
+        Span32 error;
+
+        // packed blocks of the gemm passes
+        Span32 gemm_scratch;
+
+        Conv2D layer_data[MAX_LAYERS];
+        MemoryBuffer<f32> memory;
+    };
+
+
+    inline void destroy(ConvNet& net)
+    {
+        mb::destroy_buffer(net.memory);
+        net.layers.length = 0;
+    }
+
+
+    // length of the flattened output, the input size of the mlp that follows
+    u32 output_size(ConvTopology const& topology);
+
+    u64 conv_bytes(ConvTopology const& topology);
+
+    void create(ConvNet& net, ConvTopology const& topology);
+
+    // forward from net.input to net.output
+    void eval(ConvNet const& net);
+
+    // backward from net.error, updates the weights
+    void update(ConvNet const& net);
+}
+
+
+/* conv + mlp */
+
+namespace cnn
+{
+    // conv.input -> conv -> mlp, net reads its input from conv.output
+    mlp::EvalResult eval(ConvNet const& conv, mlp::Net& net, Span32 const& expected);
+
+    mlp::EvalResult update(ConvNet const& conv, mlp::Net& net, Span32 const& expected);
+}
@@ -3,8 +3,10 @@
 #include "nn_mlp.hpp"
 #include "../util/numeric.hpp"
 
-#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 
 
 namespace mlp
@@ -17,7 +19,7 @@ namespace mlp
         Matrix32 mat{};
         mat.width = width;
         mat.height = height;
-        mat.matrix_data_ = mb::push_elements(buffer, width * height);
+        mat.matrix_data_ = mb::push_elements(buffer, (u64)width * height);
 
         return mat;        
     }
@@ -29,7 +31,7 @@ namespace mlp
         SpanView<T> span{};
 
         span.length = mat.width;
-        span.data = mat.matrix_data_ + h * mat.width;
+        span.data = mat.matrix_data_ + (u64)h * mat.width;
 
         return span;
     }
@@ -45,54 +47,26 @@ namespace mlp
     }
 
 
-    static void softmax(Span32 const& span)
-    {
-        f32 max = 0.0f;
-        for (u32 i = 0; i < span.length; i++)
-        {
-            if (span.data[i] > max)
-            {
-                max = span.data[i];
-            }
-        }
-
-        f32 total = 0.0f;
+    // an output counts as a prediction above this probability
+    constexpr f32 PREDICTION_MIN = 0.8f;
 
-        for (u32 i = 0; i < span.length; i++)
-        {
-            span.data[i] = std::exp(span.data[i] - max);
-            total += span.data[i];
-        }
 
-        assert(total >= 0.0f);
+    static inline int to_label(f32 p, u32 index)
+    {
+        return p > PREDICTION_MIN ? (int)index : -1;
+    }
 
-        auto f = 1.0f / total;
 
-        for (u32 i = 0; i < span.length; i++)
-        {
-            span.data[i] *= f;
-        }
-    }
-    
-    
     static void eval_forward(Layer const& layer)
     {
         auto input = layer.io_front;
         auto output = layer.io_back;
 
         auto a_in = activation_span(input);
-        
-        for (u32 o = 0; o < output.length; o++)
-        {
-            auto w = row_span(layer.weights, o);
+        auto a_out = activation_span(output);
 
-            auto dot = span::dot(w, a_in);
-
-            auto sum = dot + output.bias[o];
-
-            // reLU
-            output.activation[o] = sum < 0.0f ? 0.0f : sum;
-        }
+        // activation = reLU(W * input + bias)
+        span::gemv_bias_relu(layer.weights, a_in, span::to_span(output.bias, output.length), a_out);
     }
 
 
@@ -109,19 +83,12 @@ namespace mlp
             back.bias[b] += eta * back.delta[b];
         }
 
-        for (u32 f = 0; f < front.length; f++)
-        {
-            auto& ef = front.error[f];
-            auto af = front.activation[f];
+        auto delta = span::to_span(back.delta, back.length);
 
-            ef = 0.0f;
-            for (u32 b = 0; b < back.length; b++)
-            {
-                auto& w = row_span(layer.weights, b).data[f];
-                ef += back.delta[b] * w;
-                w += eta * back.delta[b] * af;
-            }
-        }
+        // front error = W^T * delta, using the weights from before the update
+        // W += eta * delta * activation^T
+        // both walk the rows of W in a single pass
+        span::gemv_t_ger(layer.weights, delta, span::to_span(front.error, front.length), activation_span(front), eta);
     }
 
 
@@ -138,39 +105,61 @@ namespace mlp
             back.bias[b] += eta * back.delta[b];
         }
 
-        for (u32 f = 0; f < front.length; f++)
-        {
-            auto af = front.activation[f];
+        // W += eta * delta * activation^T
+        span::ger(layer.weights, span::to_span(back.delta, back.length), activation_span(front), eta);
+    }
 
-            for (u32 b = 0; b < back.length; b++)
-            {
-                auto& w = row_span(layer.weights, b).data[f];
-                w += eta * back.delta[b] * af;
-            }
-        }
+
+    // each weight matrix and bias starts on a cache line
+    constexpr u64 PARAM_ALIGN = 64;
+    constexpr u64 PARAM_ALIGN_ELEMENTS = PARAM_ALIGN / sizeof(f32);
+
+
+    class ElementCount
+    {
+    public:
+        // weights and biases, padded
+        u64 params = 0;
+
+        // activations, errors, deltas
+        u64 scratch = 0;
+    };
+
+
+    static bool add_aligned(u64& n_elements, u64 n_add)
+    {
+        u64 padded = 0;
+
+        return mem::add_size(n_add, PARAM_ALIGN_ELEMENTS - 1, padded) &&
+            mem::add_size(n_elements, padded / PARAM_ALIGN_ELEMENTS * PARAM_ALIGN_ELEMENTS, n_elements);
+    }
+
+
+    // weights, bias, activation, error, delta of one layer, false on overflow
+    static bool add_layer_count(ElementCount& count, u64 len_front, u64 len_back)
+    {
+        u64 n_weights = 0;
+
+        return mem::mul_size(len_front, len_back, n_weights) &&
+            add_aligned(count.params, n_weights) &&
+            add_aligned(count.params, len_back) &&
+            mem::add_size(count.scratch, 3 * len_back, count.scratch);
     }
 
 
-    static u32 mlp_element_count(NetTopology topology)
+    // false if the topology does not fit in memory
+    static bool element_count(NetTopology topology, ElementCount& count)
     {
-        u32 n_activation = 0;
-        u32 n_bias = 0;
-        u32 n_error = 0;
-        u32 n_delta = 0;
-        u32 n_weights = 0;
-        
+        count = ElementCount{};
+
         // input layer
         TopologyIndex t_id = { (u8)0 };
         auto len_front = topology.get_input_size();
         auto len_back = topology.get_inner_size_at(t_id);
 
-        n_activation += len_front;
+        count.scratch = len_front;
 
-        n_weights += len_front * len_back;
-        n_bias += len_back;
-        n_activation += len_back;
-        n_error += len_back;
-        n_delta += len_back;
+        auto ok = add_layer_count(count, len_front, len_back);
 
         // inner layers
         auto N = topology.get_inner_layers();
@@ -181,28 +170,100 @@ namespace mlp
             len_front = len_back;
             len_back = topology.get_inner_size_at(t_id);
 
-            n_weights += len_front * len_back;
-            n_bias += len_back;
-            n_activation += len_back;
-            n_error += len_back;
-            n_delta += len_back;
+            ok = ok && add_layer_count(count, len_front, len_back);
         }
 
         // output layer
         len_front = len_back;
         len_back = topology.get_output_size();
 
-        n_weights += len_front * len_back;
-        n_bias += len_back;
-        n_activation += len_back;
-        n_error += len_back;
-        n_delta += len_back;
+        ok = ok && add_layer_count(count, len_front, len_back);
+
+        return ok;
+    }
+
+
+    // params, scratch and room to align the params, 0 if the topology does not fit in memory
+    static u64 mlp_element_count(NetTopology topology)
+    {
+        ElementCount count{};
+        u64 n_elements = 0;
+
+        auto ok = element_count(topology, count) &&
+            mem::add_size(count.params, count.scratch, n_elements) &&
+            mem::add_size(n_elements, PARAM_ALIGN_ELEMENTS, n_elements);
+
+        return ok ? n_elements : 0;
+    }
+
+
+    // a topology read from a file, sizes are used before anything is allocated
+    static bool valid_topology(NetTopology topology)
+    {
+        auto N = topology.get_inner_layers();
+
+        if (N < 1 || N > NetTopology::MAX_INNER_LAYERS || !topology.get_input_size() || !topology.get_output_size())
+        {
+            return false;
+        }
+
+        for (u32 i = 0; i < N; i++)
+        {
+            if (!topology.get_inner_size_at({ (u8)i }))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    // the next element pushed starts on a cache line, at most PARAM_ALIGN_ELEMENTS - 1 are skipped
+    static void align_buffer(MemoryBuffer<f32>& buffer)
+    {
+        auto address = (u64)(uintptr_t)(buffer.data_ + buffer.size_);
+        auto n_pad = (PARAM_ALIGN - address % PARAM_ALIGN) % PARAM_ALIGN / sizeof(f32);
+
+        if (n_pad)
+        {
+            mb::push_elements(buffer, n_pad);
+        }
+    }
+
+
+    static f32* push_aligned(MemoryBuffer<f32>& buffer, u64 n_elements)
+    {
+        align_buffer(buffer);
+
+        return mb::push_elements(buffer, n_elements);
+    }
+
+
+    // objects carved from a shared buffer check for room first, instead of failing half way
+    static bool has_room(MemoryBuffer<f32> const& buffer, u64 n_elements)
+    {
+        return buffer.data_ && n_elements && buffer.capacity_ - buffer.size_ >= n_elements;
+    }
+
+
+    static f32* next_params(f32*& params, u64 n_elements)
+    {
+        auto data = params;
+        params += (n_elements + PARAM_ALIGN_ELEMENTS - 1) / PARAM_ALIGN_ELEMENTS * PARAM_ALIGN_ELEMENTS;
+
+        return data;
+    }
+
+
+    static Matrix32 next_matrix(u32 width, u32 height, f32*& params)
+    {
+        Matrix32 mat{};
+        mat.width = width;
+        mat.height = height;
+        mat.matrix_data_ = next_params(params, (u64)width * height);
 
-        return n_activation +
-            n_weights + 
-            n_bias + 
-            n_error +
-            n_delta;
+        return mat;
     }
 
 
@@ -210,28 +271,126 @@ namespace mlp
 }
 
 
+/* mini-batch */
+
 namespace mlp
 {
-    u32 mlp_bytes(NetTopology const& topology)
+    static inline Span32 matrix_span(Matrix32 const& mat)
     {
-        return mlp_element_count(topology) * sizeof(f32);
+        return span::to_span(mat.matrix_data_, mat.width * mat.height);
     }
 
 
-    void create(Net& net, NetTopology topology)
-    { 
-        auto& buffer = net.memory;
-        if (!mb::create_buffer(buffer, mlp_element_count(topology), "mlp"))
+    static void eval_forward_batch(Layer const& layer, BatchIO const& front, BatchIO const& back, Span32 const& scratch)
+    {
+        auto bias = layer.io_back.bias;
+
+        // activation = input * W^T
+        span::gemm_bt(front.activation, layer.weights, back.activation, 1.0f, 0.0f, scratch);
+
+        for (u32 r = 0; r < back.activation.height; r++)
         {
-            assert("*** mlp buffer failed ***" && false);
+            auto a_out = row_span(back.activation, r);
+
+            for (u32 o = 0; o < a_out.length; o++)
+            {
+                auto sum = a_out.data[o] + bias[o];
+
+                // reLU
+                a_out.data[o] = sum < 0.0f ? 0.0f : sum;
+            }
+        }
+    }
+
+
+    static void delta_batch(BatchIO const& back)
+    {
+        auto act = matrix_span(back.activation);
+        auto err = matrix_span(back.error);
+        auto delta = matrix_span(back.delta);
+
+        for (u32 i = 0; i < delta.length; i++)
+        {
+            delta.data[i] = (act.data[i] > 0.0f) ? err.data[i] : 0.0f;
+        }
+    }
+
+
+    static void update_back_batch(Layer const& layer, BatchIO const& front, BatchIO const& back, Span32 const& scratch)
+    {
+        auto bias = layer.io_back.bias;
+        auto& weights = layer.weights;
+
+        auto n_rows = back.activation.height;
+
+        f32 eta = 0.000001f;
+
+        delta_batch(back);
+
+        for (u32 r = 0; r < n_rows; r++)
+        {
+            auto d = row_span(back.delta, r);
+            for (u32 b = 0; b < d.length; b++)
+            {
+                bias[b] += eta * d.data[b];
+            }
+        }
+
+        // front error = delta * W, using the weights from before the update
+        if (front.error.matrix_data_)
+        {
+            span::gemm(back.delta, weights, front.error, 1.0f, 0.0f, scratch);
+        }
+
+        // W += eta * delta^T * activation, one update per batch
+        span::gemm_at(back.delta, front.activation, weights, eta, 1.0f, scratch);
+    }
+
+
+    // same as update_back_batch with the update written to grad instead of the layer
+    static void gradient_back_batch(Layer const& layer, BatchIO const& front, BatchIO const& back, LayerGradient const& grad, Span32 const& scratch)
+    {
+        delta_batch(back);
+
+        span::fill(grad.bias, 0.0f);
+
+        for (u32 r = 0; r < back.delta.height; r++)
+        {
+            span::add(grad.bias, row_span(back.delta, r), grad.bias);
         }
 
-        auto view = span::make_view(buffer);
-        for (u32 i = 0; i < view.length; i++)
+        if (front.error.matrix_data_)
+        {
+            span::gemm(back.delta, layer.weights, front.error, 1.0f, 0.0f, scratch);
+        }
+
+        // grad = delta^T * activation
+        span::gemm_at(back.delta, front.activation, grad.weights, 1.0f, 0.0f, scratch);
+    }
+}
+
+
+namespace mlp
+{
+    u64 mlp_bytes(NetTopology const& topology)
+    {
+        u64 n_bytes = 0;
+        if (!mem::mul_size(mlp_element_count(topology), sizeof(f32), n_bytes))
         {
-            view.data[i] = (f32)rand() / RAND_MAX;
+            return 0;
         }
 
+        return n_bytes;
+    }
+
+
+    // weights and biases from params in layer order, everything else from net.memory
+    static void make_layers(Net& net, NetTopology topology, f32* params)
+    {
+        auto& buffer = net.memory;
+
+        net.topology = topology;
+
         net.layers.data = net.layer_data;        
         auto& layers = net.layers.data;
 
@@ -256,11 +415,11 @@ namespace mlp
 
             back.length = len_back;
             back.activation = mb::push_elements(buffer, len_back);
-            back.bias = mb::push_elements(buffer, len_back);
             back.error = mb::push_elements(buffer, len_back);
             back.delta = mb::push_elements(buffer, len_back);
 
-            layer.weights = push_matrix(len_front, len_back, buffer);
+            layer.weights = next_matrix(len_front, len_back, params);
+            back.bias = next_params(params, len_back);
             
             span::fill(span::to_span(back.error, len_back), 0.0f);
 
@@ -284,11 +443,11 @@ namespace mlp
             
             back.length = len_back;
             back.activation = mb::push_elements(buffer, len_back);
-            back.bias = mb::push_elements(buffer, len_back);
             back.error = mb::push_elements(buffer, len_back);
             back.delta = mb::push_elements(buffer, len_back);
 
-            layer.weights = push_matrix(len_front, len_back, buffer);
+            layer.weights = next_matrix(len_front, len_back, params);
+            back.bias = next_params(params, len_back);
             
             span::fill(span::to_span(back.error, len_back), 0.0f);
 
@@ -310,11 +469,11 @@ namespace mlp
             
             back.length = len_back;
             back.activation = mb::push_elements(buffer, len_back);
-            back.bias = mb::push_elements(buffer, len_back);
             back.error = mb::push_elements(buffer, len_back);
             back.delta = mb::push_elements(buffer, len_back);
 
-            layer.weights = push_matrix(len_front, len_back, buffer);
+            layer.weights = next_matrix(len_front, len_back, params);
+            back.bias = next_params(params, len_back);
             
             span::fill(span::to_span(back.error, len_back), 0.0f);
 
@@ -322,70 +481,1194 @@ namespace mlp
             net.error = span::to_span(back.error, len_back);
         }
 
-        // TODO?:
-        // push all weights to the end of the buffer to enable saving a model
+        assert(buffer.size_ <= buffer.capacity_);
+    }
+
+
+    void create(Net& net, NetTopology topology)
+    {
+        auto& buffer = net.memory;
+
+        ElementCount count{};
+        if (!element_count(topology, count) || !mb::create_buffer(buffer, mlp_element_count(topology), "mlp"))
+        {
+            assert("*** mlp buffer failed ***" && false);
+            return;
+        }
+
+        mb::zero_buffer(buffer);
+
+        auto params = push_aligned(buffer, count.params);
+        for (u64 i = 0; i < count.params; i++)
+        {
+            params[i] = (f32)rand() / RAND_MAX;
+        }
+
+        net.params = span::to_span(params, count.params);
 
-        assert(buffer.size_ == buffer.capacity_);
+        make_layers(net, topology, params);
     }
 
 
-    void eval(Net const& net)
+    bool create(Net& net, NetTopology topology, Span32 const& src)
     {
-        for (u32 i = 0; i < net.layers.length; i++)
+        auto& buffer = net.memory;
+
+        ElementCount count{};
+        if (!src.data || !valid_topology(topology) || !element_count(topology, count) || src.length != count.params)
         {
-            eval_forward(net.layers.data[i]);
+            return false;
+        }
+
+        if (!mb::create_buffer(buffer, mlp_element_count(topology), "mlp"))
+        {
+            return false;
+        }
+
+        mb::zero_buffer(buffer);
+
+        auto params = push_aligned(buffer, count.params);
+
+        net.params = span::to_span(params, count.params);
+        span::copy(src, net.params);
+
+        make_layers(net, topology, params);
+
+        return true;
+    }
+
+
+    constexpr u32 MODEL_FILE_MAGIC = 0x4D504C4D; // "MLPM"
+
+    // increment whenever the params layout changes
+    constexpr u32 MODEL_FILE_VERSION = 1;
+
+    // params start on a page boundary, the mapping is aligned for simd loads
+    constexpr u32 MODEL_PARAM_OFFSET = 4096;
+
+
+    class ModelFileHeader
+    {
+    public:
+        u32 magic;
+        u32 version;
+
+        NetTopology topology;
+        u32 reserved;
+
+        u64 param_offset;
+        u64 param_count;
+    };
+
+    // no padding, the header is written as is
+    static_assert(sizeof(ModelFileHeader) == 2 * 4 + sizeof(NetTopology) + 4 + 2 * 8);
+    static_assert(MODEL_PARAM_OFFSET % PARAM_ALIGN == 0);
+
+
+    bool save(NetTopology const& topology, Span32 const& params, cstr file_path)
+    {
+        ElementCount count{};
+        if (!params.data || !element_count(topology, count) || params.length != count.params)
+        {
+            return false;
+        }
+
+        // value-initialized, reserved is zero and there is no padding
+        ModelFileHeader header{};
+
+        header.magic = MODEL_FILE_MAGIC;
+        header.version = MODEL_FILE_VERSION;
+        header.topology = topology;
+        header.param_offset = MODEL_PARAM_OFFSET;
+        header.param_count = params.length;
+
+        auto tmp_path = std::filesystem::path(file_path);
+        tmp_path += ".tmp";
+
+        std::ofstream file(tmp_path, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        char padding[MODEL_PARAM_OFFSET] = { 0 };
+
+        file.write((char*)&header, sizeof(header));
+        file.write(padding, header.param_offset - sizeof(header));
+        file.write((char*)params.data, params.length * sizeof(f32));
+        file.close();
+
+        std::error_code ec;
+
+        if (file.fail())
+        {
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+
+        // readers only ever see a complete file
+        std::filesystem::rename(tmp_path, file_path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp_path, ec);
+            return false;
         }
 
-        softmax(net.output);
+        return true;
+    }
+
+
+    bool save(Net const& net, cstr file_path)
+    {
+        return save(net.topology, net.params, file_path);
     }
 
 
-    void eval(Net const& net, Span32 const& expected)
+    bool load(Net& net, cstr file_path)
     {
-        eval(net);
+        auto file = mapped_file::map_copy(file_path);
+        if (!file.ok)
+        {
+            return false;
+        }
+
+        ModelFileHeader header{};
+        ElementCount count{};
+        u64 n_bytes = 0;
+        u64 end = 0;
+
+        auto ok = file.size >= sizeof(header);
+        if (ok)
+        {
+            std::memcpy(&header, file.data, sizeof(header));
+        }
+
+        ok = ok &&
+            header.magic == MODEL_FILE_MAGIC &&
+            header.version == MODEL_FILE_VERSION &&
+            header.param_offset >= sizeof(header) &&
+            header.param_offset % PARAM_ALIGN == 0 &&
+            valid_topology(header.topology) &&
+            element_count(header.topology, count) &&
+            header.param_count == count.params &&
+            mem::mul_size(count.params, sizeof(f32), n_bytes) &&
+            mem::add_size(header.param_offset, n_bytes, end) &&
+            end <= file.size;
+
+        if (!ok || !mb::create_buffer(net.memory, count.scratch, "mlp"))
+        {
+            mapped_file::unmap(file);
+            return false;
+        }
+
+        mb::zero_buffer(net.memory);
+
+        auto params = (f32*)(file.data + header.param_offset);
 
-        span::sub(expected, net.output, net.error);
+        net.params = span::to_span(params, count.params);
+        net.param_file = file;
+        mem::tag_file(file.data, file_path);
+
+        make_layers(net, header.topology, params);
+
+        return true;
     }
 
 
-    void update(Net const& net, Span32 const& expected)
+    u64 replica_elements(Net const& net)
     {
-        eval(net, expected);
+        auto const n_layers = net.layers.length;
 
-        auto N = net.layers.length;
+        assert(n_layers > 0);
 
-        for (int i = N - 1; i > 0; i--)
+        auto& src = net.layers.data;
+
+        // room to start on a cache line, other threads write the buffer next to it
+        u64 n_elements = PARAM_ALIGN_ELEMENTS + src[0].io_front.length;
+        for (u32 i = 0; i < n_layers; i++)
         {
-            auto& layer = net.layers.data[i];
-            update_back(layer);
+            // activation, error, delta
+            n_elements += 3 * src[i].io_back.length;
         }
 
-        update_input(net.layers.data[0]);
+        return n_elements;
     }
 
 
-    int prediction_label(Net const& net)
+    bool create_replica(Net& replica, Net const& net)
     {
-        for (u32 i = 0; i < net.output.length; i++)
+        if (!mb::create_buffer(replica.memory, replica_elements(net), "mlp replica"))
         {
-            if (net.output.data[i] > 0.8f)
-            {
-                return (int)i;
-            }
+            assert("*** mlp replica buffer failed ***" && false);
+            return false;
         }
 
-        return -1;
+        return create_replica(replica, net, replica.memory);
     }
 
 
-    f32 abs_error(Net const& net)
+    bool create_replica(Net& replica, Net const& net, MemoryBuffer<f32>& buffer)
     {
-        f32 e = 0.0f;
-        for (u32 i = 0; i < net.error.length; i++)
+        auto const n_layers = net.layers.length;
+
+        if (!has_room(buffer, replica_elements(net)))
         {
-            e += num::abs(net.error.data[i]);
+            assert("*** mlp replica buffer failed ***" && false);
+            return false;
         }
 
-        return e / net.error.length;
+        auto& src = net.layers.data;
+
+        align_buffer(buffer);
+
+        replica.layers.data = replica.layer_data;
+        replica.layers.length = n_layers;
+
+        auto& layers = replica.layers.data;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& layer = layers[i];
+
+            // weights and bias stay with the source net
+            layer = src[i];
+
+            if (i == 0)
+            {
+                auto& front = layer.io_front;
+                front.activation = mb::push_elements(buffer, front.length);
+            }
+            else
+            {
+                layer.io_front = layers[i - 1].io_back;
+            }
+
+            auto& back = layer.io_back;
+            back.activation = mb::push_elements(buffer, back.length);
+            back.error = mb::push_elements(buffer, back.length);
+            back.delta = mb::push_elements(buffer, back.length);
+
+            span::fill(span::to_span(back.error, back.length), 0.0f);
+        }
+
+        auto& front = layers[0].io_front;
+        auto& back = layers[n_layers - 1].io_back;
+
+        replica.input = span::to_span(front.activation, front.length);
+        replica.output = span::to_span(back.activation, back.length);
+        replica.error = span::to_span(back.error, back.length);
+
+        return true;
+    }
+
+
+    void set_input(Net& net, f32* data)
+    {
+        assert(net.layers.length > 0);
+
+        net.layers.data[0].io_front.activation = data;
+        net.input.data = data;
+    }
+
+
+    void eval(Net const& net)
+    {
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward(net.layers.data[i]);
+        }
+
+        span::softmax(net.output);
+    }
+
+
+    EvalResult eval(Net const& net, Span32 const& expected)
+    {
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward(net.layers.data[i]);
+        }
+
+        auto sm = span::softmax_error(net.output, expected, net.error);
+
+        EvalResult res{};
+        res.abs_error = sm.abs_error;
+        res.loss = sm.loss;
+        res.label = to_label(sm.max, sm.argmax);
+        res.argmax = sm.argmax;
+
+        return res;
+    }
+
+
+    EvalResult update(Net const& net, Span32 const& expected)
+    {
+        auto res = eval(net, expected);
+
+        auto N = net.layers.length;
+
+        for (int i = N - 1; i > 0; i--)
+        {
+            auto& layer = net.layers.data[i];
+            update_back(layer);
+        }
+
+        update_input(net.layers.data[0]);
+
+        return res;
+    }
+
+
+    EvalResult update(Net const& net, Span32 const& expected, Span32 const& input_error)
+    {
+        assert(input_error.length == net.input.length);
+
+        auto res = eval(net, expected);
+
+        auto N = net.layers.length;
+
+        for (int i = N - 1; i > 0; i--)
+        {
+            auto& layer = net.layers.data[i];
+            update_back(layer);
+        }
+
+        // the input layer has no error buffer of its own
+        auto input_layer = net.layers.data[0];
+        input_layer.io_front.error = input_error.data;
+
+        update_back(input_layer);
+
+        return res;
+    }
+
+
+    int prediction_label(Net const& net)
+    {
+        for (u32 i = 0; i < net.output.length; i++)
+        {
+            if (net.output.data[i] > PREDICTION_MIN)
+            {
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+
+    f32 abs_error(Net const& net)
+    {
+        f32 e = 0.0f;
+        for (u32 i = 0; i < net.error.length; i++)
+        {
+            e += num::abs(net.error.data[i]);
+        }
+
+        return e / net.error.length;
+    }
+}
+
+
+/* mini-batch */
+
+namespace mlp
+{
+    u64 batch_elements(Net const& net, u32 batch_size)
+    {
+        assert(batch_size > 0);
+
+        auto& layers = net.layers.data;
+        auto n_layers = net.layers.length;
+
+        auto len_in = layers[0].io_front.length;
+        auto len_out = layers[n_layers - 1].io_back.length;
+
+        // input activations and expected outputs
+        u64 n_elements = len_in + len_out;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            // activation, error, delta
+            n_elements += 3 * layers[i].io_back.length;
+        }
+
+        u64 n_batch = 0;
+
+        // the gemm scratch starts on a cache line
+        auto ok =
+            mem::mul_size(n_elements, batch_size, n_batch) &&
+            mem::add_size(n_batch, span::GEMM_SCRATCH_ELEMENTS + PARAM_ALIGN_ELEMENTS, n_batch);
+
+        return ok ? n_batch : 0;
+    }
+
+
+    bool create_batch(MiniBatch& batch, Net const& net, u32 batch_size)
+    {
+        auto n_elements = batch_elements(net, batch_size);
+
+        if (!n_elements || !mb::create_buffer(batch.memory, n_elements, "mlp batch"))
+        {
+            assert("*** mlp batch buffer failed ***" && false);
+            return false;
+        }
+
+        return create_batch(batch, net, batch_size, batch.memory);
+    }
+
+
+    bool create_batch(MiniBatch& batch, Net const& net, u32 batch_size, MemoryBuffer<f32>& buffer)
+    {
+        if (!has_room(buffer, batch_elements(net, batch_size)))
+        {
+            assert("*** mlp batch buffer failed ***" && false);
+            return false;
+        }
+
+        auto& layers = net.layers.data;
+        auto n_layers = net.layers.length;
+
+        auto len_in = layers[0].io_front.length;
+        auto len_out = layers[n_layers - 1].io_back.length;
+
+        batch.gemm_scratch = span::to_span(push_aligned(buffer, span::GEMM_SCRATCH_ELEMENTS), span::GEMM_SCRATCH_ELEMENTS);
+
+        batch.io.data = batch.io_data;
+        batch.io.length = n_layers + 1;
+
+        auto& io = batch.io.data;
+
+        io[0].activation = push_matrix(len_in, batch_size, buffer);
+        io[0].error = {};
+        io[0].delta = {};
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto len = layers[i].io_back.length;
+            auto& back = io[i + 1];
+
+            back.activation = push_matrix(len, batch_size, buffer);
+            back.error = push_matrix(len, batch_size, buffer);
+            back.delta = push_matrix(len, batch_size, buffer);
+        }
+
+        batch.input = io[0].activation;
+        batch.output = io[n_layers].activation;
+        batch.error = io[n_layers].error;
+        batch.expected = push_matrix(len_out, batch_size, buffer);
+
+        batch.batch_size = batch_size;
+
+        return true;
+    }
+
+
+    EvalResult eval_batch(Net const& net, MiniBatch const& batch)
+    {
+        auto& io = batch.io.data;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward_batch(net.layers.data[i], io[i], io[i + 1], batch.gemm_scratch);
+        }
+
+        EvalResult res{};
+        res.abs_error = 0.0f;
+
+        span::SoftmaxResult sm{};
+
+        for (u32 r = 0; r < batch.batch_size; r++)
+        {
+            sm = span::softmax_error(row_span(batch.output, r), row_span(batch.expected, r), row_span(batch.error, r));
+
+            res.abs_error += sm.abs_error;
+            res.loss += sm.loss;
+        }
+
+        res.abs_error /= batch.batch_size;
+        res.loss /= batch.batch_size;
+        res.label = to_label(sm.max, sm.argmax);
+        res.argmax = sm.argmax;
+
+        return res;
+    }
+
+
+    EvalResult update_batch(Net const& net, MiniBatch const& batch)
+    {
+        auto res = eval_batch(net, batch);
+
+        auto& io = batch.io.data;
+
+        // the input io has no error to propagate
+        for (int i = net.layers.length - 1; i >= 0; i--)
+        {
+            update_back_batch(net.layers.data[i], io[i], io[i + 1], batch.gemm_scratch);
+        }
+
+        return res;
+    }
+
+
+    int prediction_label(MiniBatch const& batch, u32 row)
+    {
+        auto output = row_span(batch.output, row);
+
+        for (u32 i = 0; i < output.length; i++)
+        {
+            if (output.data[i] > PREDICTION_MIN)
+            {
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+
+    f32 abs_error(MiniBatch const& batch)
+    {
+        auto error = matrix_span(batch.error);
+
+        f32 e = 0.0f;
+        for (u32 i = 0; i < error.length; i++)
+        {
+            e += num::abs(error.data[i]);
+        }
+
+        return e / error.length;
+    }
+}
+
+
+/* data parallel */
+
+namespace mlp
+{
+    u64 gradient_elements(Net const& net)
+    {
+        // room to start on a cache line, the gradients are summed by other threads
+        u64 n_elements = PARAM_ALIGN_ELEMENTS;
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            auto& w = net.layers.data[i].weights;
+            n_elements += (u64)w.width * w.height + w.height;
+        }
+
+        return n_elements;
+    }
+
+
+    bool create_gradient(NetGradient& grad, Net const& net)
+    {
+        if (!mb::create_buffer(grad.memory, gradient_elements(net), "mlp gradient"))
+        {
+            assert("*** mlp gradient buffer failed ***" && false);
+            return false;
+        }
+
+        return create_gradient(grad, net, grad.memory);
+    }
+
+
+    bool create_gradient(NetGradient& grad, Net const& net, MemoryBuffer<f32>& buffer)
+    {
+        auto const n_layers = net.layers.length;
+
+        if (!has_room(buffer, gradient_elements(net)))
+        {
+            assert("*** mlp gradient buffer failed ***" && false);
+            return false;
+        }
+
+        align_buffer(buffer);
+
+        auto begin = buffer.data_ + buffer.size_;
+
+        grad.layers.data = grad.layer_data;
+        grad.layers.length = n_layers;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& w = net.layers.data[i].weights;
+            auto& g = grad.layers.data[i];
+
+            g.weights = push_matrix(w.width, w.height, buffer);
+            g.bias = span::push_span(buffer, w.height);
+        }
+
+        grad.values = span::to_span(begin, buffer.data_ + buffer.size_ - begin);
+
+        span::fill(grad.values, 0.0f);
+
+        return true;
+    }
+
+
+    EvalResult eval_gradient(Net const& net, MiniBatch const& batch, NetGradient const& grad)
+    {
+        assert(grad.layers.length == net.layers.length);
+
+        auto res = eval_batch(net, batch);
+
+        auto& io = batch.io.data;
+
+        for (int i = net.layers.length - 1; i >= 0; i--)
+        {
+            gradient_back_batch(net.layers.data[i], io[i], io[i + 1], grad.layers.data[i], batch.gemm_scratch);
+        }
+
+        return res;
+    }
+
+
+    void add_gradient(NetGradient const& src, NetGradient const& dst)
+    {
+        auto& s = src.values;
+        auto& d = dst.values;
+
+        assert(s.length == d.length);
+
+        span::add(d, s, d);
+    }
+
+
+    void apply_gradient(Net const& net, NetGradient const& grad, u32 part, u32 n_parts)
+    {
+        assert(part < n_parts);
+
+        f32 eta = 0.000001f;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            auto& layer = net.layers.data[i];
+            auto& g = grad.layers.data[i];
+
+            auto n_rows = layer.weights.height;
+
+            auto row_begin = (u32)((u64)n_rows * part / n_parts);
+            auto row_end = (u32)((u64)n_rows * (part + 1) / n_parts);
+
+            for (u32 r = row_begin; r < row_end; r++)
+            {
+                span::axpy(eta, row_span(g.weights, r), row_span(layer.weights, r));
+
+                layer.io_back.bias[r] += eta * g.bias.data[r];
+            }
+        }
+    }
+}
+
+/* int8 */
+
+namespace mlp
+{
+    static u32 quantized_width(u32 n_inputs)
+    {
+        constexpr auto A = span::GEMV_I8_ALIGN;
+
+        return (n_inputs + A - 1) / A * A;
+    }
+
+
+    u64 replica_elements(QuantizedNet const& net)
+    {
+        auto& layers = net.layers;
+        auto n_layers = layers.length;
+
+        assert(n_layers > 0);
+
+        u64 n_activations = layers.data[0].n_inputs + layers.data[n_layers - 1].n_outputs;
+        u32 max_width = 0;
+        u32 max_outputs = 0;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& layer = layers.data[i];
+
+            n_activations += layer.n_outputs;
+            max_width = num::max(max_width, layer.weights.width);
+            max_outputs = num::max(max_outputs, layer.n_outputs);
+        }
+
+        // input_q and the sums are stored with the activations, input_q starts on a cache line
+        return PARAM_ALIGN_ELEMENTS + (u64)max_width / sizeof(f32) + max_outputs + n_activations;
+    }
+
+
+    // quantized input, sums, activations and error, for layers that are already set up
+    static bool create_activations(QuantizedNet& net, MemoryBuffer<f32>& buffer)
+    {
+        static_assert(sizeof(i32) == sizeof(f32));
+        static_assert(span::GEMV_I8_ALIGN % sizeof(f32) == 0);
+
+        if (!has_room(buffer, replica_elements(net)))
+        {
+            return false;
+        }
+
+        auto& layers = net.layers;
+        auto n_layers = layers.length;
+
+        u32 max_width = 0;
+        u32 max_outputs = 0;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            max_width = num::max(max_width, layers.data[i].weights.width);
+            max_outputs = num::max(max_outputs, layers.data[i].n_outputs);
+        }
+
+        auto begin = push_aligned(buffer, max_width / sizeof(f32));
+
+        net.input_q = span::to_span((u8*)begin, max_width);
+        net.sums = span::to_span((i32*)mb::push_elements(buffer, max_outputs), max_outputs);
+
+        auto input = mb::push_elements(buffer, layers.data[0].n_inputs);
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& layer = layers.data[i];
+
+            layer.input = input;
+            layer.output = mb::push_elements(buffer, layer.n_outputs);
+
+            input = layer.output;
+        }
+
+        auto& back = layers.data[n_layers - 1];
+
+        net.input = span::to_span(layers.data[0].input, layers.data[0].n_inputs);
+        net.output = span::to_span(back.output, back.n_outputs);
+        net.error = span::to_span(mb::push_elements(buffer, back.n_outputs), back.n_outputs);
+
+        span::fill(span::to_span(begin, buffer.data_ + buffer.size_ - begin), 0.0f);
+
+        return true;
+    }
+
+
+    // q = round(w / scale) with scale = max|w| / 127 of the row
+    static void quantize_row(f32 const* w, u32 length, i8* q, f32& scale)
+    {
+        f32 w_max = 0.0f;
+        for (u32 i = 0; i < length; i++)
+        {
+            w_max = num::max(w_max, num::abs(w[i]));
+        }
+
+        scale = w_max / 127.0f;
+
+        auto inv = w_max > 0.0f ? 127.0f / w_max : 0.0f;
+
+        for (u32 i = 0; i < length; i++)
+        {
+            q[i] = num::round_to_signed<i8>(num::clamp(w[i] * inv, -127.0f, 127.0f));
+        }
+    }
+
+
+    // y = max(sums * scale * x_scale + bias, 0)
+    static void eval_forward(QuantizedNet const& net, QuantizedLayer const& layer)
+    {
+        auto width = layer.weights.width;
+        auto q = net.input_q.data;
+
+        auto x_scale = span::quantize_u7(span::to_span(layer.input, layer.n_inputs), net.input_q);
+
+        // a wider layer before may have left values in the padding
+        std::memset(q + layer.n_inputs, 0, width - layer.n_inputs);
+
+        auto sums = net.sums.data;
+
+        span::gemv_i8(layer.weights, span::to_span(q, width), span::to_span(sums, layer.n_outputs));
+
+        for (u32 r = 0; r < layer.n_outputs; r++)
+        {
+            auto y = (f32)sums[r] * (layer.scale[r] * x_scale) + layer.bias[r];
+
+            layer.output[r] = y < 0.0f ? 0.0f : y;
+        }
+    }
+
+
+    void quantize(QuantizedNet& qnet, Net const& net)
+    {
+        auto n_layers = net.layers.length;
+
+        assert(n_layers > 0 && n_layers <= QuantizedNet::MAX_LAYERS);
+
+        u64 n_weights = 0;
+        u64 n_params = 0;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& w = net.layers.data[i].weights;
+
+            n_weights += (u64)w.height * quantized_width(w.width);
+            n_params += 2 * w.height;
+        }
+
+        auto ok = mb::create_buffer(qnet.weight_memory, n_weights, "mlp int8 weights") &&
+            mb::create_buffer(qnet.param_memory, n_params, "mlp int8 params");
+
+        if (!ok)
+        {
+            assert("*** mlp int8 buffer failed ***" && false);
+            destroy(qnet);
+            return;
+        }
+
+        mb::zero_buffer(qnet.weight_memory);
+
+        qnet.layers.data = qnet.layer_data;
+        qnet.layers.length = n_layers;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& src = net.layers.data[i];
+            auto& layer = qnet.layers.data[i];
+
+            auto n_inputs = src.weights.width;
+            auto n_outputs = src.weights.height;
+
+            layer.n_inputs = n_inputs;
+            layer.n_outputs = n_outputs;
+
+            layer.weights.width = quantized_width(n_inputs);
+            layer.weights.height = n_outputs;
+            layer.weights.matrix_data_ = mb::push_elements(qnet.weight_memory, (u64)layer.weights.width * n_outputs);
+
+            layer.scale = mb::push_elements(qnet.param_memory, n_outputs);
+            layer.bias = mb::push_elements(qnet.param_memory, n_outputs);
+
+            for (u32 r = 0; r < n_outputs; r++)
+            {
+                auto w = row_span(src.weights, r).data;
+                auto q = row_span(layer.weights, r).data;
+
+                quantize_row(w, n_inputs, q, layer.scale[r]);
+            }
+
+            std::memcpy(layer.bias, src.io_back.bias, n_outputs * sizeof(f32));
+        }
+
+        ok = mb::create_buffer(qnet.memory, replica_elements(qnet), "mlp int8") &&
+            create_activations(qnet, qnet.memory);
+
+        if (!ok)
+        {
+            assert("*** mlp int8 buffer failed ***" && false);
+            destroy(qnet);
+        }
+    }
+
+
+    bool create_replica(QuantizedNet& replica, QuantizedNet const& net)
+    {
+        if (!mb::create_buffer(replica.memory, replica_elements(net), "mlp int8 replica"))
+        {
+            assert("*** mlp int8 replica buffer failed ***" && false);
+            return false;
+        }
+
+        return create_replica(replica, net, replica.memory);
+    }
+
+
+    bool create_replica(QuantizedNet& replica, QuantizedNet const& net, MemoryBuffer<f32>& buffer)
+    {
+        assert(net.layers.length > 0);
+
+        replica.layers.data = replica.layer_data;
+        replica.layers.length = net.layers.length;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            // weights, scale and bias stay with the source net
+            replica.layer_data[i] = net.layers.data[i];
+        }
+
+        if (!create_activations(replica, buffer))
+        {
+            assert("*** mlp int8 replica buffer failed ***" && false);
+            replica.layers.length = 0;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void set_input(QuantizedNet& net, f32* data)
+    {
+        assert(net.layers.length > 0);
+
+        net.layers.data[0].input = data;
+        net.input.data = data;
+    }
+
+
+    EvalResult eval(QuantizedNet const& net, Span32 const& expected)
+    {
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward(net, net.layers.data[i]);
+        }
+
+        auto sm = span::softmax_error(net.output, expected, net.error);
+
+        EvalResult res{};
+        res.abs_error = sm.abs_error;
+        res.loss = sm.loss;
+        res.label = to_label(sm.max, sm.argmax);
+        res.argmax = sm.argmax;
+
+        return res;
+    }
+
+
+    u64 weight_bytes(QuantizedNet const& net)
+    {
+        u64 n_bytes = 0;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            auto& layer = net.layers.data[i];
+
+            n_bytes += (u64)layer.n_outputs * layer.weights.width * sizeof(i8) + 2 * layer.n_outputs * sizeof(f32);
+        }
+
+        return n_bytes;
+    }
+
+
+    u64 weight_bytes(Net const& net)
+    {
+        u64 n_bytes = 0;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            auto& w = net.layers.data[i].weights;
+
+            n_bytes += ((u64)w.width + 1) * w.height * sizeof(f32);
+        }
+
+        return n_bytes;
+    }
+}
+
+
+/* half */
+
+namespace mlp
+{
+    u64 replica_elements(HalfNet const& net)
+    {
+        auto& layers = net.layers;
+        auto n_layers = layers.length;
+
+        assert(n_layers > 0);
+
+        // room to start on a cache line
+        u64 n_activations = PARAM_ALIGN_ELEMENTS + layers.data[0].n_inputs + layers.data[n_layers - 1].n_outputs;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            n_activations += layers.data[i].n_outputs;
+        }
+
+        return n_activations;
+    }
+
+
+    // activations and error, for layers that are already set up
+    static bool create_activations(HalfNet& net, MemoryBuffer<f32>& buffer)
+    {
+        if (!has_room(buffer, replica_elements(net)))
+        {
+            return false;
+        }
+
+        auto& layers = net.layers;
+        auto n_layers = layers.length;
+
+        auto begin = push_aligned(buffer, layers.data[0].n_inputs);
+        auto input = begin;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& layer = layers.data[i];
+
+            layer.input = input;
+            layer.output = mb::push_elements(buffer, layer.n_outputs);
+
+            input = layer.output;
+        }
+
+        auto& back = layers.data[n_layers - 1];
+
+        net.input = span::to_span(layers.data[0].input, layers.data[0].n_inputs);
+        net.output = span::to_span(back.output, back.n_outputs);
+        net.error = span::to_span(mb::push_elements(buffer, back.n_outputs), back.n_outputs);
+
+        span::fill(span::to_span(begin, buffer.data_ + buffer.size_ - begin), 0.0f);
+
+        return true;
+    }
+
+
+    static void eval_forward(HalfNet const& net, HalfLayer const& layer)
+    {
+        auto a_in = span::to_span(layer.input, layer.n_inputs);
+        auto a_out = span::to_span(layer.output, layer.n_outputs);
+
+        span::gemv_half_bias_relu(layer.weights, net.format, a_in, span::to_span(layer.bias, layer.n_outputs), a_out);
+    }
+
+
+    void to_half(HalfNet& hnet, Net const& net, span::HalfFormat format)
+    {
+        auto n_layers = net.layers.length;
+
+        assert(n_layers > 0 && n_layers <= HalfNet::MAX_LAYERS);
+
+        u64 n_weights = 0;
+        u64 n_params = 0;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& w = net.layers.data[i].weights;
+
+            n_weights += (u64)w.width * w.height;
+            n_params += w.height;
+        }
+
+        auto ok = mb::create_buffer(hnet.weight_memory, n_weights, "mlp half weights") &&
+            mb::create_buffer(hnet.param_memory, n_params, "mlp half params");
+
+        if (!ok)
+        {
+            assert("*** mlp half buffer failed ***" && false);
+            destroy(hnet);
+            return;
+        }
+
+        hnet.format = format;
+        hnet.layers.data = hnet.layer_data;
+        hnet.layers.length = n_layers;
+
+        for (u32 i = 0; i < n_layers; i++)
+        {
+            auto& src = net.layers.data[i];
+            auto& layer = hnet.layers.data[i];
+
+            auto n_inputs = src.weights.width;
+            auto n_outputs = src.weights.height;
+            auto n = (u64)n_inputs * n_outputs;
+
+            layer.n_inputs = n_inputs;
+            layer.n_outputs = n_outputs;
+
+            layer.weights.width = n_inputs;
+            layer.weights.height = n_outputs;
+            layer.weights.matrix_data_ = mb::push_elements(hnet.weight_memory, n);
+
+            layer.bias = mb::push_elements(hnet.param_memory, n_outputs);
+
+            span::to_half(span::to_span(src.weights.matrix_data_, n), span::to_span(layer.weights.matrix_data_, n), format);
+
+            std::memcpy(layer.bias, src.io_back.bias, n_outputs * sizeof(f32));
+        }
+
+        ok = mb::create_buffer(hnet.memory, replica_elements(hnet), "mlp half") &&
+            create_activations(hnet, hnet.memory);
+
+        if (!ok)
+        {
+            assert("*** mlp half buffer failed ***" && false);
+            destroy(hnet);
+        }
+    }
+
+
+    bool create_replica(HalfNet& replica, HalfNet const& net)
+    {
+        if (!mb::create_buffer(replica.memory, replica_elements(net), "mlp half replica"))
+        {
+            assert("*** mlp half replica buffer failed ***" && false);
+            return false;
+        }
+
+        return create_replica(replica, net, replica.memory);
+    }
+
+
+    bool create_replica(HalfNet& replica, HalfNet const& net, MemoryBuffer<f32>& buffer)
+    {
+        assert(net.layers.length > 0);
+
+        replica.format = net.format;
+        replica.layers.data = replica.layer_data;
+        replica.layers.length = net.layers.length;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            // weights and bias stay with the source net
+            replica.layer_data[i] = net.layers.data[i];
+        }
+
+        if (!create_activations(replica, buffer))
+        {
+            assert("*** mlp half replica buffer failed ***" && false);
+            replica.layers.length = 0;
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void set_input(HalfNet& net, f32* data)
+    {
+        assert(net.layers.length > 0);
+
+        net.layers.data[0].input = data;
+        net.input.data = data;
+    }
+
+
+    EvalResult eval(HalfNet const& net, Span32 const& expected)
+    {
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            eval_forward(net, net.layers.data[i]);
+        }
+
+        auto sm = span::softmax_error(net.output, expected, net.error);
+
+        EvalResult res{};
+        res.abs_error = sm.abs_error;
+        res.loss = sm.loss;
+        res.label = to_label(sm.max, sm.argmax);
+        res.argmax = sm.argmax;
+
+        return res;
+    }
+
+
+    u64 weight_bytes(HalfNet const& net)
+    {
+        u64 n_bytes = 0;
+
+        for (u32 i = 0; i < net.layers.length; i++)
+        {
+            auto& layer = net.layers.data[i];
+
+            n_bytes += (u64)layer.n_outputs * layer.n_inputs * sizeof(u16) + layer.n_outputs * sizeof(f32);
+        }
+
+        return n_bytes;
     }
 }
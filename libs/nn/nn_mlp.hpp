@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../span/span.hpp"
+#include "../mapped_file/mapped_file.hpp"
 
 
 namespace mlp
@@ -87,31 +88,363 @@ namespace mlp
         Span32 output;
         Span32 error;
 
+        MLP_Topology topology;
+
+        // weights and biases of every layer in one 64 byte aligned block, saved as is
+        // activations, errors and deltas are in memory after it
+        Span32 params;
+
         Layer layer_data[MAX_LAYERS];
         MemoryBuffer<f32> memory;
+
+        // params point into the file after load, pages are copied on their first write
+        MappedFile param_file;
     };
 
     using Net = MultiLayerPerceptron;
     using NetTopology = MLP_Topology;
 
 
+    class BatchIO
+    {
+    public:
+        // one row per sample in the batch
+        Matrix32 activation;
+        Matrix32 error;
+        Matrix32 delta;
+    };
+
+
+    class MiniBatch
+    {
+    public:
+        constexpr static u32 MAX_IO = MultiLayerPerceptron::MAX_LAYERS + 1;
+
+        u32 batch_size = 0;
+
+        // io[0] is the input, io[i + 1] is the output of layer i
+        SpanView<BatchIO> io;
+
+        Matrix32 input;
+        Matrix32 output;
+        Matrix32 error;
+        Matrix32 expected;
+
+        // packed blocks of the gemm passes
+        Span32 gemm_scratch;
+
+        BatchIO io_data[MAX_IO];
+        MemoryBuffer<f32> memory;
+    };
+
+
+    class EvalResult
+    {
+    public:
+        // mean |expected - output|
+        f32 abs_error = 1.0f;
+
+        // cross-entropy of the softmax output
+        f32 loss = 0.0f;
+
+        // predicted label or -1, for a batch the label of the last row
+        int label = -1;
+
+        // most likely label regardless of confidence
+        u32 argmax = 0;
+    };
+
+
+    class LayerGradient
+    {
+    public:
+        Matrix32 weights;
+        Span32 bias;
+    };
+
+
+    // weight and bias updates summed over a batch, applied separately
+    class NetGradient
+    {
+    public:
+        constexpr static u32 MAX_LAYERS = MultiLayerPerceptron::MAX_LAYERS;
+
+        SpanView<LayerGradient> layers;
+
+        // every layer's weights and bias, contiguous
+        Span32 values;
+
+        LayerGradient layer_data[MAX_LAYERS];
+        MemoryBuffer<f32> memory;
+    };
+
+
     inline void destroy(Net& net)
     {
         mb::destroy_buffer(net.memory);
+
+        if (net.param_file.ok)
+        {
+            mem::untag(net.param_file.data);
+            mapped_file::unmap(net.param_file);
+        }
+
+        net.params = Span32{};
+    }
+
+
+    inline void destroy(MiniBatch& batch)
+    {
+        mb::destroy_buffer(batch.memory);
+        batch.batch_size = 0;
+    }
+
+
+    inline void destroy(NetGradient& grad)
+    {
+        mb::destroy_buffer(grad.memory);
+        grad.layers.length = 0;
+        grad.values = Span32{};
     }
 
 
-    u32 mlp_bytes(NetTopology const& topology);
+    // 0 if the size does not fit in 64 bits
+    u64 mlp_bytes(NetTopology const& topology);
 
     void create(Net& net, NetTopology topology);
 
+    // params copied from src instead of random, false if src does not fit the topology
+    bool create(Net& net, NetTopology topology, Span32 const& src);
+
+    // topology followed by the params, the file is replaced only when complete
+    bool save(Net const& net, cstr file_path);
+
+    // params copied out of a net with that topology, e.g. written on another thread
+    bool save(NetTopology const& topology, Span32 const& params, cstr file_path);
+
+    // params are mapped from the file, not read, and can be trained without modifying it
+    bool load(Net& net, cstr file_path);
+
+    // separate activations, errors and deltas, weights and bias shared with net
+    // net must outlive the replica
+    bool create_replica(Net& replica, Net const& net);
+
+    // elements a replica takes from a shared buffer
+    u64 replica_elements(Net const& net);
+
+    // pushed to buffer instead of a buffer of its own, buffer must outlive the replica
+    bool create_replica(Net& replica, Net const& net, MemoryBuffer<f32>& buffer);
+
+    // read the input activations from data instead of the net's own buffer
+    // data must hold net.input.length values and is not modified
+    void set_input(Net& net, f32* data);
+
     void eval(Net const& net);
 
-    void eval(Net const& net, Span32 const& expected);
+    EvalResult eval(Net const& net, Span32 const& expected);
+
+    EvalResult update(Net const& net, Span32 const& expected);
 
-    void update(Net const& net, Span32 const& expected);
+    // also writes the error of the input, for a network in front of this one
+    EvalResult update(Net const& net, Span32 const& expected, Span32 const& input_error);
 
     int prediction_label(Net const& net);
 
     f32 abs_error(Net const& net);
-}
\ No newline at end of file
+}
+
+
+/* mini-batch */
+
+namespace mlp
+{
+    bool create_batch(MiniBatch& batch, Net const& net, u32 batch_size);
+
+    // 0 if the size does not fit in 64 bits
+    u64 batch_elements(Net const& net, u32 batch_size);
+
+    bool create_batch(MiniBatch& batch, Net const& net, u32 batch_size, MemoryBuffer<f32>& buffer);
+
+    EvalResult eval_batch(Net const& net, MiniBatch const& batch);
+
+    EvalResult update_batch(Net const& net, MiniBatch const& batch);
+
+    int prediction_label(MiniBatch const& batch, u32 row);
+
+    f32 abs_error(MiniBatch const& batch);
+}
+
+
+/* data parallel */
+
+namespace mlp
+{
+    bool create_gradient(NetGradient& grad, Net const& net);
+
+    u64 gradient_elements(Net const& net);
+
+    bool create_gradient(NetGradient& grad, Net const& net, MemoryBuffer<f32>& buffer);
+
+    // forward and backward over the batch, grad = sum of the per sample updates
+    // net is not modified
+    EvalResult eval_gradient(Net const& net, MiniBatch const& batch, NetGradient const& grad);
+
+    // dst += src
+    void add_gradient(NetGradient const& src, NetGradient const& dst);
+
+    // apply grad to rows [part / n_parts, (part + 1) / n_parts) of each layer
+    void apply_gradient(Net const& net, NetGradient const& grad, u32 part, u32 n_parts);
+}
+
+/* int8 */
+
+namespace mlp
+{
+    // weights of a layer as int8 rows, w = scale * q
+    class QuantizedLayer
+    {
+    public:
+        // rows padded with zeros to span::GEMV_I8_ALIGN inputs
+        MatrixView2D<i8> weights;
+
+        f32* scale = 0;
+        f32* bias = 0;
+
+        u32 n_inputs = 0;
+        u32 n_outputs = 0;
+
+        f32* input = 0;
+        f32* output = 0;
+    };
+
+
+    // inference only, the inputs of every layer are quantized to [0, 127] per sample
+    // they are >= 0, features in [0, 1] and reLU outputs
+    class QuantizedNet
+    {
+    public:
+        constexpr static u32 MAX_LAYERS = MultiLayerPerceptron::MAX_LAYERS;
+
+        SpanView<QuantizedLayer> layers;
+
+        Span32 input;
+        Span32 output;
+        Span32 error;
+
+        // quantized input of the current layer, zero padded
+        SpanView<u8> input_q;
+
+        // int32 sums of the current layer
+        SpanView<i32> sums;
+
+        QuantizedLayer layer_data[MAX_LAYERS];
+
+        // weights, scales and bias are owned by the net that was quantized, shared by its replicas
+        MemoryBuffer<i8> weight_memory;
+        MemoryBuffer<f32> param_memory;
+
+        // activations, input_q and sums
+        MemoryBuffer<f32> memory;
+    };
+
+
+    inline void destroy(QuantizedNet& net)
+    {
+        mb::destroy_buffer(net.weight_memory);
+        mb::destroy_buffer(net.param_memory);
+        mb::destroy_buffer(net.memory);
+        net.layers.length = 0;
+    }
+
+
+    // per row scales, net is not referenced afterwards
+    void quantize(QuantizedNet& qnet, Net const& net);
+
+    // separate activations and scratch, weights shared with net
+    bool create_replica(QuantizedNet& replica, QuantizedNet const& net);
+
+    u64 replica_elements(QuantizedNet const& net);
+
+    bool create_replica(QuantizedNet& replica, QuantizedNet const& net, MemoryBuffer<f32>& buffer);
+
+    void set_input(QuantizedNet& net, f32* data);
+
+    EvalResult eval(QuantizedNet const& net, Span32 const& expected);
+
+    // int8 weights, scales and bias
+    u64 weight_bytes(QuantizedNet const& net);
+
+    // f32 weights and bias
+    u64 weight_bytes(Net const& net);
+}
+
+
+/* half */
+
+namespace mlp
+{
+    // weights of a layer stored as f16 or bf16, widened to f32 when they are read
+    class HalfLayer
+    {
+    public:
+        MatrixView2D<u16> weights;
+        f32* bias = 0;
+
+        u32 n_inputs = 0;
+        u32 n_outputs = 0;
+
+        f32* input = 0;
+        f32* output = 0;
+    };
+
+
+    // inference only, half the weight bytes of Net with the same f32 activations and sums
+    class HalfNet
+    {
+    public:
+        constexpr static u32 MAX_LAYERS = MultiLayerPerceptron::MAX_LAYERS;
+
+        span::HalfFormat format = span::HalfFormat::F16;
+
+        SpanView<HalfLayer> layers;
+
+        Span32 input;
+        Span32 output;
+        Span32 error;
+
+        HalfLayer layer_data[MAX_LAYERS];
+
+        // weights and bias are owned by the net that was converted, shared by its replicas
+        MemoryBuffer<u16> weight_memory;
+        MemoryBuffer<f32> param_memory;
+
+        MemoryBuffer<f32> memory;
+    };
+
+
+    inline void destroy(HalfNet& net)
+    {
+        mb::destroy_buffer(net.weight_memory);
+        mb::destroy_buffer(net.param_memory);
+        mb::destroy_buffer(net.memory);
+        net.layers.length = 0;
+    }
+
+
+    // copy of the weights rounded to format, net stays the f32 master copy
+    void to_half(HalfNet& hnet, Net const& net, span::HalfFormat format);
+
+    // separate activations, weights shared with net
+    bool create_replica(HalfNet& replica, HalfNet const& net);
+
+    u64 replica_elements(HalfNet const& net);
+
+    bool create_replica(HalfNet& replica, HalfNet const& net, MemoryBuffer<f32>& buffer);
+
+    void set_input(HalfNet& net, f32* data);
+
+    EvalResult eval(HalfNet const& net, Span32 const& expected);
+
+    // half weights and f32 bias
+    u64 weight_bytes(HalfNet const& net);
+}
@@ -2,21 +2,39 @@
 
 #include "span.hpp"
 
+#include <bit>
 #include <cassert>
+#include <cmath>
 
-#ifdef __AVX__
-#define SPAN_SIMD_128
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPAN_X86
 #endif
 
-#ifdef __AVX2__
-#define SPAN_SIMD_128
-#define SPAN_SIMD_256
-#endif
 
+#ifdef SPAN_X86
+#include <immintrin.h>
+
+#ifdef _MSC_VER
 
+#include <intrin.h>
+
+#define SPAN_TARGET_128
+#define SPAN_TARGET_256
+#define SPAN_TARGET_512
+#define SPAN_TARGET_VNNI
+#define SPAN_TARGET_F16C
+
+#else
+
+// kernels are compiled for each instruction set and selected at runtime
+#define SPAN_TARGET_128 __attribute__((target("sse4.1")))
+#define SPAN_TARGET_256 __attribute__((target("avx2,fma")))
+#define SPAN_TARGET_512 __attribute__((target("avx512f,avx2,fma")))
+#define SPAN_TARGET_VNNI __attribute__((target("avx512f,avx512bw,avx512vnni,avx2,fma")))
+#define SPAN_TARGET_F16C __attribute__((target("avx2,fma,f16c")))
+
+#endif
 
-#ifdef SPAN_SIMD_128
-#include <immintrin.h>
 
 /* defines */
 
@@ -25,12 +43,11 @@ namespace span
     using i128 = __m128i;
     using f128 = __m128;
 
-#ifdef SPAN_SIMD_256
-
     using i256 = __m256i;
     using f256 = __m256;
 
-#endif
+    using i512 = __m512i;
+    using f512 = __m512;
 }
 
 #endif
@@ -46,7 +63,169 @@ namespace span
     constexpr auto size256 = 2 * size128;
     constexpr auto size512 = 2 * size256;
     constexpr auto size1024 = 2 * size512;
-    
+    constexpr auto size2048 = 2 * size1024;
+
+}
+
+
+/* cpu features */
+
+namespace span
+{
+    static SimdLevel detect_simd_level()
+    {
+    #if defined SPAN_X86 && defined __GNUC__
+
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return SimdLevel::AVX512;
+        }
+
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            return SimdLevel::AVX2;
+        }
+
+        if (__builtin_cpu_supports("sse4.1"))
+        {
+            return SimdLevel::SSE4;
+        }
+
+    #elif defined SPAN_X86 && defined _MSC_VER
+
+        int info[4] = { 0 };
+
+        __cpuid(info, 0);
+        auto n_ids = info[0];
+
+        __cpuid(info, 1);
+        auto ecx1 = (u32)info[2];
+
+        bool sse4 = ecx1 & (1 << 19);
+        bool fma = ecx1 & (1 << 12);
+        bool osxsave = ecx1 & (1 << 27);
+
+        u64 xcr0 = osxsave ? _xgetbv(0) : 0;
+        bool os_avx = (xcr0 & 0x06) == 0x06;
+        bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+        u32 ebx7 = 0;
+        if (n_ids >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            ebx7 = (u32)info[1];
+        }
+
+        bool avx2 = ebx7 & (1 << 5);
+        bool avx512f = ebx7 & (1 << 16);
+
+        if (avx512f && os_avx512)
+        {
+            return SimdLevel::AVX512;
+        }
+
+        if (avx2 && fma && os_avx)
+        {
+            return SimdLevel::AVX2;
+        }
+
+        if (sse4)
+        {
+            return SimdLevel::SSE4;
+        }
+
+    #endif
+
+        return SimdLevel::Scalar;
+    }
+
+
+    static SimdLevel detected_simd_level()
+    {
+        static SimdLevel const level = detect_simd_level();
+
+        return level;
+    }
+
+
+    // int8 dot products with 32 bit sums, only used at the AVX512 level
+    static bool detect_vnni()
+    {
+    #if defined SPAN_X86 && defined __GNUC__
+
+        __builtin_cpu_init();
+
+        return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+
+    #elif defined SPAN_X86 && defined _MSC_VER
+
+        int info[4] = { 0 };
+
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        __cpuidex(info, 7, 0);
+        auto ebx7 = (u32)info[1];
+        auto ecx7 = (u32)info[2];
+
+        bool avx512bw = ebx7 & (1 << 30);
+        bool vnni = ecx7 & (1 << 11);
+
+        // the AVX512 level already checked that the os saves the zmm registers
+        return avx512bw && vnni;
+
+    #else
+
+        return false;
+
+    #endif
+    }
+
+
+    static bool detected_vnni()
+    {
+        static bool const vnni = detect_vnni();
+
+        return vnni;
+    }
+
+
+    static bool detect_f16c()
+    {
+    #if defined SPAN_X86 && defined __GNUC__
+
+        __builtin_cpu_init();
+
+        return __builtin_cpu_supports("f16c");
+
+    #elif defined SPAN_X86 && defined _MSC_VER
+
+        int info[4] = { 0 };
+
+        __cpuid(info, 1);
+        auto ecx1 = (u32)info[2];
+
+        return ecx1 & (1 << 29);
+
+    #else
+
+        return false;
+
+    #endif
+    }
+
+
+    static bool detected_f16c()
+    {
+        static bool const f16c = detect_f16c();
+
+        return f16c;
+    }
 }
 
 
@@ -74,17 +253,17 @@ namespace span
         case 4:
             *(u32*)dst = *(u32*)src;
             return;
-        
+
         case 5:
             *(u32*)dst = *(u32*)src;
             dst[4] = src[4];
             return;
-        
+
         case 6:
             *(u32*)dst = *(u32*)src;
             *(u16*)(dst + 4) = *(u16*)(src + 4);
             return;
-        
+
         case 7:
             *(u32*)dst = *(u32*)src;
             *(u16*)(dst + 4) = *(u16*)(src + 4);
@@ -101,40 +280,29 @@ namespace span
     }
 
 
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
     static inline void bcopy_128(u8* src, u8* dst)
     {
-        #ifdef SPAN_SIMD_128
         _mm_storeu_si128((i128*)dst, _mm_loadu_si128((i128*)src));
-        #else
-        ((u64*)dst)[0] = ((u64*)src)[0];
-        ((u64*)dst)[1] = ((u64*)src)[1];
-        #endif
     }
 
 
+    SPAN_TARGET_256
     static inline void bcopy_256(u8* src, u8* dst)
     {
-        #ifdef SPAN_SIMD_256
         _mm256_storeu_si256((i256*)dst, _mm256_loadu_si256((i256*)src));
-        #else
-        bcopy_128(src, dst);
-        bcopy_128(src + size128, dst + size128);
-        #endif
     }
-   
 
+
+    SPAN_TARGET_512
     static inline void bcopy_512(u8* src, u8* dst)
     {
-        bcopy_256(src, dst);
-        bcopy_256(src + size256, dst + size256);
+        _mm512_storeu_si512((void*)dst, _mm512_loadu_si512((void*)src));
     }
 
-
-    static inline void bcopy_1024(u8* src, u8* dst)
-    {
-        bcopy_512(src, dst);
-        bcopy_512(src + size512, dst + size512);
-    }
+#endif
 }
 
 
@@ -161,10 +329,18 @@ namespace span
     }
 
 
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
     static void copy_u8_128(u8* src, u8* dst, u64 len_u8)
     {
-        auto const n128 = len_u8 / size128;
-        auto const end128 = n128 * size128;
+        if (len_u8 < size128)
+        {
+            copy_u8_64(src, dst, len_u8);
+            return;
+        }
+
+        auto const end128 = len_u8 - len_u8 % size128;
 
         u64 i = 0;
 
@@ -178,15 +354,30 @@ namespace span
     }
 
 
+    SPAN_TARGET_256
     static void copy_u8_256(u8* src, u8* dst, u64 len_u8)
     {
-        auto const n256 = len_u8 / size256;
-        auto const end256 = n256 * size256;
+        if (len_u8 < size256)
+        {
+            copy_u8_128(src, dst, len_u8);
+            return;
+        }
+
+        auto const end1024 = len_u8 - len_u8 % size1024;
+        auto const end256 = len_u8 - len_u8 % size256;
 
         u64 i = 0;
 
+        for (; i < end1024; i += size1024)
+        {
+            bcopy_256(src + i, dst + i);
+            bcopy_256(src + i + size256, dst + i + size256);
+            bcopy_256(src + i + 2 * size256, dst + i + 2 * size256);
+            bcopy_256(src + i + 3 * size256, dst + i + 3 * size256);
+        }
+
         for (; i < end256; i += size256)
-        {            
+        {
             bcopy_256(src + i, dst + i);
         }
 
@@ -195,38 +386,38 @@ namespace span
     }
 
 
+    SPAN_TARGET_512
     static void copy_u8_512(u8* src, u8* dst, u64 len_u8)
     {
-        auto const n512 = len_u8 / size512;
-        auto const end512 = n512 * size512;
+        if (len_u8 < size512)
+        {
+            copy_u8_256(src, dst, len_u8);
+            return;
+        }
+
+        auto const end2048 = len_u8 - len_u8 % size2048;
+        auto const end512 = len_u8 - len_u8 % size512;
 
         u64 i = 0;
 
-        for(; i < end512; i += size512)
+        for (; i < end2048; i += size2048)
         {
             bcopy_512(src + i, dst + i);
+            bcopy_512(src + i + size512, dst + i + size512);
+            bcopy_512(src + i + 2 * size512, dst + i + 2 * size512);
+            bcopy_512(src + i + 3 * size512, dst + i + 3 * size512);
         }
 
-        i = len_u8 - size512;
-        bcopy_512(src + i, dst + i);
-    }
-
-
-    static void copy_u8_1024(u8* src, u8* dst, u64 len_u8)
-    {
-        auto const n1024 = len_u8 / size1024;
-        auto const end1024 = n1024 * size1024;
-
-        u64 i = 0;
-
-        for(; i < end1024; i += size1024)
+        for (; i < end512; i += size512)
         {
-            bcopy_1024(src + i, dst + i);
+            bcopy_512(src + i, dst + i);
         }
 
-        i = len_u8 - size1024;
-        bcopy_1024(src + i, dst + i);
+        i = len_u8 - size512;
+        bcopy_512(src + i, dst + i);
     }
+
+#endif
 }
 
 
@@ -234,97 +425,96 @@ namespace span
 
 namespace span
 {
-#ifndef SPAN_SIMD_128
+#ifdef SPAN_X86
 
-    static inline void bfill_u8_64(u8* dst, u8 value)
+    SPAN_TARGET_128
+    static inline void bfill_128(u8* dst, i128 value)
     {
-        dst[0] = value;
-        dst[1] = value;
-        dst[2] = value;
-        dst[3] = value;
-        dst[4] = value;
-        dst[5] = value;
-        dst[6] = value;
-        dst[7] = value;
+        _mm_storeu_si128((i128*)dst, value);
     }
 
-#endif
-
 
-    static inline void bfill_u8_128(u8* dst, u8 value)
+    SPAN_TARGET_256
+    static inline void bfill_256(u8* dst, i256 value)
     {
-        #ifdef SPAN_SIMD_128
-        _mm_storeu_si128((i128*)dst, _mm_set1_epi8(value));
-        #else
-        bfill_u8_64(dst, value);
-        bfill_u8_64(dst + size64, value);
-        #endif
+        _mm256_storeu_si256((i256*)dst, value);
     }
 
 
-    static inline void bfill_u8_256(u8* dst, u8 value)
+    SPAN_TARGET_512
+    static inline void bfill_512(u8* dst, i512 value)
     {
-        #ifdef SPAN_SIMD_256
-        _mm256_storeu_si256((i256*)dst, _mm256_set1_epi8(value));
-        #else
-        bfill_u8_128(dst, value);
-        bfill_u8_128(dst + size128, value);
-        #endif
+        _mm512_storeu_si512((void*)dst, value);
     }
 
 
-    static inline void bfill_u8_512(u8* dst, u8 value)
+    // fill len_u8 bytes with a repeating vector, len_u8 >= vector size
+    SPAN_TARGET_128
+    static void vfill_128(u8* dst, i128 value, u64 len_u8)
     {
-        bfill_u8_256(dst, value);
-        bfill_u8_256(dst + size256, value);
-    }
+        auto const end128 = len_u8 - len_u8 % size128;
 
+        u64 i = 0;
 
-    static inline void bfill_u8_1024(u8* dst, u8 value)
-    {
-        bfill_u8_512(dst, value);
-        bfill_u8_512(dst + size512, value);
+        for (; i < end128; i += size128)
+        {
+            bfill_128(dst + i, value);
+        }
+
+        bfill_128(dst + len_u8 - size128, value);
     }
 
 
-    static inline void bfill_i32_128(u8* dst, i32 value)
+    SPAN_TARGET_256
+    static void vfill_256(u8* dst, i256 value, u64 len_u8)
     {
-        #ifdef SPAN_SIMD_128
-        _mm_storeu_si128((i128*)dst, _mm_set1_epi32(value));
-        #else
-        ((i32*)dst)[0] = value;
-        ((i32*)dst)[1] = value;
-        ((i32*)dst)[2] = value;
-        ((i32*)dst)[3] = value;
-        #endif
-    }
+        auto const end1024 = len_u8 - len_u8 % size1024;
+        auto const end256 = len_u8 - len_u8 % size256;
 
+        u64 i = 0;
 
-    static inline void bfill_i32_256(u8* dst, i32 value)
-    {
-        #ifdef SPAN_SIMD_256
-        _mm256_storeu_si256((i256*)dst, _mm256_set1_epi32(value));
-        #else
-        bfill_i32_128(dst, value);
-        bfill_i32_128(dst + size128, value);
-        #endif
-    }
+        for (; i < end1024; i += size1024)
+        {
+            bfill_256(dst + i, value);
+            bfill_256(dst + i + size256, value);
+            bfill_256(dst + i + 2 * size256, value);
+            bfill_256(dst + i + 3 * size256, value);
+        }
 
+        for (; i < end256; i += size256)
+        {
+            bfill_256(dst + i, value);
+        }
 
-    static inline void bfill_i32_512(u8* dst, i32 value)
-    {
-        
-        bfill_i32_256(dst, value);
-        bfill_i32_256(dst + size256, value);
+        bfill_256(dst + len_u8 - size256, value);
     }
 
 
-    static inline void bfill_i32_1024(u8* dst, u32 value)
+    SPAN_TARGET_512
+    static void vfill_512(u8* dst, i512 value, u64 len_u8)
     {
-        bfill_i32_512(dst, value);
-        bfill_i32_512(dst + size512, value);
+        auto const end2048 = len_u8 - len_u8 % size2048;
+        auto const end512 = len_u8 - len_u8 % size512;
+
+        u64 i = 0;
+
+        for (; i < end2048; i += size2048)
+        {
+            bfill_512(dst + i, value);
+            bfill_512(dst + i + size512, value);
+            bfill_512(dst + i + 2 * size512, value);
+            bfill_512(dst + i + 3 * size512, value);
+        }
+
+        for (; i < end512; i += size512)
+        {
+            bfill_512(dst + i, value);
+        }
+
+        bfill_512(dst + len_u8 - size512, value);
     }
-    
+
+#endif
 }
 
 
@@ -334,79 +524,54 @@ namespace span
 {
     static void fill_u8_8(u8* dst, u8 value, u64 len_u8)
     {
-        for (u32 i = 0; i < len_u8; i++)
+        for (u64 i = 0; i < len_u8; i++)
         {
             dst[i] = value;
         }
     }
 
 
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
     static void fill_u8_128(u8* dst, u8 value, u64 len_u8)
     {
-        auto const n128 = len_u8 / size128;
-        auto const end128 = n128 * size128;
-
-        u64 i = 0;
-
-        for (; i < end128; i += size128)
+        if (len_u8 < size128)
         {
-            bfill_u8_128(dst + i, value);
+            fill_u8_8(dst, value, len_u8);
+            return;
         }
 
-        i = len_u8 - size128;
-        bfill_u8_128(dst + i, value);
-    }    
+        vfill_128(dst, _mm_set1_epi8((char)value), len_u8);
+    }
 
 
+    SPAN_TARGET_256
     static void fill_u8_256(u8* dst, u8 value, u64 len_u8)
     {
-        auto const n256 = len_u8 / size256;
-        auto const end256 = n256 * size256;
-
-        u64 i = 0;
-
-        for (; i < end256; i += size256)
+        if (len_u8 < size256)
         {
-            bfill_u8_256(dst + i, value);
+            fill_u8_128(dst, value, len_u8);
+            return;
         }
 
-        i = len_u8 - size256;
-        bfill_u8_256(dst + i, value);
+        vfill_256(dst, _mm256_set1_epi8((char)value), len_u8);
     }
 
 
+    SPAN_TARGET_512
     static void fill_u8_512(u8* dst, u8 value, u64 len_u8)
     {
-        auto const n512 = len_u8 / size512;
-        auto const end512 = n512 * size512;
-
-        u64 i = 0;
-
-        for (; i < end512; i += size512)
+        if (len_u8 < size512)
         {
-            bfill_u8_512(dst + i, value);
+            fill_u8_256(dst, value, len_u8);
+            return;
         }
 
-        i = len_u8 - size512;
-        bfill_u8_512(dst + i, value);
+        vfill_512(dst, _mm512_set1_epi32((int)(0x01010101u * value)), len_u8);
     }
 
-
-    static void fill_u8_1024(u8* dst, u8 value, u64 len_u8)
-    {
-        auto const n1024 = len_u8 / size1024;
-        auto const end1024 = n1024 * size1024;
-
-        u64 i = 0;
-
-        for (; i < end1024; i += size1024)
-        {
-            bfill_u8_1024(dst + i, value);
-        }
-
-        i = len_u8 - size1024;
-        bfill_u8_1024(dst + i, value);
-    }
+#endif
 }
 
 
@@ -416,100 +581,60 @@ namespace span
 {
     static void fill_u32_32(u32* dst, u32 value, u64 len_u32)
     {
-        for (u32 i = 0; i < len_u32; i++)
+        for (u64 i = 0; i < len_u32; i++)
         {
             dst[i] = value;
         }
     }
 
 
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
     static void fill_u32_128(u32* dst, u32 value, u64 len_u32)
     {
-        auto const ival = *((int*)(&value));
-
         auto const len_u8 = len_u32 * size32;
-        auto const n128 = len_u8 / size128;
-        auto const end128 = n128 * size128;        
-
-        u8* d8 = (u8*)dst;
-
-        u64 i = 0;
 
-        for (; i < end128; i += size128)
+        if (len_u8 < size128)
         {
-            bfill_i32_128(d8 + i, ival);
+            fill_u32_32(dst, value, len_u32);
+            return;
         }
 
-        i = len_u8 - size128;
-        bfill_i32_128(d8 + i, ival);
+        vfill_128((u8*)dst, _mm_set1_epi32((int)value), len_u8);
     }
 
 
+    SPAN_TARGET_256
     static void fill_u32_256(u32* dst, u32 value, u64 len_u32)
     {
-        auto const ival = *((int*)(&value));
-
         auto const len_u8 = len_u32 * size32;
-        auto const n256 = len_u8 / size256;
-        auto const end256 = n256 * size256;
-
-        u8* d8 = (u8*)dst;
-
-        u64 i = 0;
 
-        for (; i < end256; i += size256)
+        if (len_u8 < size256)
         {
-            bfill_i32_256(d8 + i, ival);
+            fill_u32_128(dst, value, len_u32);
+            return;
         }
 
-        i = len_u8 - size256;
-        bfill_i32_256(d8 + i, ival);
+        vfill_256((u8*)dst, _mm256_set1_epi32((int)value), len_u8);
     }
 
 
+    SPAN_TARGET_512
     static void fill_u32_512(u32* dst, u32 value, u64 len_u32)
     {
-        auto const ival = *((int*)(&value));
-
-        auto const len_u8 = len_u32 * size32;
-        auto const n512 = len_u8 / size512;
-        auto const end512 = n512 * size512;
-
-        u8* d8 = (u8*)dst;
-
-        u64 i = 0;
-
-        for (; i < end512; i += size512)
-        {
-            bfill_i32_512(d8 + i, ival);
-        }
-
-        i = len_u8 - size512;
-        bfill_i32_512(d8 + i, ival);
-    }
-
-
-    static void fill_u32_1024(u32* dst, u32 value, u64 len_u32)
-    {
-        auto const ival = *((int*)(&value));
-
         auto const len_u8 = len_u32 * size32;
-        auto const n1024 = len_u8 / size1024;
-        auto const end1024 = n1024 * size1024;
-
-        u8* d8 = (u8*)dst;
-
-        u64 i = 0;
 
-        for (; i < end1024; i += size1024)
+        if (len_u8 < size512)
         {
-            bfill_i32_1024(d8 + i, ival);
+            fill_u32_256(dst, value, len_u32);
+            return;
         }
 
-        i = len_u8 - size1024;
-        bfill_i32_1024(d8 + i, ival);
+        vfill_512((u8*)dst, _mm512_set1_epi32((int)value), len_u8);
     }
 
+#endif
 }
 
 
@@ -517,23 +642,24 @@ namespace span
 
 namespace span
 {
-    static void add_32(f32* a, f32* b, f32* dst, u32 len)
+    static void add_32(f32* a, f32* b, f32* dst, u64 len)
     {
-        for (u32 i = 0; i < len; i++)
+        for (u64 i = 0; i < len; i++)
         {
             dst[i] = a[i] + b[i];
         }
     }
 
 
-    static void add_128(f32* a, f32* b, f32* dst, u32 len)
-    {
-        #ifdef SPAN_SIMD_128
+#ifdef SPAN_X86
 
+    SPAN_TARGET_128
+    static void add_128(f32* a, f32* b, f32* dst, u64 len)
+    {
         constexpr u32 N = 4;
-        u32 L = len - (len % N);
+        u64 L = len - (len % N);
 
-        u32 i = 0;
+        u64 i = 0;
         for (i = 0; i < L; i += N)
         {
             f128 va = _mm_loadu_ps(a + i);
@@ -543,23 +669,16 @@ namespace span
         }
 
         add_32(a + i, b + i, dst + i, len - i);
+    }
 
-        #else
-
-        add_32(a, b, dst, len);
 
-        #endif
-    }
-
-
-    static void add_256(f32* a, f32* b, f32* dst, u32 len)
+    SPAN_TARGET_256
+    static void add_256(f32* a, f32* b, f32* dst, u64 len)
     {
-        #ifdef SPAN_SIMD_256
-
         constexpr u32 N = 8;
-        u32 L = len - (len % N);
+        u64 L = len - (len % N);
 
-        u32 i = 0;
+        u64 i = 0;
         for (i = 0; i < L; i += N)
         {
             f256 va = _mm256_loadu_ps(a + i);
@@ -568,14 +687,29 @@ namespace span
             _mm256_storeu_ps(dst + i, _mm256_add_ps(va, vb));
         }
 
-        add_32(a + i, b + i, dst + i, len - i);
+        add_128(a + i, b + i, dst + i, len - i);
+    }
+
+
+    SPAN_TARGET_512
+    static void add_512(f32* a, f32* b, f32* dst, u64 len)
+    {
+        constexpr u32 N = 16;
+        u64 L = len - (len % N);
 
-        #else
+        u64 i = 0;
+        for (i = 0; i < L; i += N)
+        {
+            f512 va = _mm512_loadu_ps(a + i);
+            f512 vb = _mm512_loadu_ps(b + i);
 
-        add_128(a, b, dst, len);
+            _mm512_storeu_ps(dst + i, _mm512_add_ps(va, vb));
+        }
 
-        #endif
+        add_256(a + i, b + i, dst + i, len - i);
     }
+
+#endif
 }
 
 
@@ -583,23 +717,24 @@ namespace span
 
 namespace span
 {
-    static void sub_32(f32* a, f32* b, f32* dst, u32 len)
+    static void sub_32(f32* a, f32* b, f32* dst, u64 len)
     {
-        for (u32 i = 0; i < len; i++)
+        for (u64 i = 0; i < len; i++)
         {
             dst[i] = a[i] - b[i];
         }
     }
 
 
-    static void sub_128(f32* a, f32* b, f32* dst, u32 len)
-    {
-        #ifdef SPAN_SIMD_128
+#ifdef SPAN_X86
 
+    SPAN_TARGET_128
+    static void sub_128(f32* a, f32* b, f32* dst, u64 len)
+    {
         constexpr u32 N = 4;
-        u32 L = len - (len % N);
+        u64 L = len - (len % N);
 
-        u32 i = 0;
+        u64 i = 0;
         for (i = 0; i < L; i += N)
         {
             f128 va = _mm_loadu_ps(a + i);
@@ -609,24 +744,16 @@ namespace span
         }
 
         sub_32(a + i, b + i, dst + i, len - i);
-
-
-        #else
-
-        sub_32(a, b, dst, len);
-
-        #endif
     }
 
 
-    static void sub_256(f32* a, f32* b, f32* dst, u32 len)
+    SPAN_TARGET_256
+    static void sub_256(f32* a, f32* b, f32* dst, u64 len)
     {
-        #ifdef SPAN_SIMD_256
-
         constexpr u32 N = 8;
-        u32 L = len - (len % N);
+        u64 L = len - (len % N);
 
-        u32 i = 0;
+        u64 i = 0;
         for (i = 0; i < L; i += N)
         {
             f256 va = _mm256_loadu_ps(a + i);
@@ -635,14 +762,138 @@ namespace span
             _mm256_storeu_ps(dst + i, _mm256_sub_ps(va, vb));
         }
 
-        sub_32(a + i, b + i, dst + i, len - i);
+        sub_128(a + i, b + i, dst + i, len - i);
+    }
+
+
+    SPAN_TARGET_512
+    static void sub_512(f32* a, f32* b, f32* dst, u64 len)
+    {
+        constexpr u32 N = 16;
+        u64 L = len - (len % N);
+
+        u64 i = 0;
+        for (i = 0; i < L; i += N)
+        {
+            f512 va = _mm512_loadu_ps(a + i);
+            f512 vb = _mm512_loadu_ps(b + i);
+
+            _mm512_storeu_ps(dst + i, _mm512_sub_ps(va, vb));
+        }
+
+        sub_256(a + i, b + i, dst + i, len - i);
+    }
+
+#endif
+}
+
+
+/* aligned / masked loads */
+
+namespace span
+{
+    static inline bool is_aligned(void* a, void* b, u64 n_bytes)
+    {
+        return ((size_t)a | (size_t)b) % n_bytes == 0;
+    }
+
+
+#ifdef SPAN_X86
+
+    // 8 x -1 followed by 8 x 0, a window of 8 starting at (8 - n) has n lanes on
+    alignas(64) static const int tail_mask_table[16] = {
+        -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+
+    SPAN_TARGET_256
+    static inline i256 tail_mask_256(u32 n)
+    {
+        return _mm256_loadu_si256((i256*)(tail_mask_table + 8 - n));
+    }
+
+
+    static inline __mmask16 tail_mask_512(u32 n)
+    {
+        return (__mmask16)((1u << n) - 1u);
+    }
+
+
+    template <bool ALIGNED>
+    SPAN_TARGET_256
+    static inline f256 load_256(f32* p)
+    {
+        if constexpr (ALIGNED)
+        {
+            return _mm256_load_ps(p);
+        }
+        else
+        {
+            return _mm256_loadu_ps(p);
+        }
+    }
+
+
+    template <bool ALIGNED>
+    SPAN_TARGET_256
+    static inline void store_256(f32* p, f256 v)
+    {
+        if constexpr (ALIGNED)
+        {
+            _mm256_store_ps(p, v);
+        }
+        else
+        {
+            _mm256_storeu_ps(p, v);
+        }
+    }
+
+
+    template <bool ALIGNED>
+    SPAN_TARGET_512
+    static inline f512 load_512(f32* p)
+    {
+        if constexpr (ALIGNED)
+        {
+            return _mm512_load_ps(p);
+        }
+        else
+        {
+            return _mm512_loadu_ps(p);
+        }
+    }
+
+
+    template <bool ALIGNED>
+    SPAN_TARGET_512
+    static inline void store_512(f32* p, f512 v)
+    {
+        if constexpr (ALIGNED)
+        {
+            _mm512_store_ps(p, v);
+        }
+        else
+        {
+            _mm512_storeu_ps(p, v);
+        }
+    }
 
-        #else
 
-        sub_128(a, b, dst, len);
+    SPAN_TARGET_256
+    static inline f32 hsum_256(f256 v)
+    {
+        f128 lo = _mm256_castps256_ps128(v);
+        f128 hi = _mm256_extractf128_ps(v, 1);
+
+        lo = _mm_add_ps(lo, hi);
+        lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+        lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
 
-        #endif
+        return _mm_cvtss_f32(lo);
     }
+
+#endif
 }
 
 
@@ -650,10 +901,10 @@ namespace span
 
 namespace span
 {
-    static f32 dot_32(f32* a, f32* b, u32 len)
+    static f32 dot_32(f32* a, f32* b, u64 len)
     {
         f32 res = 0.0f;
-        for (u32 i = 0; i < len; i++)
+        for (u64 i = 0; i < len; i++)
         {
             res += a[i] * b[i];
         }
@@ -662,272 +913,2325 @@ namespace span
     }
 
 
-    static f32 dot_128(f32* a, f32* b, u32 len)
-    {
-        #ifdef SPAN_SIMD_128
+#ifdef SPAN_X86
 
+    SPAN_TARGET_128
+    static f32 dot_128(f32* a, f32* b, u64 len)
+    {
         constexpr u32 N = 4;
-        u32 L = len - (len % N);
+        constexpr u32 U = 4 * N;
 
-        f128 vsum = _mm_setzero_ps();
-        alignas(N * sizeof(f32)) f32 res[N];
+        // independent sums so the adds do not wait on each other
+        f128 s0 = _mm_setzero_ps();
+        f128 s1 = _mm_setzero_ps();
+        f128 s2 = _mm_setzero_ps();
+        f128 s3 = _mm_setzero_ps();
 
-        u32 i = 0;
-        for (i = 0; i < L; i += N)
+        u64 i = 0;
+        for (; i + U <= len; i += U)
         {
-            f128 va = _mm_loadu_ps(a + i);
-            f128 vb = _mm_loadu_ps(b + i);
-            f128 vm = _mm_mul_ps(va, vb);
-            vsum = _mm_add_ps(vsum, vm);
+            s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + N), _mm_loadu_ps(b + i + N)));
+            s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a + i + 2 * N), _mm_loadu_ps(b + i + 2 * N)));
+            s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a + i + 3 * N), _mm_loadu_ps(b + i + 3 * N)));
         }
 
-        _mm_storeu_ps(res, vsum);
-        f32 sum = res[0] + res[1] + res[2] + res[3];
-
-        sum += dot_32(a + i, b + i, len - i);
+        for (; i + N <= len; i += N)
+        {
+            s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
 
-        return sum;
+        f128 vsum = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+        vsum = _mm_add_ps(vsum, _mm_movehl_ps(vsum, vsum));
+        vsum = _mm_add_ss(vsum, _mm_shuffle_ps(vsum, vsum, 1));
 
-        #else
+        f32 sum = _mm_cvtss_f32(vsum);
 
-        return dot_32(a, b, len);
+        sum += dot_32(a + i, b + i, len - i);
 
-        #endif
+        return sum;
     }
 
 
-    static f32 dot_256(f32* a, f32* b, u32 len)
+    template <bool ALIGNED>
+    SPAN_TARGET_256
+    static f32 dot_256_t(f32* a, f32* b, u64 len)
     {
-        #ifdef SPAN_SIMD_256
-        
         constexpr u32 N = 8;
-        u32 L = len - (len % N);
+        constexpr u32 U = 4 * N;
 
-        f256 vsum = _mm256_setzero_ps();
-        alignas(N * sizeof(f32)) f32 res[N];
+        // fma latency is 4-5 cycles at 2 per cycle, one accumulator leaves most of it idle
+        f256 s0 = _mm256_setzero_ps();
+        f256 s1 = _mm256_setzero_ps();
+        f256 s2 = _mm256_setzero_ps();
+        f256 s3 = _mm256_setzero_ps();
 
-        u32 i = 0;
-        for (i = 0; i < L; i += N)
+        u64 i = 0;
+        for (; i + U <= len; i += U)
         {
-            f256 va = _mm256_loadu_ps(a + i);
-            f256 vb = _mm256_loadu_ps(b + i);
-            f256 vm = _mm256_mul_ps(va, vb);
-            vsum = _mm256_add_ps(vsum, vm);
+            s0 = _mm256_fmadd_ps(load_256<ALIGNED>(a + i), load_256<ALIGNED>(b + i), s0);
+            s1 = _mm256_fmadd_ps(load_256<ALIGNED>(a + i + N), load_256<ALIGNED>(b + i + N), s1);
+            s2 = _mm256_fmadd_ps(load_256<ALIGNED>(a + i + 2 * N), load_256<ALIGNED>(b + i + 2 * N), s2);
+            s3 = _mm256_fmadd_ps(load_256<ALIGNED>(a + i + 3 * N), load_256<ALIGNED>(b + i + 3 * N), s3);
         }
 
-        _mm256_storeu_ps(res, vsum);
-        f32 sum = res[0] + res[1] + res[2] + res[3] +
-            res[4] + res[5] + res[6] + res[7];
+        for (; i + N <= len; i += N)
+        {
+            s0 = _mm256_fmadd_ps(load_256<ALIGNED>(a + i), load_256<ALIGNED>(b + i), s0);
+        }
 
-        sum += dot_32(a + i, b + i, len - i);
+        if (i < len)
+        {
+            auto mask = tail_mask_256(len - i);
+            s1 = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, mask), _mm256_maskload_ps(b + i, mask), s1);
+        }
 
-        return sum;
+        return hsum_256(_mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+    }
 
-        #else
 
-        return dot_128(a, b, len);
+    SPAN_TARGET_256
+    static f32 dot_256(f32* a, f32* b, u64 len)
+    {
+        if (is_aligned(a, b, size256))
+        {
+            return dot_256_t<true>(a, b, len);
+        }
 
-        #endif
+        return dot_256_t<false>(a, b, len);
     }
-}
-
 
-/* api */
 
-namespace span
-{
-    void copy_u8(u8* src, u8* dst, u64 len_u8)
+    template <bool ALIGNED>
+    SPAN_TARGET_512
+    static f32 dot_512_t(f32* a, f32* b, u64 len)
     {
-        auto const n_64 = len_u8 / 8;
+        constexpr u32 N = 16;
+        constexpr u32 U = 4 * N;
 
-        switch (n_64)
+        f512 s0 = _mm512_setzero_ps();
+        f512 s1 = _mm512_setzero_ps();
+        f512 s2 = _mm512_setzero_ps();
+        f512 s3 = _mm512_setzero_ps();
+
+        u64 i = 0;
+        for (; i + U <= len; i += U)
         {
-        case 0:
-        case 1:
-            copy_u8_64(src, dst, len_u8);
-            break;
-        case 2:
-        case 3:
-            copy_u8_128(src, dst, len_u8);
-            break;
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            copy_u8_256(src, dst, len_u8);
-            break;
-        case 8:
-        case 9:
-        case 10:
-        case 11:
-        case 12:
-        case 13:
-        case 14:
-        case 15:
-            copy_u8_512(src, dst, len_u8);
-            break;
-        default:
-            copy_u8_1024(src, dst, len_u8);
+            s0 = _mm512_fmadd_ps(load_512<ALIGNED>(a + i), load_512<ALIGNED>(b + i), s0);
+            s1 = _mm512_fmadd_ps(load_512<ALIGNED>(a + i + N), load_512<ALIGNED>(b + i + N), s1);
+            s2 = _mm512_fmadd_ps(load_512<ALIGNED>(a + i + 2 * N), load_512<ALIGNED>(b + i + 2 * N), s2);
+            s3 = _mm512_fmadd_ps(load_512<ALIGNED>(a + i + 3 * N), load_512<ALIGNED>(b + i + 3 * N), s3);
         }
-    }
-
 
-    void fill_u8(u8* dst, u8 value, u64 len_u8)
-    {
-        auto const n_64 = len_u8 / 8;
+        for (; i + N <= len; i += N)
+        {
+            s0 = _mm512_fmadd_ps(load_512<ALIGNED>(a + i), load_512<ALIGNED>(b + i), s0);
+        }
 
-        switch (n_64)
+        if (i < len)
         {
-        case 0:
-        case 1:
-            fill_u8_8(dst, value, len_u8);
-            break;
-        case 2:
-        case 3:
-            fill_u8_128(dst, value, len_u8);
-            break;
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            fill_u8_256(dst, value, len_u8);
-            break;
-        case 8:
-        case 9:
-        case 10:
-        case 11:
-        case 12:
-        case 13:
-        case 14:
-        case 15:
-            fill_u8_512(dst, value, len_u8);
-            break;
-        default:
-            fill_u8_1024(dst, value, len_u8);
+            auto mask = tail_mask_512(len - i);
+            s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), s1);
         }
+
+        f512 vsum = _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3));
+
+        alignas(64) f32 res[N];
+        _mm512_store_ps(res, vsum);
+
+        return hsum_256(_mm256_add_ps(_mm256_load_ps(res), _mm256_load_ps(res + 8)));
     }
 
 
-    void fill_u32(u32* dst, u32 value, u64 len_u32)
+    SPAN_TARGET_512
+    static f32 dot_512(f32* a, f32* b, u64 len)
     {
-        auto const n_64 = len_u32 / 2;
-
-        switch (n_64)
+        if (is_aligned(a, b, size512))
         {
-        case 0:
-        case 1:
-            fill_u32_32(dst, value, len_u32);
-            break;
-        case 2:
-        case 3:
-            fill_u32_128(dst, value, len_u32);
-            break;
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            fill_u32_256(dst, value, len_u32);
-            break;
-        case 8:
-        case 9:
-        case 10:
-        case 11:
-        case 12:
-        case 13:
-        case 14:
-        case 15:
-            fill_u32_512(dst, value, len_u32);
-            break;
-        default:
-            fill_u32_1024(dst, value, len_u32);
+            return dot_512_t<true>(a, b, len);
         }
+
+        return dot_512_t<false>(a, b, len);
     }
+
+#endif
 }
 
 
+/* axpy */
+
 namespace span
 {
-    void add(SpanView<f32> const& a, SpanView<f32> const& b, SpanView<f32> const& dst)
+    static void axpy_32(f32 alpha, f32* x, f32* y, u64 len)
     {
-        auto len = a.length;
+        for (u64 i = 0; i < len; i++)
+        {
+            y[i] += alpha * x[i];
+        }
+    }
 
-        assert(b.length == len);
-        assert(dst.length == len);
 
-        switch (len)
-        {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-            add_32(a.data, b.data, dst.data, len);
-            break;
+#ifdef SPAN_X86
 
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            add_128(a.data, b.data, dst.data, len);
-            break;
+    SPAN_TARGET_128
+    static void axpy_128(f32 alpha, f32* x, f32* y, u64 len)
+    {
+        constexpr u32 N = 4;
+        u64 L = len - (len % N);
 
-        default: 
-            add_256(a.data, b.data, dst.data, len);
-            break;
+        f128 va = _mm_set1_ps(alpha);
+
+        u64 i = 0;
+        for (i = 0; i < L; i += N)
+        {
+            f128 vx = _mm_loadu_ps(x + i);
+            f128 vy = _mm_loadu_ps(y + i);
+
+            _mm_storeu_ps(y + i, _mm_add_ps(vy, _mm_mul_ps(va, vx)));
         }
+
+        axpy_32(alpha, x + i, y + i, len - i);
     }
-    
 
-    void sub(SpanView<f32> const& a, SpanView<f32> const& b, SpanView<f32> const& dst)
+
+    template <bool ALIGNED>
+    SPAN_TARGET_256
+    static void axpy_256_t(f32 alpha, f32* x, f32* y, u64 len)
     {
-        auto len = a.length;
+        constexpr u32 N = 8;
+        constexpr u32 U = 4 * N;
 
-        assert(b.length == len);
-        assert(dst.length == len);
+        f256 va = _mm256_set1_ps(alpha);
 
-        switch (len)
+        u64 i = 0;
+        for (; i + U <= len; i += U)
         {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-            sub_32(a.data, b.data, dst.data, len);
-            break;
+            f256 y0 = _mm256_fmadd_ps(va, load_256<ALIGNED>(x + i), load_256<ALIGNED>(y + i));
+            f256 y1 = _mm256_fmadd_ps(va, load_256<ALIGNED>(x + i + N), load_256<ALIGNED>(y + i + N));
+            f256 y2 = _mm256_fmadd_ps(va, load_256<ALIGNED>(x + i + 2 * N), load_256<ALIGNED>(y + i + 2 * N));
+            f256 y3 = _mm256_fmadd_ps(va, load_256<ALIGNED>(x + i + 3 * N), load_256<ALIGNED>(y + i + 3 * N));
+
+            store_256<ALIGNED>(y + i, y0);
+            store_256<ALIGNED>(y + i + N, y1);
+            store_256<ALIGNED>(y + i + 2 * N, y2);
+            store_256<ALIGNED>(y + i + 3 * N, y3);
+        }
 
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            sub_128(a.data, b.data, dst.data, len);
-            break;
+        for (; i + N <= len; i += N)
+        {
+            store_256<ALIGNED>(y + i, _mm256_fmadd_ps(va, load_256<ALIGNED>(x + i), load_256<ALIGNED>(y + i)));
+        }
 
-        default: 
-            sub_256(a.data, b.data, dst.data, len);
-            break;
+        if (i < len)
+        {
+            auto mask = tail_mask_256(len - i);
+            f256 vy = _mm256_fmadd_ps(va, _mm256_maskload_ps(x + i, mask), _mm256_maskload_ps(y + i, mask));
+            _mm256_maskstore_ps(y + i, mask, vy);
         }
     }
-    
 
-    f32 dot(SpanView<f32> const& a, SpanView<f32> const& b)
+
+    SPAN_TARGET_256
+    static void axpy_256(f32 alpha, f32* x, f32* y, u64 len)
+    {
+        if (is_aligned(x, y, size256))
+        {
+            axpy_256_t<true>(alpha, x, y, len);
+            return;
+        }
+
+        axpy_256_t<false>(alpha, x, y, len);
+    }
+
+
+    template <bool ALIGNED>
+    SPAN_TARGET_512
+    static void axpy_512_t(f32 alpha, f32* x, f32* y, u64 len)
+    {
+        constexpr u32 N = 16;
+        constexpr u32 U = 4 * N;
+
+        f512 va = _mm512_set1_ps(alpha);
+
+        u64 i = 0;
+        for (; i + U <= len; i += U)
+        {
+            f512 y0 = _mm512_fmadd_ps(va, load_512<ALIGNED>(x + i), load_512<ALIGNED>(y + i));
+            f512 y1 = _mm512_fmadd_ps(va, load_512<ALIGNED>(x + i + N), load_512<ALIGNED>(y + i + N));
+            f512 y2 = _mm512_fmadd_ps(va, load_512<ALIGNED>(x + i + 2 * N), load_512<ALIGNED>(y + i + 2 * N));
+            f512 y3 = _mm512_fmadd_ps(va, load_512<ALIGNED>(x + i + 3 * N), load_512<ALIGNED>(y + i + 3 * N));
+
+            store_512<ALIGNED>(y + i, y0);
+            store_512<ALIGNED>(y + i + N, y1);
+            store_512<ALIGNED>(y + i + 2 * N, y2);
+            store_512<ALIGNED>(y + i + 3 * N, y3);
+        }
+
+        for (; i + N <= len; i += N)
+        {
+            store_512<ALIGNED>(y + i, _mm512_fmadd_ps(va, load_512<ALIGNED>(x + i), load_512<ALIGNED>(y + i)));
+        }
+
+        if (i < len)
+        {
+            auto mask = tail_mask_512(len - i);
+            f512 vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+            _mm512_mask_storeu_ps(y + i, mask, vy);
+        }
+    }
+
+
+    SPAN_TARGET_512
+    static void axpy_512(f32 alpha, f32* x, f32* y, u64 len)
+    {
+        if (is_aligned(x, y, size512))
+        {
+            axpy_512_t<true>(alpha, x, y, len);
+            return;
+        }
+
+        axpy_512_t<false>(alpha, x, y, len);
+    }
+
+#endif
+}
+
+
+/* gemv_t_ger */
+
+namespace span
+{
+    // y += xi * row, row += s * z
+    static void row_gemv_t_ger_32(f32* row, f32 xi, f32 s, f32* y, f32* z, u32 len)
+    {
+        for (u32 i = 0; i < len; i++)
+        {
+            y[i] += xi * row[i];
+            row[i] += s * z[i];
+        }
+    }
+
+
+#ifdef SPAN_X86
+
+    SPAN_TARGET_256
+    static void row_gemv_t_ger_256(f32* row, f32 xi, f32 s, f32* y, f32* z, u32 len)
+    {
+        constexpr u32 N = 8;
+        u32 L = len - (len % N);
+
+        f256 vx = _mm256_set1_ps(xi);
+        f256 vs = _mm256_set1_ps(s);
+
+        u32 i = 0;
+        for (i = 0; i < L; i += N)
+        {
+            f256 vr = _mm256_loadu_ps(row + i);
+
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(vx, vr, _mm256_loadu_ps(y + i)));
+            _mm256_storeu_ps(row + i, _mm256_fmadd_ps(vs, _mm256_loadu_ps(z + i), vr));
+        }
+
+        row_gemv_t_ger_32(row + i, xi, s, y + i, z + i, len - i);
+    }
+
+
+    SPAN_TARGET_512
+    static void row_gemv_t_ger_512(f32* row, f32 xi, f32 s, f32* y, f32* z, u32 len)
+    {
+        constexpr u32 N = 16;
+        u32 L = len - (len % N);
+
+        f512 vx = _mm512_set1_ps(xi);
+        f512 vs = _mm512_set1_ps(s);
+
+        u32 i = 0;
+        for (i = 0; i < L; i += N)
+        {
+            f512 vr = _mm512_loadu_ps(row + i);
+
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(vx, vr, _mm512_loadu_ps(y + i)));
+            _mm512_storeu_ps(row + i, _mm512_fmadd_ps(vs, _mm512_loadu_ps(z + i), vr));
+        }
+
+        row_gemv_t_ger_256(row + i, xi, s, y + i, z + i, len - i);
+    }
+
+#endif
+}
+
+
+/* gemv_bias_relu */
+
+namespace span
+{
+    // y = max(A * x + bias, 0) for a rows x width block of A
+    static void gemv_bias_relu_32(f32* a, u32 width, u32 rows, f32* x, f32* bias, f32* y)
+    {
+        for (u32 r = 0; r < rows; r++)
+        {
+            auto sum = dot_32(a, x, width) + bias[r];
+
+            y[r] = sum < 0.0f ? 0.0f : sum;
+
+            a += width;
+        }
+    }
+
+
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
+    static void gemv_bias_relu_128(f32* a, u32 width, u32 rows, f32* x, f32* bias, f32* y)
+    {
+        constexpr u32 N = 4;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            f128 s0 = _mm_setzero_ps();
+            f128 s1 = _mm_setzero_ps();
+            f128 s2 = _mm_setzero_ps();
+            f128 s3 = _mm_setzero_ps();
+
+            u32 i = 0;
+            for (; i + N <= width; i += N)
+            {
+                // each input lane is loaded once for all rows
+                f128 vx = _mm_loadu_ps(x + i);
+
+                s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a0 + i), vx));
+                s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a1 + i), vx));
+                s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a2 + i), vx));
+                s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a3 + i), vx));
+            }
+
+            // [sum0, sum1, sum2, sum3]
+            f128 vsum = _mm_hadd_ps(_mm_hadd_ps(s0, s1), _mm_hadd_ps(s2, s3));
+
+            if (i < width)
+            {
+                auto n = width - i;
+                alignas(16) f32 tail[R] = {
+                    dot_32(a0 + i, x + i, n),
+                    dot_32(a1 + i, x + i, n),
+                    dot_32(a2 + i, x + i, n),
+                    dot_32(a3 + i, x + i, n)
+                };
+
+                vsum = _mm_add_ps(vsum, _mm_load_ps(tail));
+            }
+
+            vsum = _mm_add_ps(vsum, _mm_loadu_ps(bias + r));
+            _mm_storeu_ps(y + r, _mm_max_ps(vsum, _mm_setzero_ps()));
+
+            a += R * width;
+        }
+
+        gemv_bias_relu_32(a, width, rows - r, x, bias + r, y + r);
+    }
+
+
+    SPAN_TARGET_256
+    static void gemv_bias_relu_256(f32* a, u32 width, u32 rows, f32* x, f32* bias, f32* y)
+    {
+        constexpr u32 N = 8;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            // two accumulators per row, 8 independent fma chains
+            f256 s00 = _mm256_setzero_ps(); f256 s01 = _mm256_setzero_ps();
+            f256 s10 = _mm256_setzero_ps(); f256 s11 = _mm256_setzero_ps();
+            f256 s20 = _mm256_setzero_ps(); f256 s21 = _mm256_setzero_ps();
+            f256 s30 = _mm256_setzero_ps(); f256 s31 = _mm256_setzero_ps();
+
+            u32 i = 0;
+            for (; i + 2 * N <= width; i += 2 * N)
+            {
+                f256 x0 = _mm256_loadu_ps(x + i);
+                f256 x1 = _mm256_loadu_ps(x + i + N);
+
+                s00 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + i), x0, s00);
+                s10 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + i), x0, s10);
+                s20 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + i), x0, s20);
+                s30 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + i), x0, s30);
+
+                s01 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + i + N), x1, s01);
+                s11 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + i + N), x1, s11);
+                s21 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + i + N), x1, s21);
+                s31 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + i + N), x1, s31);
+            }
+
+            for (; i + N <= width; i += N)
+            {
+                f256 x0 = _mm256_loadu_ps(x + i);
+
+                s00 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + i), x0, s00);
+                s10 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + i), x0, s10);
+                s20 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + i), x0, s20);
+                s30 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + i), x0, s30);
+            }
+
+            if (i < width)
+            {
+                auto mask = tail_mask_256(width - i);
+                f256 x0 = _mm256_maskload_ps(x + i, mask);
+
+                s01 = _mm256_fmadd_ps(_mm256_maskload_ps(a0 + i, mask), x0, s01);
+                s11 = _mm256_fmadd_ps(_mm256_maskload_ps(a1 + i, mask), x0, s11);
+                s21 = _mm256_fmadd_ps(_mm256_maskload_ps(a2 + i, mask), x0, s21);
+                s31 = _mm256_fmadd_ps(_mm256_maskload_ps(a3 + i, mask), x0, s31);
+            }
+
+            f256 s0 = _mm256_add_ps(s00, s01);
+            f256 s1 = _mm256_add_ps(s10, s11);
+            f256 s2 = _mm256_add_ps(s20, s21);
+            f256 s3 = _mm256_add_ps(s30, s31);
+
+            // [s0 lo, s1 lo, s2 lo, s3 lo, s0 hi, s1 hi, s2 hi, s3 hi]
+            f256 h = _mm256_hadd_ps(_mm256_hadd_ps(s0, s1), _mm256_hadd_ps(s2, s3));
+
+            f128 vsum = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+
+            vsum = _mm_add_ps(vsum, _mm_loadu_ps(bias + r));
+            _mm_storeu_ps(y + r, _mm_max_ps(vsum, _mm_setzero_ps()));
+
+            a += R * width;
+        }
+
+        for (; r < rows; r++)
+        {
+            auto sum = dot_256(a, x, width) + bias[r];
+
+            y[r] = sum < 0.0f ? 0.0f : sum;
+
+            a += width;
+        }
+    }
+
+#endif
+}
+
+
+/* half */
+
+namespace span
+{
+    // round to nearest even, overflow to inf
+    static u16 f32_to_f16(f32 value)
+    {
+        constexpr u32 F32_INF = 255u << 23;
+        constexpr u32 F16_OVERFLOW = (127u + 16) << 23;
+
+        // adding it to a value below 2^-14 leaves the f16 subnormal in the low mantissa bits
+        constexpr u32 SUBNORMAL_MAGIC = ((127u - 15) + (23 - 10) + 1) << 23;
+
+        auto f = std::bit_cast<u32>(value);
+        auto sign = f & 0x80000000u;
+        f ^= sign;
+
+        u16 h = 0;
+
+        if (f >= F16_OVERFLOW)
+        {
+            h = f > F32_INF ? 0x7e00 : 0x7c00;
+        }
+        else if (f < (113u << 23))
+        {
+            auto v = std::bit_cast<f32>(f) + std::bit_cast<f32>(SUBNORMAL_MAGIC);
+            h = (u16)(std::bit_cast<u32>(v) - SUBNORMAL_MAGIC);
+        }
+        else
+        {
+            auto mantissa_odd = (f >> 13) & 1;
+
+            // rebias the exponent and round
+            f += ((u32)(15 - 127) << 23) + 0xfff + mantissa_odd;
+            h = (u16)(f >> 13);
+        }
+
+        return h | (u16)(sign >> 16);
+    }
+
+
+    static f32 f16_to_f32(u16 h)
+    {
+        constexpr u32 EXP_MASK = 0x7c00u << 13;
+
+        u32 f = (h & 0x7fffu) << 13;
+        auto exp = f & EXP_MASK;
+
+        f += (127u - 15) << 23;
+
+        if (exp == EXP_MASK)
+        {
+            // inf, nan
+            f += (128u - 16) << 23;
+        }
+        else if (exp == 0)
+        {
+            // zero, subnormal
+            f += 1u << 23;
+            f = std::bit_cast<u32>(std::bit_cast<f32>(f) - std::bit_cast<f32>(113u << 23));
+        }
+
+        return std::bit_cast<f32>(f | ((u32)(h & 0x8000u) << 16));
+    }
+
+
+    // round to nearest even, nan stays nan
+    static u16 f32_to_bf16(f32 value)
+    {
+        auto f = std::bit_cast<u32>(value);
+
+        if ((f & 0x7fffffffu) > 0x7f800000u)
+        {
+            return (u16)((f >> 16) | 0x40);
+        }
+
+        return (u16)((f + 0x7fffu + ((f >> 16) & 1)) >> 16);
+    }
+
+
+    static f32 bf16_to_f32(u16 h)
+    {
+        return std::bit_cast<f32>((u32)h << 16);
+    }
+
+
+    template <HalfFormat F>
+    static inline f32 half_to_f32(u16 h)
+    {
+        if constexpr (F == HalfFormat::F16)
+        {
+            return f16_to_f32(h);
+        }
+        else
+        {
+            return bf16_to_f32(h);
+        }
+    }
+
+
+    template <HalfFormat F>
+    static f32 dot_half_32(u16* a, f32* x, u32 width)
+    {
+        f32 sum = 0.0f;
+        for (u32 i = 0; i < width; i++)
+        {
+            sum += half_to_f32<F>(a[i]) * x[i];
+        }
+
+        return sum;
+    }
+
+
+    // y = max(A * x + bias, 0) for a rows x width block of half precision A
+    template <HalfFormat F>
+    static void gemv_half_bias_relu_32(u16* a, u32 width, u32 rows, f32* x, f32* bias, f32* y)
+    {
+        for (u32 r = 0; r < rows; r++)
+        {
+            auto sum = dot_half_32<F>(a, x, width) + bias[r];
+
+            y[r] = sum < 0.0f ? 0.0f : sum;
+
+            a += width;
+        }
+    }
+
+
+#ifdef SPAN_X86
+
+    // 8 weights widened to f32, bf16 only needs the shift
+    template <HalfFormat F>
+    SPAN_TARGET_F16C
+    static inline f256 load_half_256(u16* a)
+    {
+        i128 h = _mm_loadu_si128((i128*)a);
+
+        if constexpr (F == HalfFormat::F16)
+        {
+            return _mm256_cvtph_ps(h);
+        }
+        else
+        {
+            return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+        }
+    }
+
+
+    // same order of operations as gemv_bias_relu_256, half the bytes of A per row
+    template <HalfFormat F>
+    SPAN_TARGET_F16C
+    static void gemv_half_bias_relu_256(u16* a, u32 width, u32 rows, f32* x, f32* bias, f32* y)
+    {
+        constexpr u32 N = 8;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            f256 s00 = _mm256_setzero_ps(); f256 s01 = _mm256_setzero_ps();
+            f256 s10 = _mm256_setzero_ps(); f256 s11 = _mm256_setzero_ps();
+            f256 s20 = _mm256_setzero_ps(); f256 s21 = _mm256_setzero_ps();
+            f256 s30 = _mm256_setzero_ps(); f256 s31 = _mm256_setzero_ps();
+
+            u32 i = 0;
+            for (; i + 2 * N <= width; i += 2 * N)
+            {
+                f256 x0 = _mm256_loadu_ps(x + i);
+                f256 x1 = _mm256_loadu_ps(x + i + N);
+
+                s00 = _mm256_fmadd_ps(load_half_256<F>(a0 + i), x0, s00);
+                s10 = _mm256_fmadd_ps(load_half_256<F>(a1 + i), x0, s10);
+                s20 = _mm256_fmadd_ps(load_half_256<F>(a2 + i), x0, s20);
+                s30 = _mm256_fmadd_ps(load_half_256<F>(a3 + i), x0, s30);
+
+                s01 = _mm256_fmadd_ps(load_half_256<F>(a0 + i + N), x1, s01);
+                s11 = _mm256_fmadd_ps(load_half_256<F>(a1 + i + N), x1, s11);
+                s21 = _mm256_fmadd_ps(load_half_256<F>(a2 + i + N), x1, s21);
+                s31 = _mm256_fmadd_ps(load_half_256<F>(a3 + i + N), x1, s31);
+            }
+
+            for (; i + N <= width; i += N)
+            {
+                f256 x0 = _mm256_loadu_ps(x + i);
+
+                s00 = _mm256_fmadd_ps(load_half_256<F>(a0 + i), x0, s00);
+                s10 = _mm256_fmadd_ps(load_half_256<F>(a1 + i), x0, s10);
+                s20 = _mm256_fmadd_ps(load_half_256<F>(a2 + i), x0, s20);
+                s30 = _mm256_fmadd_ps(load_half_256<F>(a3 + i), x0, s30);
+            }
+
+            f256 s0 = _mm256_add_ps(s00, s01);
+            f256 s1 = _mm256_add_ps(s10, s11);
+            f256 s2 = _mm256_add_ps(s20, s21);
+            f256 s3 = _mm256_add_ps(s30, s31);
+
+            // [s0 lo, s1 lo, s2 lo, s3 lo, s0 hi, s1 hi, s2 hi, s3 hi]
+            f256 h = _mm256_hadd_ps(_mm256_hadd_ps(s0, s1), _mm256_hadd_ps(s2, s3));
+
+            f128 vsum = _mm_add_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+
+            if (i < width)
+            {
+                auto n = width - i;
+                alignas(16) f32 tail[R] = {
+                    dot_half_32<F>(a0 + i, x + i, n),
+                    dot_half_32<F>(a1 + i, x + i, n),
+                    dot_half_32<F>(a2 + i, x + i, n),
+                    dot_half_32<F>(a3 + i, x + i, n)
+                };
+
+                vsum = _mm_add_ps(vsum, _mm_load_ps(tail));
+            }
+
+            vsum = _mm_add_ps(vsum, _mm_loadu_ps(bias + r));
+            _mm_storeu_ps(y + r, _mm_max_ps(vsum, _mm_setzero_ps()));
+
+            a += R * width;
+        }
+
+        for (; r < rows; r++)
+        {
+            f256 s0 = _mm256_setzero_ps();
+
+            u32 i = 0;
+            for (; i + N <= width; i += N)
+            {
+                s0 = _mm256_fmadd_ps(load_half_256<F>(a + i), _mm256_loadu_ps(x + i), s0);
+            }
+
+            f128 s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+            s = _mm_hadd_ps(s, s);
+            s = _mm_hadd_ps(s, s);
+
+            auto sum = _mm_cvtss_f32(s) + dot_half_32<F>(a + i, x + i, width - i) + bias[r];
+
+            y[r] = sum < 0.0f ? 0.0f : sum;
+
+            a += width;
+        }
+    }
+
+#endif
+}
+
+
+/* gemv_i8 */
+
+namespace span
+{
+    // y = A * x for a rows x width block of A, x is u8 and A is i8
+    static i32 dot_i8_8(i8* a, u8* x, u32 width)
+    {
+        i32 sum = 0;
+        for (u32 i = 0; i < width; i++)
+        {
+            sum += (i32)a[i] * (i32)x[i];
+        }
+
+        return sum;
+    }
+
+
+    static void gemv_i8_8(i8* a, u32 width, u32 rows, u8* x, i32* y)
+    {
+        for (u32 r = 0; r < rows; r++)
+        {
+            y[r] = dot_i8_8(a, x, width);
+            a += width;
+        }
+    }
+
+
+#ifdef SPAN_X86
+
+    // u8 * i8 pairs summed to i16 then i32
+    // x <= 127 and |a| <= 127 keep the i16 pair sums from saturating
+    SPAN_TARGET_128
+    static inline i128 dot_i8_step_128(i128 vx, i8* a, i128 sum)
+    {
+        i128 p = _mm_maddubs_epi16(vx, _mm_loadu_si128((i128*)a));
+
+        return _mm_add_epi32(sum, _mm_madd_epi16(p, _mm_set1_epi16(1)));
+    }
+
+
+    SPAN_TARGET_128
+    static void gemv_i8_128(i8* a, u32 width, u32 rows, u8* x, i32* y)
+    {
+        constexpr u32 N = 16;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            i128 s0 = _mm_setzero_si128();
+            i128 s1 = _mm_setzero_si128();
+            i128 s2 = _mm_setzero_si128();
+            i128 s3 = _mm_setzero_si128();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                i128 vx = _mm_loadu_si128((i128*)(x + i));
+
+                s0 = dot_i8_step_128(vx, a0 + i, s0);
+                s1 = dot_i8_step_128(vx, a1 + i, s1);
+                s2 = dot_i8_step_128(vx, a2 + i, s2);
+                s3 = dot_i8_step_128(vx, a3 + i, s3);
+            }
+
+            // [sum0, sum1, sum2, sum3]
+            i128 vsum = _mm_hadd_epi32(_mm_hadd_epi32(s0, s1), _mm_hadd_epi32(s2, s3));
+            _mm_storeu_si128((i128*)(y + r), vsum);
+
+            a += R * width;
+        }
+
+        for (; r < rows; r++)
+        {
+            i128 s0 = _mm_setzero_si128();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                s0 = dot_i8_step_128(_mm_loadu_si128((i128*)(x + i)), a + i, s0);
+            }
+
+            s0 = _mm_hadd_epi32(s0, s0);
+            s0 = _mm_hadd_epi32(s0, s0);
+            y[r] = _mm_cvtsi128_si32(s0);
+
+            a += width;
+        }
+    }
+
+
+    SPAN_TARGET_256
+    static inline i256 dot_i8_step_256(i256 vx, i8* a, i256 sum)
+    {
+        i256 p = _mm256_maddubs_epi16(vx, _mm256_loadu_si256((i256*)a));
+
+        return _mm256_add_epi32(sum, _mm256_madd_epi16(p, _mm256_set1_epi16(1)));
+    }
+
+
+    SPAN_TARGET_256
+    static void gemv_i8_256(i8* a, u32 width, u32 rows, u8* x, i32* y)
+    {
+        constexpr u32 N = 32;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            i256 s0 = _mm256_setzero_si256();
+            i256 s1 = _mm256_setzero_si256();
+            i256 s2 = _mm256_setzero_si256();
+            i256 s3 = _mm256_setzero_si256();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                i256 vx = _mm256_loadu_si256((i256*)(x + i));
+
+                s0 = dot_i8_step_256(vx, a0 + i, s0);
+                s1 = dot_i8_step_256(vx, a1 + i, s1);
+                s2 = dot_i8_step_256(vx, a2 + i, s2);
+                s3 = dot_i8_step_256(vx, a3 + i, s3);
+            }
+
+            // [s0 lo, s1 lo, s2 lo, s3 lo, s0 hi, s1 hi, s2 hi, s3 hi]
+            i256 h = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1), _mm256_hadd_epi32(s2, s3));
+
+            i128 vsum = _mm_add_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+            _mm_storeu_si128((i128*)(y + r), vsum);
+
+            a += R * width;
+        }
+
+        for (; r < rows; r++)
+        {
+            i256 s0 = _mm256_setzero_si256();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                s0 = dot_i8_step_256(_mm256_loadu_si256((i256*)(x + i)), a + i, s0);
+            }
+
+            i128 s = _mm_add_epi32(_mm256_castsi256_si128(s0), _mm256_extracti128_si256(s0, 1));
+            s = _mm_hadd_epi32(s, s);
+            s = _mm_hadd_epi32(s, s);
+            y[r] = _mm_cvtsi128_si32(s);
+
+            a += width;
+        }
+    }
+
+
+    // vpdpbusd, 4 u8 * i8 products summed straight into i32, nothing saturates
+    SPAN_TARGET_VNNI
+    static void gemv_i8_vnni(i8* a, u32 width, u32 rows, u8* x, i32* y)
+    {
+        constexpr u32 N = 64;
+        constexpr u32 R = 4;
+
+        u32 r = 0;
+        for (; r + R <= rows; r += R)
+        {
+            auto a0 = a;
+            auto a1 = a0 + width;
+            auto a2 = a1 + width;
+            auto a3 = a2 + width;
+
+            i512 s0 = _mm512_setzero_si512();
+            i512 s1 = _mm512_setzero_si512();
+            i512 s2 = _mm512_setzero_si512();
+            i512 s3 = _mm512_setzero_si512();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                i512 vx = _mm512_loadu_si512((void*)(x + i));
+
+                s0 = _mm512_dpbusd_epi32(s0, vx, _mm512_loadu_si512((void*)(a0 + i)));
+                s1 = _mm512_dpbusd_epi32(s1, vx, _mm512_loadu_si512((void*)(a1 + i)));
+                s2 = _mm512_dpbusd_epi32(s2, vx, _mm512_loadu_si512((void*)(a2 + i)));
+                s3 = _mm512_dpbusd_epi32(s3, vx, _mm512_loadu_si512((void*)(a3 + i)));
+            }
+
+            y[r] = _mm512_reduce_add_epi32(s0);
+            y[r + 1] = _mm512_reduce_add_epi32(s1);
+            y[r + 2] = _mm512_reduce_add_epi32(s2);
+            y[r + 3] = _mm512_reduce_add_epi32(s3);
+
+            a += R * width;
+        }
+
+        for (; r < rows; r++)
+        {
+            i512 s0 = _mm512_setzero_si512();
+
+            for (u32 i = 0; i < width; i += N)
+            {
+                s0 = _mm512_dpbusd_epi32(s0, _mm512_loadu_si512((void*)(x + i)), _mm512_loadu_si512((void*)(a + i)));
+            }
+
+            y[r] = _mm512_reduce_add_epi32(s0);
+
+            a += width;
+        }
+    }
+
+#endif
+}
+
+
+/* quantize_u7 */
+
+namespace span
+{
+    // q = x / scale rounded and clamped to [0, 127], scale = max(x) / 127
+    // every level rounds with +0.5 and truncation so they all produce the same q
+    static inline u8 quantize_u7_1(f32 x, f32 inv)
+    {
+        auto v = x * inv + 0.5f;
+
+        return (u8)(v < 0.0f ? 0.0f : (v > 127.0f ? 127.0f : v));
+    }
+
+
+    static f32 quantize_u7_8(f32* x, u8* q, u32 len)
+    {
+        f32 x_max = 0.0f;
+        for (u32 i = 0; i < len; i++)
+        {
+            x_max = x[i] > x_max ? x[i] : x_max;
+        }
+
+        auto inv = x_max > 0.0f ? 127.0f / x_max : 0.0f;
+
+        for (u32 i = 0; i < len; i++)
+        {
+            q[i] = quantize_u7_1(x[i], inv);
+        }
+
+        return x_max / 127.0f;
+    }
+
+
+#ifdef SPAN_X86
+
+    SPAN_TARGET_128
+    static inline i128 quantize_u7_step_128(f32* x, f128 inv)
+    {
+        f128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), inv), _mm_set1_ps(0.5f));
+
+        return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(127.0f)));
+    }
+
+
+    SPAN_TARGET_128
+    static f32 quantize_u7_128(f32* x, u8* q, u32 len)
+    {
+        constexpr u32 N = 4;
+
+        u32 i = 0;
+
+        f128 vmax = _mm_setzero_ps();
+        for (; i + N <= len; i += N)
+        {
+            vmax = _mm_max_ps(vmax, _mm_loadu_ps(x + i));
+        }
+
+        vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+        vmax = _mm_max_ss(vmax, _mm_shuffle_ps(vmax, vmax, 1));
+
+        auto x_max = _mm_cvtss_f32(vmax);
+        for (; i < len; i++)
+        {
+            x_max = x[i] > x_max ? x[i] : x_max;
+        }
+
+        auto inv = x_max > 0.0f ? 127.0f / x_max : 0.0f;
+
+        auto vinv = _mm_set1_ps(inv);
+
+        i = 0;
+        for (; i + 4 * N <= len; i += 4 * N)
+        {
+            auto p01 = _mm_packs_epi32(quantize_u7_step_128(x + i, vinv), quantize_u7_step_128(x + i + N, vinv));
+            auto p23 = _mm_packs_epi32(quantize_u7_step_128(x + i + 2 * N, vinv), quantize_u7_step_128(x + i + 3 * N, vinv));
+
+            _mm_storeu_si128((i128*)(q + i), _mm_packus_epi16(p01, p23));
+        }
+
+        for (; i < len; i++)
+        {
+            q[i] = quantize_u7_1(x[i], inv);
+        }
+
+        return x_max / 127.0f;
+    }
+
+
+    SPAN_TARGET_256
+    static inline i256 quantize_u7_step_256(f32* x, f256 inv)
+    {
+        f256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x), inv), _mm256_set1_ps(0.5f));
+
+        return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(127.0f)));
+    }
+
+
+    SPAN_TARGET_256
+    static f32 quantize_u7_256(f32* x, u8* q, u32 len)
+    {
+        constexpr u32 N = 8;
+
+        u32 i = 0;
+
+        f256 vmax = _mm256_setzero_ps();
+        for (; i + N <= len; i += N)
+        {
+            vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+        }
+
+        f128 m = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+
+        auto x_max = _mm_cvtss_f32(m);
+        for (; i < len; i++)
+        {
+            x_max = x[i] > x_max ? x[i] : x_max;
+        }
+
+        auto inv = x_max > 0.0f ? 127.0f / x_max : 0.0f;
+
+        auto vinv = _mm256_set1_ps(inv);
+
+        // packs work within 128 bit lanes, the permute puts the 32 bytes back in order
+        auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        i = 0;
+        for (; i + 4 * N <= len; i += 4 * N)
+        {
+            auto p01 = _mm256_packs_epi32(quantize_u7_step_256(x + i, vinv), quantize_u7_step_256(x + i + N, vinv));
+            auto p23 = _mm256_packs_epi32(quantize_u7_step_256(x + i + 2 * N, vinv), quantize_u7_step_256(x + i + 3 * N, vinv));
+            auto b = _mm256_packus_epi16(p01, p23);
+
+            _mm256_storeu_si256((i256*)(q + i), _mm256_permutevar8x32_epi32(b, order));
+        }
+
+        for (; i < len; i++)
+        {
+            q[i] = quantize_u7_1(x[i], inv);
+        }
+
+        return x_max / 127.0f;
+    }
+
+#endif
+}
+
+
+/* softmax */
+
+namespace span
+{
+    // exp(x) for x in [-87.3, 88.7], polynomial on the reduced range
+    // relative error below 2e-7, a couple of ulp
+    namespace exp_poly
+    {
+        constexpr f32 MIN_X = -87.3365f;
+        constexpr f32 MAX_X = 88.7228f;
+
+        constexpr f32 LOG2E = 1.44269504088896341f;
+
+        // ln2 split in two so x - n * ln2 stays exact
+        constexpr f32 LN2_HI = 0.693359375f;
+        constexpr f32 LN2_LO = -2.12194440e-4f;
+
+        constexpr f32 P0 = 1.9875691500e-4f;
+        constexpr f32 P1 = 1.3981999507e-3f;
+        constexpr f32 P2 = 8.3334519073e-3f;
+        constexpr f32 P3 = 4.1665795894e-2f;
+        constexpr f32 P4 = 1.6666665459e-1f;
+        constexpr f32 P5 = 5.0000001201e-1f;
+    }
+
+
+    static inline f32 exp_32(f32 x)
+    {
+        using namespace exp_poly;
+
+        x = x < MIN_X ? MIN_X : (x > MAX_X ? MAX_X : x);
+
+        auto n = std::floor(x * LOG2E + 0.5f);
+
+        x = x - n * LN2_HI - n * LN2_LO;
+
+        auto p = P0;
+        p = p * x + P1;
+        p = p * x + P2;
+        p = p * x + P3;
+        p = p * x + P4;
+        p = p * x + P5;
+        p = p * x * x + x + 1.0f;
+
+        // 2^n
+        auto bits = (u32)((i32)n + 127) << 23;
+        f32 pow2n = 0.0f;
+        std::memcpy(&pow2n, &bits, sizeof(f32));
+
+        return p * pow2n;
+    }
+
+
+    static SoftmaxResult softmax_error_32(f32* x, f32* expected, f32* error, u32 len)
+    {
+        SoftmaxResult res{};
+
+        f32 max = x[0];
+        f32 ex = 0.0f;
+        f32 e_total = 0.0f;
+
+        for (u32 i = 0; i < len; i++)
+        {
+            if (x[i] > max)
+            {
+                max = x[i];
+                res.argmax = i;
+            }
+        }
+
+        f32 total = 0.0f;
+
+        for (u32 i = 0; i < len; i++)
+        {
+            if (expected)
+            {
+                ex += expected[i] * x[i];
+                e_total += expected[i];
+            }
+
+            x[i] = exp_32(x[i] - max);
+            total += x[i];
+        }
+
+        auto f = 1.0f / total;
+
+        for (u32 i = 0; i < len; i++)
+        {
+            x[i] *= f;
+        }
+
+        res.max = x[res.argmax];
+
+        if (!expected)
+        {
+            return res;
+        }
+
+        f32 abs_sum = 0.0f;
+
+        for (u32 i = 0; i < len; i++)
+        {
+            error[i] = expected[i] - x[i];
+            abs_sum += error[i] < 0.0f ? -error[i] : error[i];
+        }
+
+        res.abs_error = abs_sum / len;
+
+        // -sum(e * log(p)) with log(p) = x - max - log(total)
+        res.loss = (max + std::log(total)) * e_total - ex;
+
+        return res;
+    }
+
+
+#ifdef SPAN_X86
+
+    SPAN_TARGET_256
+    static inline f256 exp_256(f256 x)
+    {
+        using namespace exp_poly;
+
+        x = _mm256_max_ps(x, _mm256_set1_ps(MIN_X));
+        x = _mm256_min_ps(x, _mm256_set1_ps(MAX_X));
+
+        f256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(0.5f)));
+
+        x = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI), x);
+        x = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO), x);
+
+        f256 p = _mm256_set1_ps(P0);
+        p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(P1));
+        p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(P2));
+        p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(P3));
+        p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(P4));
+        p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(P5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+        // 2^n
+        i256 bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+
+        return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+    }
+
+
+    // index of the first lane equal to value
+    SPAN_TARGET_256
+    static inline bool find_256(f256 v, f256 value, u32 offset, u32& index)
+    {
+        auto bits = (u32)_mm256_movemask_ps(_mm256_cmp_ps(v, value, _CMP_EQ_OQ));
+        if (!bits)
+        {
+            return false;
+        }
+
+        index = offset + (u32)std::countr_zero(bits);
+
+        return true;
+    }
+
+
+    // len >= 1, tails use masked loads/stores
+    SPAN_TARGET_256
+    static SoftmaxResult softmax_error_256(f32* x, f32* expected, f32* error, u32 len)
+    {
+        constexpr u32 N = 8;
+
+        SoftmaxResult res{};
+
+        auto const n_full = len / N;
+        auto const n_tail = len - n_full * N;
+        auto const tail_mask = tail_mask_256(n_tail);
+
+        f256 const v_min = _mm256_set1_ps(-INFINITY);
+        f256 const f_tail_mask = _mm256_castsi256_ps(tail_mask);
+
+        // max
+        f256 vmax = v_min;
+
+        u32 i = 0;
+        for (; i < n_full * N; i += N)
+        {
+            vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+        }
+
+        if (n_tail)
+        {
+            vmax = _mm256_max_ps(vmax, _mm256_blendv_ps(v_min, _mm256_maskload_ps(x + i, tail_mask), f_tail_mask));
+        }
+
+        vmax = _mm256_max_ps(vmax, _mm256_permute2f128_ps(vmax, vmax, 1));
+        vmax = _mm256_max_ps(vmax, _mm256_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmax = _mm256_max_ps(vmax, _mm256_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        f32 const max = _mm256_cvtss_f32(vmax);
+
+        // exp, sum, argmax and the dot with expected for the loss
+        bool found = false;
+
+        f256 vtotal = _mm256_setzero_ps();
+        f256 vex = _mm256_setzero_ps();
+        f256 ve_total = _mm256_setzero_ps();
+
+        f256 const vzero = _mm256_setzero_ps();
+
+        for (i = 0; i < n_full * N; i += N)
+        {
+            f256 ve = expected ? _mm256_loadu_ps(expected + i) : vzero;
+            f256 vx = _mm256_loadu_ps(x + i);
+
+            found = found || find_256(vx, vmax, i, res.argmax);
+
+            vex = _mm256_fmadd_ps(ve, vx, vex);
+            ve_total = _mm256_add_ps(ve_total, ve);
+
+            f256 vp = exp_256(_mm256_sub_ps(vx, vmax));
+
+            vtotal = _mm256_add_ps(vtotal, vp);
+            _mm256_storeu_ps(x + i, vp);
+        }
+
+        if (n_tail)
+        {
+            f256 ve = expected ? _mm256_maskload_ps(expected + i, tail_mask) : vzero;
+            // zeros in the masked lanes for the dot with expected, -inf for max and exp
+            f256 vx_e = _mm256_maskload_ps(x + i, tail_mask);
+            f256 vx = _mm256_blendv_ps(v_min, vx_e, f_tail_mask);
+
+            found = found || find_256(vx, vmax, i, res.argmax);
+
+            vex = _mm256_fmadd_ps(ve, vx_e, vex);
+            ve_total = _mm256_add_ps(ve_total, ve);
+
+            f256 vp = _mm256_and_ps(exp_256(_mm256_sub_ps(vx, vmax)), f_tail_mask);
+
+            vtotal = _mm256_add_ps(vtotal, vp);
+            _mm256_maskstore_ps(x + i, tail_mask, vp);
+        }
+
+        f32 const total = hsum_256(vtotal);
+
+        // normalize, error = expected - p, sum |error|
+        f256 const vf = _mm256_set1_ps(1.0f / total);
+        f256 const sign = _mm256_set1_ps(-0.0f);
+
+        f256 vabs = _mm256_setzero_ps();
+
+        for (i = 0; i < n_full * N; i += N)
+        {
+            f256 vp = _mm256_mul_ps(_mm256_loadu_ps(x + i), vf);
+            _mm256_storeu_ps(x + i, vp);
+
+            if (expected)
+            {
+                f256 ve = _mm256_sub_ps(_mm256_loadu_ps(expected + i), vp);
+                _mm256_storeu_ps(error + i, ve);
+                vabs = _mm256_add_ps(vabs, _mm256_andnot_ps(sign, ve));
+            }
+        }
+
+        if (n_tail)
+        {
+            f256 vp = _mm256_mul_ps(_mm256_maskload_ps(x + i, tail_mask), vf);
+            _mm256_maskstore_ps(x + i, tail_mask, vp);
+
+            if (expected)
+            {
+                f256 ve = _mm256_sub_ps(_mm256_maskload_ps(expected + i, tail_mask), vp);
+                _mm256_maskstore_ps(error + i, tail_mask, ve);
+                vabs = _mm256_add_ps(vabs, _mm256_andnot_ps(sign, ve));
+            }
+        }
+
+        res.max = x[res.argmax];
+
+        if (!expected)
+        {
+            return res;
+        }
+
+        res.abs_error = hsum_256(vabs) / len;
+        res.loss = (max + std::log(total)) * hsum_256(ve_total) - hsum_256(vex);
+
+        return res;
+    }
+
+#endif
+}
+
+
+/* gemm */
+
+namespace span
+{
+    // register tile computed by the micro-kernel
+    constexpr u32 GEMM_MR = 6;
+    constexpr u32 GEMM_NR = 16;
+
+    // cache blocks, the micro-kernel reads a GEMM_MR x kc sliver of A (3 KB) and a kc x GEMM_NR sliver of B (8 KB) from L1
+    // the mc x kc block of A (48 KB) and the kc x nc panel of B (128 KB) stay in L2
+    constexpr u32 GEMM_KC = 128;
+    constexpr u32 GEMM_MC = 16 * GEMM_MR;
+    constexpr u32 GEMM_NC = 16 * GEMM_NR;
+
+    static_assert(GEMM_SCRATCH_ELEMENTS == GEMM_MC * GEMM_KC + GEMM_KC * GEMM_NC);
+
+
+    class GemmOperand
+    {
+    public:
+        f32* data = 0;
+        u32 width = 0;
+        bool transpose = false;
+    };
+
+
+    static inline u32 min_u32(u32 a, u32 b)
+    {
+        return a < b ? a : b;
+    }
+
+
+    static inline f32 gemm_at(GemmOperand const& m, u32 r, u32 c)
+    {
+        return m.transpose ? m.data[(u64)c * m.width + r] : m.data[(u64)r * m.width + c];
+    }
+
+
+    // mc x kc block of A, packed in slivers of GEMM_MR rows
+    static void gemm_pack_a(GemmOperand const& a, u32 i_begin, u32 p_begin, u32 mc, u32 kc, f32* dst)
+    {
+        for (u32 ir = 0; ir < mc; ir += GEMM_MR)
+        {
+            auto mr = min_u32(GEMM_MR, mc - ir);
+
+            for (u32 p = 0; p < kc; p++)
+            {
+                u32 i = 0;
+                for (; i < mr; i++)
+                {
+                    dst[i] = gemm_at(a, i_begin + ir + i, p_begin + p);
+                }
+
+                for (; i < GEMM_MR; i++)
+                {
+                    dst[i] = 0.0f;
+                }
+
+                dst += GEMM_MR;
+            }
+        }
+    }
+
+
+    // kc x nc panel of B, packed in slivers of GEMM_NR columns
+    static void gemm_pack_b(GemmOperand const& b, u32 p_begin, u32 j_begin, u32 kc, u32 nc, f32* dst)
+    {
+        for (u32 jr = 0; jr < nc; jr += GEMM_NR)
+        {
+            auto nr = min_u32(GEMM_NR, nc - jr);
+
+            for (u32 p = 0; p < kc; p++)
+            {
+                u32 j = 0;
+                for (; j < nr; j++)
+                {
+                    dst[j] = gemm_at(b, p_begin + p, j_begin + jr + j);
+                }
+
+                for (; j < GEMM_NR; j++)
+                {
+                    dst[j] = 0.0f;
+                }
+
+                dst += GEMM_NR;
+            }
+        }
+    }
+
+
+    static void gemm_store_tile(f32* tile, f32* c, u32 c_width, u32 mr, u32 nr, f32 alpha, f32 beta)
+    {
+        for (u32 i = 0; i < mr; i++)
+        {
+            auto t = tile + i * GEMM_NR;
+            auto d = c + (u64)i * c_width;
+
+            if (beta == 0.0f)
+            {
+                for (u32 j = 0; j < nr; j++)
+                {
+                    d[j] = alpha * t[j];
+                }
+            }
+            else
+            {
+                for (u32 j = 0; j < nr; j++)
+                {
+                    d[j] = alpha * t[j] + beta * d[j];
+                }
+            }
+        }
+    }
+
+
+    static void gemm_kernel_32(u32 kc, f32* a, f32* b, f32* c, u32 c_width, u32 mr, u32 nr, f32 alpha, f32 beta)
+    {
+        f32 tile[GEMM_MR * GEMM_NR] = { 0 };
+
+        for (u32 p = 0; p < kc; p++)
+        {
+            for (u32 i = 0; i < GEMM_MR; i++)
+            {
+                auto ai = a[i];
+                auto t = tile + i * GEMM_NR;
+
+                for (u32 j = 0; j < GEMM_NR; j++)
+                {
+                    t[j] += ai * b[j];
+                }
+            }
+
+            a += GEMM_MR;
+            b += GEMM_NR;
+        }
+
+        gemm_store_tile(tile, c, c_width, mr, nr, alpha, beta);
+    }
+
+
+#ifdef SPAN_X86
+
+    // 6 x 8 half of the tile, 12 accumulators and the 2 vectors of b fit in the 16 xmm registers
+    SPAN_TARGET_128
+    static void gemm_half_tile_128(u32 kc, f32* a, f32* b, f32* tile)
+    {
+        f128 c00 = _mm_setzero_ps(); f128 c01 = _mm_setzero_ps();
+        f128 c10 = _mm_setzero_ps(); f128 c11 = _mm_setzero_ps();
+        f128 c20 = _mm_setzero_ps(); f128 c21 = _mm_setzero_ps();
+        f128 c30 = _mm_setzero_ps(); f128 c31 = _mm_setzero_ps();
+        f128 c40 = _mm_setzero_ps(); f128 c41 = _mm_setzero_ps();
+        f128 c50 = _mm_setzero_ps(); f128 c51 = _mm_setzero_ps();
+
+        for (u32 p = 0; p < kc; p++)
+        {
+            f128 b0 = _mm_load_ps(b);
+            f128 b1 = _mm_load_ps(b + 4);
+
+            f128 ai = _mm_set1_ps(a[0]);
+            c00 = _mm_add_ps(c00, _mm_mul_ps(ai, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(ai, b1));
+
+            ai = _mm_set1_ps(a[1]);
+            c10 = _mm_add_ps(c10, _mm_mul_ps(ai, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(ai, b1));
+
+            ai = _mm_set1_ps(a[2]);
+            c20 = _mm_add_ps(c20, _mm_mul_ps(ai, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(ai, b1));
+
+            ai = _mm_set1_ps(a[3]);
+            c30 = _mm_add_ps(c30, _mm_mul_ps(ai, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(ai, b1));
+
+            ai = _mm_set1_ps(a[4]);
+            c40 = _mm_add_ps(c40, _mm_mul_ps(ai, b0)); c41 = _mm_add_ps(c41, _mm_mul_ps(ai, b1));
+
+            ai = _mm_set1_ps(a[5]);
+            c50 = _mm_add_ps(c50, _mm_mul_ps(ai, b0)); c51 = _mm_add_ps(c51, _mm_mul_ps(ai, b1));
+
+            a += GEMM_MR;
+            b += GEMM_NR;
+        }
+
+        _mm_store_ps(tile + 0 * GEMM_NR, c00); _mm_store_ps(tile + 0 * GEMM_NR + 4, c01);
+        _mm_store_ps(tile + 1 * GEMM_NR, c10); _mm_store_ps(tile + 1 * GEMM_NR + 4, c11);
+        _mm_store_ps(tile + 2 * GEMM_NR, c20); _mm_store_ps(tile + 2 * GEMM_NR + 4, c21);
+        _mm_store_ps(tile + 3 * GEMM_NR, c30); _mm_store_ps(tile + 3 * GEMM_NR + 4, c31);
+        _mm_store_ps(tile + 4 * GEMM_NR, c40); _mm_store_ps(tile + 4 * GEMM_NR + 4, c41);
+        _mm_store_ps(tile + 5 * GEMM_NR, c50); _mm_store_ps(tile + 5 * GEMM_NR + 4, c51);
+    }
+
+
+    SPAN_TARGET_128
+    static void gemm_kernel_128(u32 kc, f32* a, f32* b, f32* c, u32 c_width, u32 mr, u32 nr, f32 alpha, f32 beta)
+    {
+        static_assert(GEMM_MR == 6 && GEMM_NR == 16);
+
+        alignas(16) f32 tile[GEMM_MR * GEMM_NR];
+
+        // a full 6 x 16 tile needs 24 accumulators, more than SSE has registers
+        gemm_half_tile_128(kc, a, b, tile);
+        gemm_half_tile_128(kc, a, b + 8, tile + 8);
+
+        if (mr < GEMM_MR || nr < GEMM_NR)
+        {
+            gemm_store_tile(tile, c, c_width, mr, nr, alpha, beta);
+            return;
+        }
+
+        f128 va = _mm_set1_ps(alpha);
+        f128 vb = _mm_set1_ps(beta);
+
+        for (u32 i = 0; i < GEMM_MR; i++)
+        {
+            auto d = c + (u64)i * c_width;
+            auto t = tile + i * GEMM_NR;
+
+            for (u32 j = 0; j < GEMM_NR; j += 4)
+            {
+                f128 v = _mm_mul_ps(va, _mm_load_ps(t + j));
+
+                if (beta != 0.0f)
+                {
+                    v = _mm_add_ps(v, _mm_mul_ps(vb, _mm_loadu_ps(d + j)));
+                }
+
+                _mm_storeu_ps(d + j, v);
+            }
+        }
+    }
+
+
+    SPAN_TARGET_256
+    static void gemm_kernel_256(u32 kc, f32* a, f32* b, f32* c, u32 c_width, u32 mr, u32 nr, f32 alpha, f32 beta)
+    {
+        static_assert(GEMM_MR == 6 && GEMM_NR == 16);
+
+        f256 c00 = _mm256_setzero_ps(); f256 c01 = _mm256_setzero_ps();
+        f256 c10 = _mm256_setzero_ps(); f256 c11 = _mm256_setzero_ps();
+        f256 c20 = _mm256_setzero_ps(); f256 c21 = _mm256_setzero_ps();
+        f256 c30 = _mm256_setzero_ps(); f256 c31 = _mm256_setzero_ps();
+        f256 c40 = _mm256_setzero_ps(); f256 c41 = _mm256_setzero_ps();
+        f256 c50 = _mm256_setzero_ps(); f256 c51 = _mm256_setzero_ps();
+
+        for (u32 p = 0; p < kc; p++)
+        {
+            f256 b0 = _mm256_load_ps(b);
+            f256 b1 = _mm256_load_ps(b + 8);
+
+            f256 ai = _mm256_broadcast_ss(a + 0);
+            c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+
+            ai = _mm256_broadcast_ss(a + 1);
+            c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+
+            ai = _mm256_broadcast_ss(a + 2);
+            c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+
+            ai = _mm256_broadcast_ss(a + 3);
+            c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+
+            ai = _mm256_broadcast_ss(a + 4);
+            c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+
+            ai = _mm256_broadcast_ss(a + 5);
+            c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+
+            a += GEMM_MR;
+            b += GEMM_NR;
+        }
+
+        alignas(32) f32 tile[GEMM_MR * GEMM_NR];
+
+        _mm256_store_ps(tile + 0 * GEMM_NR, c00); _mm256_store_ps(tile + 0 * GEMM_NR + 8, c01);
+        _mm256_store_ps(tile + 1 * GEMM_NR, c10); _mm256_store_ps(tile + 1 * GEMM_NR + 8, c11);
+        _mm256_store_ps(tile + 2 * GEMM_NR, c20); _mm256_store_ps(tile + 2 * GEMM_NR + 8, c21);
+        _mm256_store_ps(tile + 3 * GEMM_NR, c30); _mm256_store_ps(tile + 3 * GEMM_NR + 8, c31);
+        _mm256_store_ps(tile + 4 * GEMM_NR, c40); _mm256_store_ps(tile + 4 * GEMM_NR + 8, c41);
+        _mm256_store_ps(tile + 5 * GEMM_NR, c50); _mm256_store_ps(tile + 5 * GEMM_NR + 8, c51);
+
+        if (mr < GEMM_MR || nr < GEMM_NR)
+        {
+            gemm_store_tile(tile, c, c_width, mr, nr, alpha, beta);
+            return;
+        }
+
+        f256 va = _mm256_set1_ps(alpha);
+        f256 vb = _mm256_set1_ps(beta);
+
+        for (u32 i = 0; i < GEMM_MR; i++)
+        {
+            auto d = c + (u64)i * c_width;
+
+            f256 t0 = _mm256_mul_ps(va, _mm256_load_ps(tile + i * GEMM_NR));
+            f256 t1 = _mm256_mul_ps(va, _mm256_load_ps(tile + i * GEMM_NR + 8));
+
+            if (beta != 0.0f)
+            {
+                t0 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(d), t0);
+                t1 = _mm256_fmadd_ps(vb, _mm256_loadu_ps(d + 8), t1);
+            }
+
+            _mm256_storeu_ps(d, t0);
+            _mm256_storeu_ps(d + 8, t1);
+        }
+    }
+
+#endif
+}
+
+
+/* dispatch */
+
+namespace span
+{
+    using copy_u8_f = void (*)(u8*, u8*, u64);
+    using fill_u8_f = void (*)(u8*, u8, u64);
+    using fill_u32_f = void (*)(u32*, u32, u64);
+    using binary_f32_f = void (*)(f32*, f32*, f32*, u64);
+    using dot_f32_f = f32 (*)(f32*, f32*, u64);
+    using axpy_f32_f = void (*)(f32, f32*, f32*, u64);
+    using row_gemv_t_ger_f = void (*)(f32*, f32, f32, f32*, f32*, u32);
+    using gemv_bias_relu_f = void (*)(f32*, u32, u32, f32*, f32*, f32*);
+    using softmax_error_f = SoftmaxResult (*)(f32*, f32*, f32*, u32);
+    using gemm_kernel_f = void (*)(u32, f32*, f32*, f32*, u32, u32, u32, f32, f32);
+    using gemv_i8_f = void (*)(i8*, u32, u32, u8*, i32*);
+    using quantize_u7_f = f32 (*)(f32*, u8*, u32);
+    using gemv_half_f = void (*)(u16*, u32, u32, f32*, f32*, f32*);
+
+
+    class SimdKernels
+    {
+    public:
+        SimdLevel level = SimdLevel::Scalar;
+
+        copy_u8_f copy_u8 = copy_u8_64;
+        fill_u8_f fill_u8 = fill_u8_8;
+        fill_u32_f fill_u32 = fill_u32_32;
+
+        binary_f32_f add = add_32;
+        binary_f32_f sub = sub_32;
+        dot_f32_f dot = dot_32;
+        axpy_f32_f axpy = axpy_32;
+
+        row_gemv_t_ger_f row_gemv_t_ger = row_gemv_t_ger_32;
+        gemv_bias_relu_f gemv_bias_relu = gemv_bias_relu_32;
+        softmax_error_f softmax_error = softmax_error_32;
+        gemm_kernel_f gemm_kernel = gemm_kernel_32;
+        gemv_i8_f gemv_i8 = gemv_i8_8;
+        quantize_u7_f quantize_u7 = quantize_u7_8;
+        gemv_half_f gemv_f16 = gemv_half_bias_relu_32<HalfFormat::F16>;
+        gemv_half_f gemv_bf16 = gemv_half_bias_relu_32<HalfFormat::BF16>;
+
+        bool vnni = false;
+        bool f16c = false;
+    };
+
+
+    // the half kernels convert with F16C, which every AVX2 cpu has in practice
+    static void set_half_kernels_256(SimdKernels& k)
+    {
+    #ifdef SPAN_X86
+
+        k.f16c = detected_f16c();
+
+        if (k.f16c)
+        {
+            k.gemv_f16 = gemv_half_bias_relu_256<HalfFormat::F16>;
+            k.gemv_bf16 = gemv_half_bias_relu_256<HalfFormat::BF16>;
+        }
+
+    #endif
+    }
+
+
+    static SimdKernels make_simd_kernels(SimdLevel level)
+    {
+        SimdKernels k{};
+
+    #ifdef SPAN_X86
+
+        switch (level)
+        {
+        case SimdLevel::AVX512:
+            k.level = level;
+            k.copy_u8 = copy_u8_512;
+            k.fill_u8 = fill_u8_512;
+            k.fill_u32 = fill_u32_512;
+            k.add = add_512;
+            k.sub = sub_512;
+            k.dot = dot_512;
+            k.axpy = axpy_512;
+            k.row_gemv_t_ger = row_gemv_t_ger_512;
+            k.gemv_bias_relu = gemv_bias_relu_256;
+            k.softmax_error = softmax_error_256;
+            k.gemm_kernel = gemm_kernel_256;
+            k.vnni = detected_vnni();
+            k.gemv_i8 = k.vnni ? gemv_i8_vnni : gemv_i8_256;
+            k.quantize_u7 = quantize_u7_256;
+            set_half_kernels_256(k);
+            break;
+
+        case SimdLevel::AVX2:
+            k.level = level;
+            k.copy_u8 = copy_u8_256;
+            k.fill_u8 = fill_u8_256;
+            k.fill_u32 = fill_u32_256;
+            k.add = add_256;
+            k.sub = sub_256;
+            k.dot = dot_256;
+            k.axpy = axpy_256;
+            k.row_gemv_t_ger = row_gemv_t_ger_256;
+            k.gemv_bias_relu = gemv_bias_relu_256;
+            k.softmax_error = softmax_error_256;
+            k.gemm_kernel = gemm_kernel_256;
+            k.gemv_i8 = gemv_i8_256;
+            k.quantize_u7 = quantize_u7_256;
+            set_half_kernels_256(k);
+            break;
+
+        case SimdLevel::SSE4:
+            k.level = level;
+            k.copy_u8 = copy_u8_128;
+            k.fill_u8 = fill_u8_128;
+            k.fill_u32 = fill_u32_128;
+            k.add = add_128;
+            k.sub = sub_128;
+            k.dot = dot_128;
+            k.axpy = axpy_128;
+            k.gemv_bias_relu = gemv_bias_relu_128;
+            k.gemm_kernel = gemm_kernel_128;
+            k.gemv_i8 = gemv_i8_128;
+            k.quantize_u7 = quantize_u7_128;
+            break;
+
+        default:
+            break;
+        }
+
+    #endif
+
+        return k;
+    }
+
+
+    static SimdKernels& simd()
+    {
+        static SimdKernels kernels = make_simd_kernels(detected_simd_level());
+
+        return kernels;
+    }
+}
+
+
+/* gemm */
+
+namespace span
+{
+    static void gemm_scale(MatrixView2D<f32> const& c, f32 beta)
+    {
+        u64 len = (u64)c.width * c.height;
+
+        for (u64 i = 0; i < len; i++)
+        {
+            c.matrix_data_[i] = beta == 0.0f ? 0.0f : beta * c.matrix_data_[i];
+        }
+    }
+
+
+    static void gemm_f32(GemmOperand const& a, GemmOperand const& b, MatrixView2D<f32> const& c, u32 K, f32 alpha, f32 beta, SpanView<f32> const& scratch)
+    {
+        auto const M = c.height;
+        auto const N = c.width;
+
+        if (!M || !N)
+        {
+            return;
+        }
+
+        if (!K)
+        {
+            gemm_scale(c, beta);
+            return;
+        }
+
+        auto const gemm_kernel = simd().gemm_kernel;
+
+        assert(scratch.length >= GEMM_SCRATCH_ELEMENTS);
+        assert((uintptr_t)scratch.data % 64 == 0);
+
+        // the micro-kernels load the packed blocks aligned
+        auto pack_a = scratch.data;
+        auto pack_b = pack_a + GEMM_MC * GEMM_KC;
+
+        for (u32 jc = 0; jc < N; jc += GEMM_NC)
+        {
+            auto nc = min_u32(GEMM_NC, N - jc);
+
+            for (u32 pc = 0; pc < K; pc += GEMM_KC)
+            {
+                auto kc = min_u32(GEMM_KC, K - pc);
+
+                // beta only applies to the first pass over K
+                auto beta_k = pc ? 1.0f : beta;
+
+                gemm_pack_b(b, pc, jc, kc, nc, pack_b);
+
+                for (u32 ic = 0; ic < M; ic += GEMM_MC)
+                {
+                    auto mc = min_u32(GEMM_MC, M - ic);
+
+                    gemm_pack_a(a, ic, pc, mc, kc, pack_a);
+
+                    for (u32 jr = 0; jr < nc; jr += GEMM_NR)
+                    {
+                        auto nr = min_u32(GEMM_NR, nc - jr);
+
+                        for (u32 ir = 0; ir < mc; ir += GEMM_MR)
+                        {
+                            auto mr = min_u32(GEMM_MR, mc - ir);
+
+                            auto d = c.matrix_data_ + (u64)(ic + ir) * N + jc + jr;
+
+                            gemm_kernel(kc, pack_a + ir * kc, pack_b + jr * kc, d, N, mr, nr, alpha, beta_k);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/* api */
+
+namespace span
+{
+    SimdLevel simd_level()
+    {
+        return simd().level;
+    }
+
+
+    SimdLevel set_simd_level(SimdLevel level)
+    {
+        auto max_level = detected_simd_level();
+        if ((u8)level > (u8)max_level)
+        {
+            level = max_level;
+        }
+
+        simd() = make_simd_kernels(level);
+
+        return simd().level;
+    }
+
+
+    bool simd_vnni()
+    {
+        return simd().vnni;
+    }
+
+
+    bool simd_f16c()
+    {
+        return simd().f16c;
+    }
+
+
+    cstr simd_level_str(SimdLevel level)
+    {
+        switch (level)
+        {
+        case SimdLevel::SSE4: return "SSE4";
+        case SimdLevel::AVX2: return "AVX2+FMA";
+        case SimdLevel::AVX512: return "AVX-512";
+        default: return "Scalar";
+        }
+    }
+}
+
+
+namespace span
+{
+    void copy_u8(u8* src, u8* dst, u64 len_u8)
+    {
+        simd().copy_u8(src, dst, len_u8);
+    }
+
+
+    void fill_u8(u8* dst, u8 value, u64 len_u8)
+    {
+        simd().fill_u8(dst, value, len_u8);
+    }
+
+
+    void fill_u32(u32* dst, u32 value, u64 len_u32)
+    {
+        simd().fill_u32(dst, value, len_u32);
+    }
+}
+
+
+namespace span
+{
+    void add(SpanView<f32> const& a, SpanView<f32> const& b, SpanView<f32> const& dst)
     {
         auto len = a.length;
 
         assert(b.length == len);
+        assert(dst.length == len);
 
-        switch (len)
+        if (len < 4)
+        {
+            add_32(a.data, b.data, dst.data, len);
+            return;
+        }
+
+        simd().add(a.data, b.data, dst.data, len);
+    }
+
+
+    void sub(SpanView<f32> const& a, SpanView<f32> const& b, SpanView<f32> const& dst)
+    {
+        auto len = a.length;
+
+        assert(b.length == len);
+        assert(dst.length == len);
+
+        if (len < 4)
+        {
+            sub_32(a.data, b.data, dst.data, len);
+            return;
+        }
+
+        simd().sub(a.data, b.data, dst.data, len);
+    }
+
+
+    void axpy(f32 alpha, SpanView<f32> const& x, SpanView<f32> const& y)
+    {
+        auto len = x.length;
+
+        assert(y.length == len);
+
+        if (len < 4)
+        {
+            axpy_32(alpha, x.data, y.data, len);
+            return;
+        }
+
+        simd().axpy(alpha, x.data, y.data, len);
+    }
+
+
+    f32 dot(SpanView<f32> const& a, SpanView<f32> const& b)
+    {
+        auto len = a.length;
+
+        assert(b.length == len);
+
+        if (len < 4)
         {
-        case 0:
-        case 1:
-        case 2:
-        case 3:
             return dot_32(a.data, b.data, len);
-        case 4:
-        case 5:
-        case 6:
-        case 7:
-            return dot_128(a.data, b.data, len);
+        }
+
+        return simd().dot(a.data, b.data, len);
+    }
+}
+
+
+namespace span
+{
+    void gemv(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y)
+    {
+        assert(a.width == x.length);
+        assert(a.height == y.length);
+
+        SpanView<f32> row{};
+        row.data = a.matrix_data_;
+        row.length = a.width;
+
+        for (u32 i = 0; i < y.length; i++)
+        {
+            y.data[i] = dot(row, x);
+            row.data += a.width;
+        }
+    }
+
+
+    void gemv_bias_relu(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& bias, SpanView<f32> const& y)
+    {
+        assert(a.width == x.length);
+        assert(a.height == y.length);
+        assert(a.height == bias.length);
+
+        simd().gemv_bias_relu(a.matrix_data_, a.width, a.height, x.data, bias.data, y.data);
+    }
+
+
+    void gemv_i8(MatrixView2D<i8> const& a, SpanView<u8> const& x, SpanView<i32> const& y)
+    {
+        assert(a.width == x.length);
+        assert(a.height == y.length);
+        assert(a.width % GEMV_I8_ALIGN == 0);
+
+        simd().gemv_i8(a.matrix_data_, a.width, a.height, x.data, y.data);
+    }
+
+
+    f32 quantize_u7(SpanView<f32> const& x, SpanView<u8> const& q)
+    {
+        assert(q.length >= x.length);
+
+        return simd().quantize_u7(x.data, q.data, x.length);
+    }
+
+
+    void gemv_half_bias_relu(MatrixView2D<u16> const& a, HalfFormat format, SpanView<f32> const& x, SpanView<f32> const& bias, SpanView<f32> const& y)
+    {
+        assert(a.width == x.length);
+        assert(a.height == y.length);
+        assert(a.height == bias.length);
+
+        auto& k = simd();
+        auto gemv = format == HalfFormat::F16 ? k.gemv_f16 : k.gemv_bf16;
+
+        gemv(a.matrix_data_, a.width, a.height, x.data, bias.data, y.data);
+    }
+
+
+    void to_half(SpanView<f32> const& src, SpanView<u16> const& dst, HalfFormat format)
+    {
+        assert(src.length == dst.length);
+
+        auto convert = format == HalfFormat::F16 ? f32_to_f16 : f32_to_bf16;
+
+        for (u32 i = 0; i < src.length; i++)
+        {
+            dst.data[i] = convert(src.data[i]);
+        }
+    }
+
+
+    void to_f32(SpanView<u16> const& src, SpanView<f32> const& dst, HalfFormat format)
+    {
+        assert(src.length == dst.length);
+
+        auto convert = format == HalfFormat::F16 ? f16_to_f32 : bf16_to_f32;
+
+        for (u32 i = 0; i < src.length; i++)
+        {
+            dst.data[i] = convert(src.data[i]);
+        }
+    }
+
+
+    cstr half_format_str(HalfFormat format)
+    {
+        switch (format)
+        {
+        case HalfFormat::F16: return "f16";
+        case HalfFormat::BF16: return "bf16";
+        default: return "";
+        }
+    }
+
+
+    void gemv_t(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y)
+    {
+        assert(a.height == x.length);
+        assert(a.width == y.length);
+
+        fill(y, 0.0f);
 
-        default: 
-            return dot_256(a.data, b.data, len);
+        auto row = a.matrix_data_;
+
+        for (u32 i = 0; i < x.length; i++)
+        {
+            axpy(x.data[i], to_span(row, a.width), y);
+            row += a.width;
+        }
+    }
+
+
+    void ger(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& z, f32 alpha)
+    {
+        assert(a.height == x.length);
+        assert(a.width == z.length);
+
+        auto row = a.matrix_data_;
+
+        for (u32 i = 0; i < x.length; i++)
+        {
+            auto s = alpha * x.data[i];
+            if (s != 0.0f)
+            {
+                axpy(s, z, to_span(row, a.width));
+            }
+
+            row += a.width;
+        }
+    }
+
+
+    void gemv_t_ger(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y, SpanView<f32> const& z, f32 alpha)
+    {
+        assert(a.height == x.length);
+        assert(a.width == y.length);
+        assert(a.width == z.length);
+
+        fill(y, 0.0f);
+
+        auto const row_gemv_t_ger = simd().row_gemv_t_ger;
+
+        auto row = a.matrix_data_;
+
+        for (u32 i = 0; i < x.length; i++)
+        {
+            auto xi = x.data[i];
+
+            // zero rows (e.g. inactive reLU) contribute nothing to either result
+            if (xi != 0.0f)
+            {
+                row_gemv_t_ger(row, xi, alpha * xi, y.data, z.data, a.width);
+            }
+
+            row += a.width;
+        }
+    }
+
+
+    void gemm(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch)
+    {
+        assert(a.width == b.height);
+        assert(c.height == a.height);
+        assert(c.width == b.width);
+
+        GemmOperand op_a{ a.matrix_data_, a.width, false };
+        GemmOperand op_b{ b.matrix_data_, b.width, false };
+
+        gemm_f32(op_a, op_b, c, a.width, alpha, beta, scratch);
+    }
+
+
+    void gemm_bt(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch)
+    {
+        assert(a.width == b.width);
+        assert(c.height == a.height);
+        assert(c.width == b.height);
+
+        if (c.height == 1 && alpha == 1.0f && beta == 0.0f)
+        {
+            // single row, packing costs more than it saves
+            gemv(b, to_span(a.matrix_data_, a.width), to_span(c.matrix_data_, c.width));
+            return;
+        }
+
+        GemmOperand op_a{ a.matrix_data_, a.width, false };
+        GemmOperand op_b{ b.matrix_data_, b.width, true };
+
+        gemm_f32(op_a, op_b, c, a.width, alpha, beta, scratch);
+    }
+
+
+    void gemm_at(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch)
+    {
+        assert(a.height == b.height);
+        assert(c.height == a.width);
+        assert(c.width == b.width);
+
+        GemmOperand op_a{ a.matrix_data_, a.width, true };
+        GemmOperand op_b{ b.matrix_data_, b.width, false };
+
+        gemm_f32(op_a, op_b, c, a.height, alpha, beta, scratch);
+    }
+}
+
+
+namespace span
+{
+    void softmax(SpanView<f32> const& x)
+    {
+        if (!x.length)
+        {
+            return;
+        }
+
+        simd().softmax_error(x.data, 0, 0, x.length);
+    }
+
+
+    SoftmaxResult softmax_error(SpanView<f32> const& x, SpanView<f32> const& expected, SpanView<f32> const& error)
+    {
+        assert(expected.length == x.length);
+        assert(error.length == x.length);
+
+        if (!x.length)
+        {
+            return SoftmaxResult{};
         }
+
+        return simd().softmax_error(x.data, expected.data, error.data, x.length);
     }
 }
\ No newline at end of file
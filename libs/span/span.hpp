@@ -15,7 +15,7 @@ class SpanView
 {
 public:
 	T* data = 0;
-	u32 length = 0;
+	u64 length = 0;
 };
 
 
@@ -46,7 +46,7 @@ namespace span
 
 
     template <typename T>
-    inline SpanView<T> push_span(MemoryBuffer<T>& buffer, u32 length)
+    inline SpanView<T> push_span(MemoryBuffer<T>& buffer, u64 length)
     {
         SpanView<T> view{};
 
@@ -78,7 +78,7 @@ namespace span
 
 
     template <typename T>
-    inline SpanView<T> to_span(T* data, u32 length)
+    inline SpanView<T> to_span(T* data, u64 length)
     {
         SpanView<T> span{};
         span.data = data;
@@ -130,7 +130,7 @@ namespace span
 	inline void fill(SpanView<T> const& dst, T value)
 	{
         T* d = dst.data;
-		for (u32 i = 0; i < dst.length; ++i)
+		for (u64 i = 0; i < dst.length; ++i)
 		{
 			d[i] = value;
 		}
@@ -145,6 +145,137 @@ namespace span
     void sub(SpanView<f32> const& a, SpanView<f32> const& b, SpanView<f32> const& dst);    
 
     f32 dot(SpanView<f32> const& a, SpanView<f32> const& b);
+
+    // y += alpha * x
+    void axpy(f32 alpha, SpanView<f32> const& x, SpanView<f32> const& y);
+}
+
+
+/* softmax */
+
+namespace span
+{
+    class SoftmaxResult
+    {
+    public:
+        // mean |expected - p|
+        f32 abs_error = 0.0f;
+
+        // cross-entropy, -sum(expected * log(p))
+        f32 loss = 0.0f;
+
+        // largest probability and its index
+        f32 max = 0.0f;
+        u32 argmax = 0;
+    };
+
+
+    // x = softmax(x)
+    void softmax(SpanView<f32> const& x);
+
+    // x = softmax(x), error = expected - x
+    // max, exp, normalize and the error reductions share the same passes over x
+    SoftmaxResult softmax_error(SpanView<f32> const& x, SpanView<f32> const& expected, SpanView<f32> const& error);
+}
+
+
+/* cpu features */
+
+namespace span
+{
+    enum class SimdLevel : u8
+    {
+        Scalar = 0,
+        SSE4,
+        AVX2,
+        AVX512
+    };
+
+
+    // instruction set selected at startup from cpuid
+    SimdLevel simd_level();
+
+    // limit kernels to a lower instruction set, returns the level actually used
+    SimdLevel set_simd_level(SimdLevel level);
+
+    // int8 kernels use AVX-512 VNNI instead of AVX2
+    bool simd_vnni();
+
+    // half precision kernels convert with F16C, scalar without it
+    bool simd_f16c();
+
+    cstr simd_level_str(SimdLevel level);
+}
+
+
+/* half */
+
+namespace span
+{
+    // 16 bit storage of f32 values
+    enum class HalfFormat : u8
+    {
+        // ieee binary16, 10 bit mantissa, |x| <= 65504
+        F16 = 0,
+
+        // upper half of an f32, 7 bit mantissa, f32 range
+        BF16
+    };
+
+
+    // round to nearest even
+    void to_half(SpanView<f32> const& src, SpanView<u16> const& dst, HalfFormat format);
+
+    void to_f32(SpanView<u16> const& src, SpanView<f32> const& dst, HalfFormat format);
+
+    cstr half_format_str(HalfFormat format);
+}
+
+
+/* matrix */
+
+namespace span
+{
+    // y = A * x
+    void gemv(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y);
+
+    // y = max(A * x + bias, 0), several rows of A per pass over x
+    void gemv_bias_relu(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& bias, SpanView<f32> const& y);
+
+    // row length of gemv_i8, rows are padded with zeros
+    constexpr u32 GEMV_I8_ALIGN = 64;
+
+    // y = A * x with int32 sums, x must be in [0, 127]
+    // with 8 bit x the u8 * i8 pair sums of SSE4/AVX2 would saturate at 16 bits
+    void gemv_i8(MatrixView2D<i8> const& a, SpanView<u8> const& x, SpanView<i32> const& y);
+
+    // q = round(x / scale) clamped to [0, 127] for gemv_i8, returns scale = max(x) / 127
+    f32 quantize_u7(SpanView<f32> const& x, SpanView<u8> const& q);
+
+    // y = max(A * x + bias, 0) with f32 sums, the rows of A are widened to f32 as they are read
+    void gemv_half_bias_relu(MatrixView2D<u16> const& a, HalfFormat format, SpanView<f32> const& x, SpanView<f32> const& bias, SpanView<f32> const& y);
+
+    // y = A^T * x
+    void gemv_t(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y);
+
+    // A += alpha * x * z^T
+    void ger(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& z, f32 alpha);
+
+    // y = A^T * x, then A += alpha * x * z^T, in one pass over the rows of A
+    void gemv_t_ger(MatrixView2D<f32> const& a, SpanView<f32> const& x, SpanView<f32> const& y, SpanView<f32> const& z, f32 alpha);
+
+    // the gemm functions pack blocks of A and B into scratch, one scratch per calling thread
+    // GEMM_SCRATCH_ELEMENTS long and 64 byte aligned
+    constexpr u64 GEMM_SCRATCH_ELEMENTS = 96 * 128 + 128 * 256;
+
+    // C = alpha * A * B + beta * C
+    void gemm(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch);
+
+    // C = alpha * A * B^T + beta * C
+    void gemm_bt(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch);
+
+    // C = alpha * A^T * B + beta * C
+    void gemm_at(MatrixView2D<f32> const& a, MatrixView2D<f32> const& b, MatrixView2D<f32> const& c, f32 alpha, f32 beta, SpanView<f32> const& scratch);
 }
 
 
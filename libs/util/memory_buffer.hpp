@@ -10,8 +10,8 @@ class MemoryBuffer
 {
 public:
 	T* data_ = nullptr;
-	u32 capacity_ = 0;
-	u32 size_ = 0;
+	u64 capacity_ = 0;
+	u64 size_ = 0;
 
 	bool ok = false;
 };
@@ -20,7 +20,7 @@ public:
 namespace memory_buffer
 {
 	template <typename T>
-	inline bool create_buffer(MemoryBuffer<T>& buffer, u32 n_elements, cstr tag)
+	inline bool create_buffer(MemoryBuffer<T>& buffer, u64 n_elements, cstr tag)
 	{
 		assert(n_elements > 0);
 		assert(!buffer.data_);
@@ -47,7 +47,7 @@ namespace memory_buffer
 
 
 	/*template <typename T>
-	inline bool create_buffer(MemoryBuffer<T>& buffer, u32 n_elements)
+	inline bool create_buffer(MemoryBuffer<T>& buffer, u64 n_elements)
 	{
 		return create_buffer(buffer, n_elements, "create_buffer");
 	}*/
@@ -78,7 +78,7 @@ namespace memory_buffer
 	template <typename T>
 	inline void zero_buffer(MemoryBuffer<T>& buffer)
 	{
-		for (u32 i = 0; i < buffer.capacity_; i++)
+		for (u64 i = 0; i < buffer.capacity_; i++)
 		{
 			buffer.data_[i] = (T)0;
 		}
@@ -86,7 +86,7 @@ namespace memory_buffer
 
 
 	template <typename T>
-	inline T* push_elements(MemoryBuffer<T>& buffer, u32 n_elements)
+	inline T* push_elements(MemoryBuffer<T>& buffer, u64 n_elements)
 	{
 		assert(n_elements > 0);
 
@@ -120,7 +120,7 @@ namespace memory_buffer
 
 
 	template <typename T>
-	inline void pop_elements(MemoryBuffer<T>& buffer, u32 n_elements)
+	inline void pop_elements(MemoryBuffer<T>& buffer, u64 n_elements)
 	{
 		if (!n_elements)
 		{
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.hpp"
+
+
+// splitmix64, one add and a few multiply/xorshifts per number
+class Rng
+{
+public:
+    u64 state = 0;
+};
+
+
+namespace rng
+{
+    inline Rng seed(u64 value)
+    {
+        Rng rng{};
+        rng.state = value;
+
+        return rng;
+    }
+
+
+    // independent stream for each (seed, key) pair
+    inline Rng seed(u64 value, u64 key)
+    {
+        return seed(value ^ (key * 0x9e3779b97f4a7c15));
+    }
+
+
+    inline u64 next_u64(Rng& rng)
+    {
+        u64 z = (rng.state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+        return z ^ (z >> 31);
+    }
+
+
+    // [0, n), multiply-shift instead of modulo
+    inline u32 next_below(Rng& rng, u32 n)
+    {
+        return (u32)(((next_u64(rng) >> 32) * n) >> 32);
+    }
+
+
+    // Fisher-Yates
+    template <typename T>
+    inline void shuffle(Rng& rng, T* data, u32 length)
+    {
+        for (u32 i = length; i > 1; i--)
+        {
+            auto j = next_below(rng, i);
+
+            auto tmp = data[i - 1];
+            data[i - 1] = data[j];
+            data[j] = tmp;
+        }
+    }
+}
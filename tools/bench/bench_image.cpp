@@ -0,0 +1,204 @@
+#include "../../libs/image/image.hpp"
+#include "../../libs/util/stopwatch.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+
+namespace img = image;
+
+
+class ImageSize
+{
+public:
+    u32 width;
+    u32 height;
+    cstr name;
+};
+
+
+template <class FN>
+static f64 mpix_per_sec(u32 n_pixels, FN const& fn)
+{
+    Stopwatch sw;
+
+    // warm up
+    fn();
+
+    u32 n_runs = 0;
+    sw.start();
+
+    while (n_runs < 3 || sw.get_time_milli() < 250.0)
+    {
+        fn();
+        n_runs++;
+    }
+
+    auto sec = sw.get_time_sec() / n_runs;
+
+    return n_pixels / sec / 1e6;
+}
+
+
+// mpix/s of gradient_x, gradient_y
+static void bench_gradient(ImageSize const& size, f64* res)
+{
+    auto w = size.width;
+    auto h = size.height;
+
+    auto buffer = img::create_buffer8(w * h + (w - 2) * (h - 2), "bench gradient");
+    if (!buffer.ok)
+    {
+        printf("%s: allocation failed\n", size.name);
+        return;
+    }
+
+    auto src = img::make_view(w, h, buffer);
+    auto dst = img::make_view(w - 2, h - 2, buffer);
+
+    for (u32 i = 0; i < w * h; i++)
+    {
+        src.matrix_data_[i] = (u8)rand();
+    }
+
+    auto n_pixels = dst.width * dst.height;
+
+    res[0] = mpix_per_sec(n_pixels, [&](){ img::gradient_x(src, dst); });
+    res[1] = mpix_per_sec(n_pixels, [&](){ img::gradient_y(src, dst); });
+
+    mb::destroy_buffer(buffer);
+}
+
+
+// the cnn features the old way, u8 gradient and pool images then f32
+static void gradient_then_pool(img::GrayView const& src, img::GrayView const& grad, img::GrayView const& pool, SpanView<f32> const& dst)
+{
+    constexpr auto F = 1.0f / 255.0f;
+
+    auto len = pool.width * pool.height;
+
+    img::gradient_x(src, grad);
+    img::scale_down_max(grad, pool);
+
+    for (u32 i = 0; i < len; i++)
+    {
+        dst.data[i] = F * pool.matrix_data_[i];
+    }
+
+    img::gradient_y(src, grad);
+    img::scale_down_max(grad, pool);
+
+    for (u32 i = 0; i < len; i++)
+    {
+        dst.data[len + i] = F * pool.matrix_data_[i];
+    }
+}
+
+
+// mpix/s of the separate passes, fused gradient_pool
+static void bench_gradient_pool(ImageSize const& size, f64* res)
+{
+    auto w = size.width;
+    auto h = size.height;
+
+    auto gw = w - 2;
+    auto gh = h - 2;
+    auto pw = gw / 2;
+    auto ph = gh / 2;
+
+    auto buffer = img::create_buffer8(w * h + gw * gh + pw * ph, "bench gradient pool");
+    if (!buffer.ok)
+    {
+        printf("%s: allocation failed\n", size.name);
+        return;
+    }
+
+    MemoryBuffer<f32> features;
+    if (!mb::create_buffer(features, 2 * pw * ph, "bench features"))
+    {
+        mb::destroy_buffer(buffer);
+        printf("%s: allocation failed\n", size.name);
+        return;
+    }
+
+    auto src = img::make_view(w, h, buffer);
+    auto grad = img::make_view(gw, gh, buffer);
+    auto pool = img::make_view(pw, ph, buffer);
+    auto dst = span::to_span(mb::push_elements(features, 2 * pw * ph), 2 * pw * ph);
+
+    for (u32 i = 0; i < w * h; i++)
+    {
+        src.matrix_data_[i] = (u8)rand();
+    }
+
+    auto n_pixels = w * h;
+
+    res[0] = mpix_per_sec(n_pixels, [&](){ gradient_then_pool(src, grad, pool, dst); });
+    res[1] = mpix_per_sec(n_pixels, [&](){ img::gradient_pool(src, dst); });
+
+    mb::destroy_buffer(features);
+    mb::destroy_buffer(buffer);
+}
+
+
+int main()
+{
+    ImageSize sizes[] = {
+        { 28,   28,   "mnist 28 x 28" },
+        { 128,  128,  "128 x 128" },
+        { 512,  512,  "512 x 512" },
+        { 1920, 1080, "1920 x 1080" },
+    };
+
+    constexpr u32 N_SIZES = sizeof(sizes) / sizeof(sizes[0]);
+
+    f64 scalar[N_SIZES][2] = { 0 };
+
+    auto const max_level = (u8)span::simd_level();
+
+    // same binary, each instruction set the cpu supports
+    for (u8 level = 0; level <= max_level; level++)
+    {
+        auto used = span::set_simd_level((span::SimdLevel)level);
+
+        printf("\n%s: image::gradient_x, image::gradient_y\n", span::simd_level_str(used));
+
+        for (u32 i = 0; i < N_SIZES; i++)
+        {
+            f64 res[2] = { 0 };
+            bench_gradient(sizes[i], res);
+
+            if (level == 0)
+            {
+                scalar[i][0] = res[0];
+                scalar[i][1] = res[1];
+            }
+
+            printf("%-16s | x %8.1f Mpix/s (x%4.1f) | y %8.1f Mpix/s (x%4.1f)\n",
+                sizes[i].name, res[0], res[0] / scalar[i][0], res[1], res[1] / scalar[i][1]);
+        }
+
+        printf("%s: cnn features, separate passes vs image::gradient_pool\n", span::simd_level_str(used));
+
+        for (u32 i = 0; i < N_SIZES; i++)
+        {
+            f64 res[2] = { 0 };
+            bench_gradient_pool(sizes[i], res);
+
+            printf("%-16s | passes %8.1f Mpix/s | fused %8.1f Mpix/s | x%.1f\n",
+                sizes[i].name, res[0], res[1], res[1] / res[0]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+#include "../../libs/image/image.cpp"
+#include "../../libs/span/span.cpp"
+#include "../../libs/alloc_type/alloc_type.cpp"
+#include "../../libs/qsprintf/qsprintf.cpp"
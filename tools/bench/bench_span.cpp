@@ -0,0 +1,233 @@
+#include "../../libs/span/span.hpp"
+#include "../../libs/util/stopwatch.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+
+using Matrix32 = MatrixView2D<f32>;
+
+
+class GemmSize
+{
+public:
+    u32 m;
+    u32 n;
+    u32 k;
+    cstr name;
+};
+
+
+static Matrix32 push_matrix(u32 width, u32 height, MemoryBuffer<f32>& buffer)
+{
+    Matrix32 mat{};
+    mat.width = width;
+    mat.height = height;
+    mat.matrix_data_ = mb::push_elements(buffer, width * height);
+
+    for (u32 i = 0; i < width * height; i++)
+    {
+        mat.matrix_data_[i] = (f32)rand() / RAND_MAX - 0.5f;
+    }
+
+    return mat;
+}
+
+
+static SpanView<f32> row_span(Matrix32 const& mat, u32 y)
+{
+    return span::to_span(mat.matrix_data_ + (u64)y * mat.width, mat.width);
+}
+
+
+// C = A * B^T the way the network did it, one span::dot per element
+static void naive_gemm_bt(Matrix32 const& a, Matrix32 const& b, Matrix32 const& c)
+{
+    for (u32 i = 0; i < c.height; i++)
+    {
+        auto a_row = row_span(a, i);
+        auto c_row = row_span(c, i);
+
+        for (u32 j = 0; j < c.width; j++)
+        {
+            c_row.data[j] = span::dot(a_row, row_span(b, j));
+        }
+    }
+}
+
+
+template <class FN>
+static f64 gflops(GemmSize const& size, FN const& fn)
+{
+    Stopwatch sw;
+
+    // warm up
+    fn();
+
+    u32 n_runs = 0;
+    sw.start();
+
+    while (n_runs < 3 || sw.get_time_milli() < 250.0)
+    {
+        fn();
+        n_runs++;
+    }
+
+    auto sec = sw.get_time_sec() / n_runs;
+    auto flop = 2.0 * size.m * size.n * size.k;
+
+    return flop / sec / 1e9;
+}
+
+
+static void bench_gemm(GemmSize const& size)
+{
+    MemoryBuffer<f32> buffer;
+    auto n_elements = size.m * size.k + size.n * size.k + size.m * size.n + span::GEMM_SCRATCH_ELEMENTS + 16;
+
+    if (!mb::create_buffer(buffer, n_elements, "bench gemm"))
+    {
+        printf("%s: allocation failed\n", size.name);
+        return;
+    }
+
+    auto a = push_matrix(size.k, size.m, buffer);
+    auto b = push_matrix(size.k, size.n, buffer);
+    auto c = push_matrix(size.n, size.m, buffer);
+
+    // 64 byte aligned
+    auto pad = (16 - (uintptr_t)(buffer.data_ + buffer.size_) / sizeof(f32) % 16) % 16;
+    auto scratch = span::to_span(mb::push_elements(buffer, span::GEMM_SCRATCH_ELEMENTS + pad) + pad, span::GEMM_SCRATCH_ELEMENTS);
+
+    auto naive = gflops(size, [&](){ naive_gemm_bt(a, b, c); });
+    auto gemm = gflops(size, [&](){ span::gemm_bt(a, b, c, 1.0f, 0.0f, scratch); });
+
+    printf("%-24s %4u x %4u x %4u | dot %7.2f GFLOP/s | gemm %7.2f GFLOP/s | x%.1f\n",
+        size.name, size.m, size.n, size.k, naive, gemm, gemm / naive);
+
+    mb::destroy_buffer(buffer);
+}
+
+
+static void bench_vector(u32 length)
+{
+    MemoryBuffer<f32> buffer;
+
+    if (!mb::create_buffer(buffer, 2 * length, "bench vector"))
+    {
+        printf("%u: allocation failed\n", length);
+        return;
+    }
+
+    auto x = push_matrix(length, 1, buffer);
+    auto y = push_matrix(length, 1, buffer);
+
+    auto sx = row_span(x, 0);
+    auto sy = row_span(y, 0);
+
+    GemmSize size = { 1, 1, length, "" };
+
+    f32 res = 0.0f;
+    auto dot = gflops(size, [&](){ res += span::dot(sx, sy); });
+    auto axpy = gflops(size, [&](){ span::axpy(1e-6f, sx, sy); });
+
+    printf("%-24s %18u | dot %7.2f GFLOP/s | axpy %7.2f GFLOP/s\n", "vector", length, dot, axpy);
+
+    mb::destroy_buffer(buffer);
+}
+
+
+// one forward layer the old way, gemv then bias and reLU per neuron
+static void gemv_then_bias_relu(Matrix32 const& w, SpanView<f32> const& x, SpanView<f32> const& bias, SpanView<f32> const& y)
+{
+    span::gemv(w, x, y);
+
+    for (u32 o = 0; o < y.length; o++)
+    {
+        auto sum = y.data[o] + bias.data[o];
+        y.data[o] = sum < 0.0f ? 0.0f : sum;
+    }
+}
+
+
+static void bench_layer(GemmSize const& size)
+{
+    MemoryBuffer<f32> buffer;
+    auto n_elements = size.n * size.k + size.k + 2 * size.n;
+
+    if (!mb::create_buffer(buffer, n_elements, "bench layer"))
+    {
+        printf("%s: allocation failed\n", size.name);
+        return;
+    }
+
+    auto w = push_matrix(size.k, size.n, buffer);
+    auto x = row_span(push_matrix(size.k, 1, buffer), 0);
+    auto bias = row_span(push_matrix(size.n, 1, buffer), 0);
+    auto y = row_span(push_matrix(size.n, 1, buffer), 0);
+
+    auto split = gflops(size, [&](){ gemv_then_bias_relu(w, x, bias, y); });
+    auto fused = gflops(size, [&](){ span::gemv_bias_relu(w, x, bias, y); });
+
+    printf("%-24s %4u x %4u x %4u | gemv %6.2f GFLOP/s | fused %6.2f GFLOP/s | x%.1f\n",
+        size.name, size.m, size.n, size.k, split, fused, fused / split);
+
+    mb::destroy_buffer(buffer);
+}
+
+
+int main()
+{
+    GemmSize sizes[] = {
+        { 1,   128, 338, "single sample layer" },
+        { 32,  128, 338, "batch 32 input layer" },
+        { 256, 128, 338, "batch 256 input layer" },
+        { 256, 128, 128, "batch 256 inner layer" },
+        { 256, 256, 256, "square 256" },
+        { 512, 512, 512, "square 512" },
+    };
+
+    u32 lengths[] = { 338, 784, 4096 };
+
+    GemmSize layers[] = {
+        { 1, 128, 338, "forward input layer" },
+        { 1, 128, 128, "forward inner layer" },
+        { 1, 10,  128, "forward output layer" },
+    };
+
+    auto const max_level = (u8)span::simd_level();
+
+    // same binary, each instruction set the cpu supports
+    for (u8 level = 0; level <= max_level; level++)
+    {
+        auto used = span::set_simd_level((span::SimdLevel)level);
+
+        printf("\n%s: span::dot, span::axpy, forward layer, span::gemm_bt\n", span::simd_level_str(used));
+
+        for (auto length : lengths)
+        {
+            bench_vector(length);
+        }
+
+        for (auto const& size : layers)
+        {
+            bench_layer(size);
+        }
+
+        for (auto const& size : sizes)
+        {
+            bench_gemm(size);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+#include "../../libs/span/span.cpp"
+#include "../../libs/alloc_type/alloc_type.cpp"
+#include "../../libs/qsprintf/qsprintf.cpp"